@@ -0,0 +1,174 @@
+/* Host benchmark for the pattern search kernels in private/hs_search.hpp.
+ *
+ * Reports the throughput (MB/s of window data scanned) of every search kernel
+ * available on the host for a couple of pattern lengths, and the end-to-end
+ * throughput of the encoder, which uses whatever Locator::find_pattern()
+ * dispatches to. */
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "heatshrink_encoder.h"
+#include "hs_search.hpp"
+
+using heatshrink::Locator;
+
+typedef const uint8_t* (*find_fn)(const uint8_t* pattern, uint32_t patLen,
+    const uint8_t* data, uint32_t dataLen);
+
+typedef struct {
+    const char *name;
+    find_fn find;
+} kernel;
+
+#define WINDOW_SZ2 12
+#define WINDOW_SZ (1 << WINDOW_SZ2)
+#define BENCH_BYTES (256L * 1024 * 1024)
+#define ENCODE_BYTES (4L * 1024 * 1024)
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void fill_with_pseudorandom_letters(uint8_t *buf, size_t size, uint32_t seed) {
+    uint64_t rn = 9223372036854775783u; /* prime under 2^64 */
+    for (size_t i=0; i<size; i++) {
+        rn = rn*seed + seed;
+        buf[i] = (rn % 26) + 'a';
+    }
+}
+
+/* Scan the window over and over for a pattern which starts and ends with
+ * letters (so there are candidates to verify) but never fully matches. */
+static double bench_kernel(const kernel *k, const uint8_t *window, uint32_t pat_len) {
+    uint8_t pattern[32];
+    memset(pattern, '{', sizeof(pattern));
+    pattern[0] = 'e';
+    /* A 2-byte pattern has no middle to mismatch, so it never matches at all. */
+    pattern[pat_len-1] = (pat_len == 2) ? '{' : 't';
+
+    const long iterations = BENCH_BYTES / WINDOW_SZ;
+    const uint8_t *volatile sink = NULL;
+    double t0 = now();
+    for (long i=0; i<iterations; i++) {
+        sink = k->find(pattern, pat_len, window, WINDOW_SZ);
+    }
+    double t = now() - t0;
+    (void)sink;
+    return (iterations * (double)WINDOW_SZ) / t / 1e6;
+}
+
+typedef heatshrink::byte_span (*longest_fn)(const uint8_t* pattern, uint32_t patLen,
+    const uint8_t* data, uint32_t dataLen, uint32_t maxMatches, uint32_t goodLen);
+
+/* Longest match of every position of a window of highly repetitive data in the
+ * window before it, i.e. many successively longer matches per search. */
+static double bench_longest(longest_fn find, const uint8_t *buf) {
+    const long iterations = 64;
+    uint32_t total = 0;
+    double t0 = now();
+    for (long i=0; i<iterations; i++) {
+        for (uint32_t pos=0; pos<WINDOW_SZ; pos += 61) {
+            total += find(&buf[WINDOW_SZ + pos], 32, &buf[pos], WINDOW_SZ, UINT32_MAX, UINT32_MAX).size();
+        }
+    }
+    double t = now() - t0;
+    (void)total;
+    return (iterations * (double)WINDOW_SZ * WINDOW_SZ / 61) / t / 1e6;
+}
+
+static double bench_encoder(const uint8_t *input, size_t input_size) {
+    heatshrink_encoder *hse = heatshrink_encoder_alloc(WINDOW_SZ2, 4);
+    if (hse == NULL) { return 0; }
+    uint8_t out[4096];
+    size_t sunk = 0, count = 0, compressed = 0;
+
+    double t0 = now();
+    while (sunk < input_size) {
+        heatshrink_encoder_sink(hse, &input[sunk], input_size - sunk, &count);
+        sunk += count;
+        if (sunk == input_size) { heatshrink_encoder_finish(hse); }
+        HSE_poll_res pres;
+        do {
+            pres = heatshrink_encoder_poll(hse, out, sizeof(out), &count);
+            compressed += count;
+        } while (pres == HSER_POLL_MORE);
+    }
+    while (heatshrink_encoder_finish(hse) == HSER_FINISH_MORE) {
+        heatshrink_encoder_poll(hse, out, sizeof(out), &count);
+        compressed += count;
+    }
+    double t = now() - t0;
+    heatshrink_encoder_free(hse);
+    printf("encoder (-w %d -l 4): %zu -> %zu bytes, %8.1f MB/s\n",
+        WINDOW_SZ2, input_size, compressed, input_size / t / 1e6);
+    return input_size / t / 1e6;
+}
+
+int main(void) {
+    /* Room for patterns to extend beyond the end of the window. */
+    uint8_t *window = (uint8_t *)malloc(WINDOW_SZ + 64);
+    if (window == NULL) { return 1; }
+    fill_with_pseudorandom_letters(window, WINDOW_SZ, 3);
+    memset(&window[WINDOW_SZ], '{', 64);
+
+    kernel kernels[7];
+    int kernel_count = 0;
+    kernels[kernel_count++] = kernel{ "scalar", Locator::find_pattern_scalar };
+#if defined(__x86_64__) || defined(__i386__)
+    if (heatshrink::Arch::X86_SSE2) {
+        kernels[kernel_count++] = kernel{ "sse2", Locator::find_pattern_sse2 };
+        if (Locator::cpu_has_avx2()) {
+            kernels[kernel_count++] = kernel{ "avx2", Locator::find_pattern_avx2 };
+        }
+    }
+#endif
+    if (heatshrink::Arch::VECTOR_EXT) {
+        kernels[kernel_count++] = kernel{ "vector", Locator::find_pattern_vec };
+    }
+    kernels[kernel_count++] = kernel{ "find_pattern", Locator::find_pattern };
+    kernels[kernel_count++] = kernel{ "scalar bwd", Locator::find_pattern_backward_scalar };
+    if (heatshrink::Arch::VECTOR_EXT) {
+        kernels[kernel_count++] = kernel{ "vector bwd", Locator::find_pattern_backward_vec };
+    }
+
+    static const uint32_t pat_lens[] = { 2, 3, 4, 8, 16 };
+    printf("%-14s", "kernel MB/s");
+    for (size_t p=0; p<sizeof(pat_lens)/sizeof(pat_lens[0]); p++) {
+        printf("  len %-4u", pat_lens[p]);
+    }
+    printf("\n");
+    for (int k=0; k<kernel_count; k++) {
+        printf("%-14s", kernels[k].name);
+        for (size_t p=0; p<sizeof(pat_lens)/sizeof(pat_lens[0]); p++) {
+            printf("  %8.1f", bench_kernel(&kernels[k], window, pat_lens[p]));
+        }
+        printf("\n");
+    }
+
+    /* Short random phrases repeated with variations */
+    uint8_t *rep = (uint8_t *)malloc(2 * WINDOW_SZ + 64);
+    if (rep == NULL) { return 1; }
+    fill_with_pseudorandom_letters(rep, 2 * WINDOW_SZ + 64, 5);
+    for (uint32_t i=0; i<2 * WINDOW_SZ + 64; i++) {
+        if (rep[i] > 'c') { rep[i] = "abcabcabd"[i % 9]; }
+    }
+    printf("longest match MB/s: rescan %8.1f  find_longest_match %8.1f  backward %8.1f\n",
+        bench_longest(Locator::find_longest_match_rescan, rep),
+        bench_longest(Locator::find_longest_match, rep),
+        bench_longest(Locator::find_longest_match_backward, rep));
+    free(rep);
+
+    uint8_t *input = (uint8_t *)malloc(ENCODE_BYTES);
+    if (input == NULL) { return 1; }
+    fill_with_pseudorandom_letters(input, ENCODE_BYTES, 7);
+    bench_encoder(input, ENCODE_BYTES);
+
+    free(input);
+    free(window);
+    return 0;
+}
@@ -1,3 +1,6 @@
+/* pwrite() under -std=c99 */
+#define _XOPEN_SOURCE 700
+
 #include <stdlib.h>
 #include <stdio.h>
 #include <unistd.h>
@@ -6,6 +9,8 @@
 #include <string.h>
 #include <fcntl.h>
 #include <getopt.h>
+#include <pthread.h>
+#include <sys/stat.h>
 
 #include "heatshrink_encoder.h"
 #include "heatshrink_decoder.h"
@@ -14,6 +19,8 @@
 #define DEF_LOOKAHEAD_SZ2 4
 #define DEF_DECODER_INPUT_BUFFER_SIZE 256
 #define DEF_BUFFER_SIZE (64 * 1024)
+#define DEF_BLOCK_SIZE (1024 * 1024)
+#define MAX_THREADS 256
 
 #if 0
 #define LOG(...) fprintf(stderr, __VA_ARGS__)
@@ -53,7 +60,7 @@ static void usage(void) {
     fprintf(stderr, "Home page: %s\n\n", url);
     fprintf(stderr,
         "Usage:\n"
-        "  heatshrink [-h] [-e|-d] [-v] [-w SIZE] [-l BITS] [IN_FILE] [OUT_FILE]\n"
+        "  heatshrink [-h] [-e|-d] [-v] [-p] [-1..-9|-O] [-D FILE] [-j N] [-w SIZE] [-l BITS] [IN_FILE] [OUT_FILE]\n"
         "\n"
         "heatshrink compresses or decompresses byte streams using LZSS, and is\n"
         "designed especially for embedded, low-memory, and/or hard real-time\n"
@@ -63,6 +70,15 @@ static void usage(void) {
         " -e        encode (compress, default)\n"
         " -d        decode (decompress)\n"
         " -v        verbose (print input & output sizes, compression ratio, etc.)\n"
+        " -p        heatshrink+ format (range coded, smaller; needs -p to decode)\n"
+        " -1..-9    bound the search effort per byte, from fastest to slowest\n"
+        "           (default: unbounded)\n"
+        " -O        maximize compression ratio (optimal parse; much slower, for\n"
+        "           compressing once on a host, output decodes as usual)\n"
+        " -D FILE   preset the window with (the end of) FILE as a dictionary;\n"
+        "           needs the same -D FILE to decode\n"
+        " -j N      framed container of independent blocks, compressed on N\n"
+        "           threads (0: one per core); needs -j to decode\n"
         "\n"
         " -w SIZE   Base-2 log of LZSS sliding window size\n"
         "\n"
@@ -99,8 +115,15 @@ typedef struct {
 typedef struct {
     uint8_t window_sz2;
     uint8_t lookahead_sz2;
+    uint8_t level;
+    uint8_t plus;
+    uint8_t *dict;              /* preset dictionary, or NULL */
+    size_t dict_size;
     size_t decoder_input_buffer_size;
     size_t buffer_size;
+    uint8_t framed;             /* framed container (-j) */
+    unsigned threads;
+    size_t block_size;
     uint8_t verbose;
     Operation cmd;
     char *in_fname;
@@ -116,6 +139,29 @@ static void die(char *msg) {
 
 static void report(config *cfg);
 
+/* Read the dictionary file FNAME into CFG. */
+static void load_dictionary(config *cfg, const char *fname) {
+    FILE *f = fopen(fname, "rb");
+    if (f == NULL) { HEATSHRINK_ERR(1, "open %s", fname); }
+    size_t size = 0, cap = 4096;
+    uint8_t *dict = malloc(cap);
+    size_t n;
+    while (dict != NULL && (n = fread(&dict[size], 1, cap - size, f)) > 0) {
+        size += n;
+        if (size == cap) {
+            cap *= 2;
+            uint8_t *grown = realloc(dict, cap);
+            if (grown == NULL) { free(dict); }
+            dict = grown;
+        }
+    }
+    if (dict == NULL) { die("dictionary: out of memory"); }
+    if (ferror(f)) { HEATSHRINK_ERR(1, "read %s", fname); }
+    fclose(f);
+    cfg->dict = dict;
+    cfg->dict_size = size;
+}
+
 /* Open an IO handle. Returns NULL on error. */
 static io_handle *handle_open(char *fname, IO_mode m, size_t buf_sz) {
     io_handle *io = NULL;
@@ -277,11 +323,34 @@ static int encoder_sink_read(config *cfg, heatshrink_encoder *hse,
     return 0;
 }
 
+static heatshrink_encoder *encoder_alloc(config *cfg) {
+    heatshrink_encoder *hse = NULL;
+    if (cfg->plus) {
+#if HEATSHRINK_32BIT
+        hse = heatshrink_encoder_alloc_plus(cfg->window_sz2, cfg->lookahead_sz2, cfg->level);
+#else
+        die("heatshrink+ needs the 32-bit variant");
+#endif
+    } else {
+        hse = heatshrink_encoder_alloc_ex(cfg->window_sz2, cfg->lookahead_sz2, cfg->level);
+    }
+    if (hse == NULL) { die("failed to init encoder: bad settings"); }
+    return hse;
+}
+
+/* Preset a new or reset encoder's window with the dictionary, if any. */
+static void encoder_start(config *cfg, heatshrink_encoder *hse) {
+    if (cfg->dict != NULL &&
+        heatshrink_encoder_set_dictionary(hse, cfg->dict, cfg->dict_size) < 0) {
+        die("set_dictionary");
+    }
+}
+
 static int encode(config *cfg) {
     uint8_t window_sz2 = cfg->window_sz2;
     size_t window_sz = 1 << window_sz2; 
-    heatshrink_encoder *hse = heatshrink_encoder_alloc(window_sz2, cfg->lookahead_sz2);
-    if (hse == NULL) { die("failed to init encoder: bad settings"); }
+    heatshrink_encoder *hse = encoder_alloc(cfg);
+    encoder_start(cfg, hse);
     ssize_t read_sz = 0;
     io_handle *in = cfg->in;
 
@@ -304,6 +373,7 @@ static int encode(config *cfg) {
     if (read_sz == -1) { HEATSHRINK_ERR(1, "read"); }
 
     heatshrink_encoder_free(hse);
+    free(cfg->dict);
     close_and_report(cfg);
     return 0;
 }
@@ -345,13 +415,36 @@ static int decoder_sink_read(config *cfg, heatshrink_decoder *hsd,
     return 0;
 }
 
+static heatshrink_decoder *decoder_alloc(config *cfg,
+        uint8_t window_sz2, uint8_t lookahead_sz2, uint8_t plus) {
+    size_t ibs = cfg->decoder_input_buffer_size;
+    heatshrink_decoder *hsd = NULL;
+    if (plus) {
+#if HEATSHRINK_32BIT
+        hsd = heatshrink_decoder_alloc_plus(ibs, window_sz2, lookahead_sz2);
+#else
+        die("heatshrink+ needs the 32-bit variant");
+#endif
+    } else {
+        hsd = heatshrink_decoder_alloc(ibs, window_sz2, lookahead_sz2);
+    }
+    if (hsd == NULL) { die("failed to init decoder"); }
+    return hsd;
+}
+
+/* Preset a new or reset decoder's window with the dictionary, if any. */
+static void decoder_start(config *cfg, heatshrink_decoder *hsd) {
+    if (cfg->dict != NULL &&
+        heatshrink_decoder_set_dictionary(hsd, cfg->dict, cfg->dict_size) < 0) {
+        die("set_dictionary");
+    }
+}
+
 static int decode(config *cfg) {
     uint8_t window_sz2 = cfg->window_sz2;
     size_t window_sz = 1 << window_sz2;
-    size_t ibs = cfg->decoder_input_buffer_size;
-    heatshrink_decoder *hsd = heatshrink_decoder_alloc(ibs,
-        window_sz2, cfg->lookahead_sz2);
-    if (hsd == NULL) { die("failed to init decoder"); }
+    heatshrink_decoder *hsd = decoder_alloc(cfg, window_sz2, cfg->lookahead_sz2, cfg->plus);
+    decoder_start(cfg, hsd);
 
     ssize_t read_sz = 0;
 
@@ -381,6 +474,402 @@ static int decode(config *cfg) {
     if (read_sz == -1) { HEATSHRINK_ERR(1, "read"); }
         
     heatshrink_decoder_free(hsd);
+    free(cfg->dict);
+    close_and_report(cfg);
+    return 0;
+}
+
+/* Framed container (-j): a magic, followed by independent blocks of up to
+ * cfg->block_size input bytes. Each block has a header of FRAME_HEADER_SIZE
+ * bytes, with the window and lookahead bits, FRAME_FLAG_* flags, a zero byte,
+ * and the compressed and raw sizes as little-endian 32-bit values, followed
+ * by the compressed data, which starts with an empty (or dictionary) window. */
+static const uint8_t frame_magic[4] = { 'H', 'S', 'F', 1 };
+#define FRAME_HEADER_SIZE 12
+#define FRAME_FLAG_PLUS 0x01
+#define FRAME_FLAG_DICTIONARY 0x02
+
+static void put_le32(uint8_t *p, uint32_t v) {
+    p[0] = v; p[1] = v >> 8; p[2] = v >> 16; p[3] = v >> 24;
+}
+
+static uint32_t get_le32(const uint8_t *p) {
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+/* Read up to SIZE bytes into BUF, bypassing the IO handle's buffer.
+ * Returns the number of bytes read, less than SIZE only at EOF. */
+static size_t handle_read_full(io_handle *io, uint8_t *buf, size_t size) {
+    size_t got = 0;
+    while (got < size && io->fd != -1) {
+        ssize_t read_sz = read(io->fd, &buf[got], size - got);
+        if (read_sz < 0) { HEATSHRINK_ERR(1, "read"); }
+        if (read_sz == 0) {     /* EOF */
+            if (close(io->fd) < 0) { HEATSHRINK_ERR(1, "close"); }
+            io->fd = -1;
+        }
+        got += read_sz;
+    }
+    io->total += got;
+    return got;
+}
+
+/* Write SIZE bytes from BUF, bypassing the IO handle's buffer. */
+static void handle_write_full(io_handle *io, const uint8_t *buf, size_t size) {
+    size_t put = 0;
+    while (put < size) {
+        ssize_t written = write(io->fd, &buf[put], size - put);
+        if (written == -1) { HEATSHRINK_ERR(1, "write"); }
+        put += written;
+    }
+    io->total += put;
+}
+
+/* A block in flight. Blocks are numbered in input order and take turns
+ * in the pool's ring of slots, so that they are written in order. */
+typedef enum { SLOT_FREE, SLOT_QUEUED, SLOT_DONE, } slot_state;
+
+typedef struct {
+    slot_state state;
+    uint8_t *in;                /* input: raw data, or header and compressed data */
+    size_t in_size;
+    size_t in_cap;
+    uint8_t *out;               /* output: header and compressed data, or raw data */
+    size_t out_size;
+    size_t out_cap;
+    off_t out_offset;           /* where the output goes, if written directly */
+} slot;
+
+typedef struct {
+    config *cfg;
+    pthread_mutex_t lock;
+    pthread_cond_t queued;      /* a block was queued, or the pool stops */
+    pthread_cond_t done;        /* a block is done */
+    slot *slots;
+    size_t slot_count;
+    size_t queued_count;        /* blocks queued so far */
+    size_t taken;               /* blocks taken by the workers so far */
+    int stop;
+    int direct;                 /* workers write their output at out_offset */
+    pthread_t threads[MAX_THREADS];
+} pool;
+
+static void pool_init(pool *p, config *cfg) {
+    memset(p, 0, sizeof(*p));
+    p->cfg = cfg;
+    p->slot_count = 2 * cfg->threads;
+    p->slots = calloc(p->slot_count, sizeof(slot));
+    if (p->slots == NULL) { die("pool: out of memory"); }
+    pthread_mutex_init(&p->lock, NULL);
+    pthread_cond_init(&p->queued, NULL);
+    pthread_cond_init(&p->done, NULL);
+}
+
+static void pool_start(pool *p, void *(*worker)(void *)) {
+    for (unsigned i = 0; i < p->cfg->threads; i++) {
+        if (pthread_create(&p->threads[i], NULL, worker, p) != 0) {
+            die("pthread_create");
+        }
+    }
+}
+
+/* Hand the block in S to the workers. */
+static void pool_queue(pool *p, slot *s) {
+    pthread_mutex_lock(&p->lock);
+    s->state = SLOT_QUEUED;
+    p->queued_count++;
+    pthread_cond_signal(&p->queued);
+    pthread_mutex_unlock(&p->lock);
+}
+
+/* Take the next queued block, in order. Returns NULL once the pool stops. */
+static slot *pool_take(pool *p) {
+    slot *s = NULL;
+    pthread_mutex_lock(&p->lock);
+    while (p->taken == p->queued_count && !p->stop) {
+        pthread_cond_wait(&p->queued, &p->lock);
+    }
+    if (p->taken < p->queued_count) { s = &p->slots[p->taken++ % p->slot_count]; }
+    pthread_mutex_unlock(&p->lock);
+    return s;
+}
+
+static void pool_done(pool *p, slot *s) {
+    pthread_mutex_lock(&p->lock);
+    s->state = SLOT_DONE;
+    pthread_cond_broadcast(&p->done);
+    pthread_mutex_unlock(&p->lock);
+}
+
+/* Wait for the block in S to be processed, write it (unless the worker
+ * already did), and free the slot. */
+static void write_block(pool *p, slot *s) {
+    pthread_mutex_lock(&p->lock);
+    while (s->state != SLOT_DONE) { pthread_cond_wait(&p->done, &p->lock); }
+    s->state = SLOT_FREE;
+    pthread_mutex_unlock(&p->lock);
+    if (p->direct) {
+        p->cfg->out->total += s->out_size;
+    } else {
+        handle_write_full(p->cfg->out, s->out, s->out_size);
+    }
+}
+
+/* Stop the workers once the queued blocks are done, and free the pool. */
+static void pool_finish(pool *p) {
+    pthread_mutex_lock(&p->lock);
+    p->stop = 1;
+    pthread_cond_broadcast(&p->queued);
+    pthread_mutex_unlock(&p->lock);
+    for (unsigned i = 0; i < p->cfg->threads; i++) { pthread_join(p->threads[i], NULL); }
+
+    pthread_cond_destroy(&p->done);
+    pthread_cond_destroy(&p->queued);
+    pthread_mutex_destroy(&p->lock);
+    for (size_t i = 0; i < p->slot_count; i++) {
+        free(p->slots[i].in);
+        free(p->slots[i].out);
+    }
+    free(p->slots);
+}
+
+/* Make room for SIZE more output bytes in S. */
+static void slot_reserve(slot *s, size_t size) {
+    if (s->out_size + size <= s->out_cap) { return; }
+    size_t cap = s->out_cap * 2;
+    if (cap < s->out_size + size) { cap = s->out_size + size; }
+    uint8_t *out = realloc(s->out, cap);
+    if (out == NULL) { die("block: out of memory"); }
+    s->out = out;
+    s->out_cap = cap;
+}
+
+/* Make room for SIZE input bytes in S. */
+static void slot_reserve_in(slot *s, size_t size) {
+    if (size <= s->in_cap) { return; }
+    free(s->in);
+    s->in = malloc(size);
+    if (s->in == NULL) { die("block: out of memory"); }
+    s->in_cap = size;
+}
+
+/* Compress the block in S with HSE, framed with its header. */
+static void compress_block(config *cfg, heatshrink_encoder *hse, slot *s) {
+    heatshrink_encoder_reset(hse);
+    encoder_start(cfg, hse);
+    s->out_size = FRAME_HEADER_SIZE;
+    size_t sunk = 0;
+    while (1) {
+        if (sunk < s->in_size) {
+            size_t sink_sz = 0;
+            if (heatshrink_encoder_sink(hse, &s->in[sunk],
+                    s->in_size - sunk, &sink_sz) < 0) {
+                die("sink");
+            }
+            sunk += sink_sz;
+        } else {
+            HSE_finish_res fres = heatshrink_encoder_finish(hse);
+            if (fres < 0) { die("finish"); }
+            if (fres == HSER_FINISH_DONE) { break; }
+        }
+
+        HSE_poll_res pres;
+        do {
+            slot_reserve(s, 4096);
+            size_t poll_sz = 0;
+            pres = heatshrink_encoder_poll(hse, &s->out[s->out_size],
+                s->out_cap - s->out_size, &poll_sz);
+            if (pres < 0) { die("poll"); }
+            s->out_size += poll_sz;
+        } while (pres == HSER_POLL_MORE);
+    }
+
+    uint8_t *h = s->out;
+    h[0] = cfg->window_sz2;
+    h[1] = cfg->lookahead_sz2;
+    h[2] = (cfg->plus ? FRAME_FLAG_PLUS : 0) | (cfg->dict != NULL ? FRAME_FLAG_DICTIONARY : 0);
+    h[3] = 0;
+    put_le32(&h[4], s->out_size - FRAME_HEADER_SIZE);
+    put_le32(&h[8], s->in_size);
+}
+
+/* Worker thread: compress the queued blocks, in order, with an encoder of its own. */
+static void *compress_worker(void *arg) {
+    pool *p = arg;
+    heatshrink_encoder *hse = encoder_alloc(p->cfg);
+    slot *s;
+    while ((s = pool_take(p)) != NULL) {
+        compress_block(p->cfg, hse, s);
+        pool_done(p, s);
+    }
+    heatshrink_encoder_free(hse);
+    return NULL;
+}
+
+/* Compress into the framed container: the main thread reads blocks into the
+ * free slots, and writes them out in order as the workers finish them. */
+static int encode_framed(config *cfg) {
+    pool p;
+    pool_init(&p, cfg);
+    for (size_t i = 0; i < p.slot_count; i++) {
+        slot *s = &p.slots[i];
+        slot_reserve_in(s, cfg->block_size);
+        slot_reserve(s, FRAME_HEADER_SIZE + heatshrink_compress_bound(cfg->block_size));
+    }
+    pool_start(&p, compress_worker);
+
+    handle_write_full(cfg->out, frame_magic, sizeof(frame_magic));
+    size_t count = 0, written = 0;
+    while (1) {
+        slot *s = &p.slots[count % p.slot_count];
+        if (count - written == p.slot_count) { write_block(&p, s); written++; }
+        s->in_size = handle_read_full(cfg->in, s->in, cfg->block_size);
+        if (s->in_size == 0) { break; }
+        pool_queue(&p, s);
+        count++;
+        if (s->in_size < cfg->block_size) { break; }
+    }
+    while (written < count) { write_block(&p, &p.slots[written++ % p.slot_count]); }
+
+    pool_finish(&p);
+    free(cfg->dict);
+    close_and_report(cfg);
+    return 0;
+}
+
+/* Decompress the framed block in S (header and compressed data) into its
+ * output, with *HSD if its settings PARAMS match the block's, or else a
+ * new decoder. */
+static void decompress_block(config *cfg, heatshrink_decoder **hsd,
+        uint8_t params[3], slot *s) {
+    const uint8_t *h = s->in;
+    const uint8_t *in = &s->in[FRAME_HEADER_SIZE];
+    size_t comp_size = s->in_size - FRAME_HEADER_SIZE;
+    size_t raw_size = get_le32(&h[8]);
+    if (*hsd == NULL || memcmp(params, h, 3) != 0) {
+        heatshrink_decoder_free(*hsd);
+        *hsd = decoder_alloc(cfg, h[0], h[1], (h[2] & FRAME_FLAG_PLUS) != 0);
+        memcpy(params, h, 3);
+    }
+    /* One spare byte to catch blocks longer than their header says. */
+    s->out_size = 0;
+    slot_reserve(s, raw_size + 1);
+
+    heatshrink_decoder_reset(*hsd);
+    /* Only blocks compressed with the dictionary start from it. */
+    if (h[2] & FRAME_FLAG_DICTIONARY) { decoder_start(cfg, *hsd); }
+    size_t sunk = 0, size = 0;
+    while (1) {
+        if (sunk < comp_size) {
+            size_t sink_sz = 0;
+            if (heatshrink_decoder_sink(*hsd, &in[sunk], comp_size - sunk, &sink_sz) < 0) {
+                die("sink");
+            }
+            sunk += sink_sz;
+        } else {
+            HSD_finish_res fres = heatshrink_decoder_finish(*hsd);
+            if (fres < 0) { die("finish"); }
+            if (fres == HSDR_FINISH_DONE) { break; }
+        }
+
+        HSD_poll_res pres;
+        do {
+            if (size > raw_size) { die("corrupt block"); }
+            size_t poll_sz = 0;
+            pres = heatshrink_decoder_poll(*hsd, &s->out[size], raw_size + 1 - size, &poll_sz);
+            if (pres < 0) { die("poll"); }
+            size += poll_sz;
+        } while (pres == HSDR_POLL_MORE);
+    }
+    if (size != raw_size) { die("corrupt block"); }
+    s->out_size = size;
+}
+
+/* Worker thread: decompress the queued blocks with a decoder of its own,
+ * writing each to its final offset in the output if the pool is direct. */
+static void *decompress_worker(void *arg) {
+    pool *p = arg;
+    heatshrink_decoder *hsd = NULL;
+    uint8_t params[3] = { 0 };
+    slot *s;
+    while ((s = pool_take(p)) != NULL) {
+        decompress_block(p->cfg, &hsd, params, s);
+        for (size_t put = 0; p->direct && put < s->out_size; ) {
+            ssize_t written = pwrite(p->cfg->out->fd, &s->out[put],
+                s->out_size - put, s->out_offset + put);
+            if (written == -1) { HEATSHRINK_ERR(1, "write"); }
+            put += written;
+        }
+        pool_done(p, s);
+    }
+    heatshrink_decoder_free(hsd);
+    return NULL;
+}
+
+/* Can blocks be written at their final offsets, rather than in order? */
+static int output_is_direct(io_handle *out) {
+#if _WIN32
+    (void)out;
+    return 0;
+#else
+    struct stat st;
+    if (fstat(out->fd, &st) < 0 || !S_ISREG(st.st_mode)) { return 0; }
+    int flags = fcntl(out->fd, F_GETFL);
+    return flags != -1 && !(flags & O_APPEND);
+#endif
+}
+
+/* Decompress the framed container: the main thread reads blocks into the
+ * free slots, and the workers decompress them concurrently. Into a regular
+ * file, each worker writes its block directly at the block's offset (known
+ * from the raw sizes of the blocks before it); otherwise the main thread
+ * writes the blocks in order. */
+static int decode_framed(config *cfg) {
+    uint8_t magic[sizeof(frame_magic)];
+    if (handle_read_full(cfg->in, magic, sizeof(magic)) != sizeof(magic) ||
+        memcmp(magic, frame_magic, sizeof(magic)) != 0) {
+        die("not a framed heatshrink container");
+    }
+
+    pool p;
+    pool_init(&p, cfg);
+    off_t offset = 0;
+    p.direct = output_is_direct(cfg->out);
+    if (p.direct) {
+        offset = lseek(cfg->out->fd, 0, SEEK_CUR);
+        if (offset < 0) { HEATSHRINK_ERR(1, "lseek"); }
+    }
+    pool_start(&p, decompress_worker);
+
+    size_t count = 0, written = 0;
+    while (1) {
+        slot *s = &p.slots[count % p.slot_count];
+        if (count - written == p.slot_count) { write_block(&p, s); written++; }
+        uint8_t h[FRAME_HEADER_SIZE];
+        size_t header_sz = handle_read_full(cfg->in, h, sizeof(h));
+        if (header_sz == 0) { break; }
+        if (header_sz < sizeof(h)) { die("truncated block header"); }
+        if ((h[2] & FRAME_FLAG_DICTIONARY) && cfg->dict == NULL) {
+            die("block needs a dictionary (-D FILE)");
+        }
+        size_t comp_size = get_le32(&h[4]);
+        slot_reserve_in(s, FRAME_HEADER_SIZE + comp_size);
+        memcpy(s->in, h, sizeof(h));
+        if (handle_read_full(cfg->in, &s->in[FRAME_HEADER_SIZE], comp_size) != comp_size) {
+            die("truncated block");
+        }
+        s->in_size = FRAME_HEADER_SIZE + comp_size;
+        s->out_offset = offset;
+        offset += get_le32(&h[8]);
+        pool_queue(&p, s);
+        count++;
+    }
+    while (written < count) { write_block(&p, &p.slots[written++ % p.slot_count]); }
+
+    pool_finish(&p);
+    /* Leave the output's position after the data, as sequential writes would. */
+    if (p.direct && lseek(cfg->out->fd, offset, SEEK_SET) < 0) { HEATSHRINK_ERR(1, "lseek"); }
+    free(cfg->dict);
     close_and_report(cfg);
     return 0;
 }
@@ -397,6 +886,7 @@ static void report(config *cfg) {
 static void proc_args(config *cfg, int argc, char **argv) {
     cfg->window_sz2 = DEF_WINDOW_SZ2;
     cfg->lookahead_sz2 = DEF_LOOKAHEAD_SZ2;
+    cfg->level = HEATSHRINK_LEVEL_DEFAULT;
     cfg->buffer_size = DEF_BUFFER_SIZE;
     cfg->decoder_input_buffer_size = DEF_DECODER_INPUT_BUFFER_SIZE;
     cfg->cmd = OP_ENC;
@@ -405,7 +895,7 @@ static void proc_args(config *cfg, int argc, char **argv) {
     cfg->out_fname = "-";
 
     int a = 0;
-    while ((a = getopt(argc, argv, "hedi:w:l:v")) != -1) {
+    while ((a = getopt(argc, argv, "hedi:w:l:vpOD:j:123456789")) != -1) {
         switch (a) {
         case 'h':               /* help */
             usage();
@@ -425,6 +915,23 @@ static void proc_args(config *cfg, int argc, char **argv) {
         case 'v':               /* verbosity++ */
             cfg->verbose++;
             break;
+        case 'p':               /* heatshrink+ format */
+            cfg->plus = 1;
+            break;
+        case 'D':               /* preset dictionary */
+            load_dictionary(cfg, optarg);
+            break;
+        case 'j':               /* framed container, threads */
+            cfg->framed = 1;
+            cfg->threads = atoi(optarg);
+            break;
+        case 'O':               /* max. compression ratio */
+            cfg->level = HEATSHRINK_LEVEL_MAX_RATIO;
+            break;
+        case '1': case '2': case '3': case '4': case '5':
+        case '6': case '7': case '8': case '9':
+            cfg->level = a - '0';   /* search effort level */
+            break;
         case '?':               /* unknown argument */
         default:
             usage();
@@ -451,6 +958,27 @@ int main(int argc, char **argv) {
         exit(1);
     }
 
+    /* Input is read a window at a time, and windows can exceed the default. */
+    if (cfg.window_sz2 <= HEATSHRINK_MAX_WINDOW_BITS &&
+        cfg.buffer_size < ((size_t)1 << cfg.window_sz2)) {
+        cfg.buffer_size = (size_t)1 << cfg.window_sz2;
+    }
+
+    if (cfg.framed) {
+        if (cfg.threads == 0) {
+            long cores = sysconf(_SC_NPROCESSORS_ONLN);
+            cfg.threads = cores > 0 ? cores : 1;
+        }
+        if (cfg.threads > MAX_THREADS) { cfg.threads = MAX_THREADS; }
+        /* Blocks start with an empty window, so make them long enough that
+         * this costs little. */
+        cfg.block_size = DEF_BLOCK_SIZE;
+        if (cfg.window_sz2 <= HEATSHRINK_MAX_WINDOW_BITS &&
+            cfg.block_size < ((size_t)8 << cfg.window_sz2)) {
+            cfg.block_size = (size_t)8 << cfg.window_sz2;
+        }
+    }
+
     cfg.in = handle_open(cfg.in_fname, IO_READ, cfg.buffer_size);
     if (cfg.in == NULL) { die("Failed to open input file for read"); }
     cfg.out = handle_open(cfg.out_fname, IO_WRITE, cfg.buffer_size);
@@ -466,9 +994,9 @@ int main(int argc, char **argv) {
 #endif
 
     if (cfg.cmd == OP_ENC) {
-        return encode(&cfg);
+        return cfg.framed ? encode_framed(&cfg) : encode(&cfg);
     } else if (cfg.cmd == OP_DEC) {
-        return decode(&cfg);
+        return cfg.framed ? decode_framed(&cfg) : decode(&cfg);
     } else {
         usage();
     }
@@ -0,0 +1,731 @@
+#ifndef HEATSHRINK_HPP
+#define HEATSHRINK_HPP
+
+/* Header-only C++ encoder and decoder with the window and lookahead sizes
+ * fixed at compile time, e.g.
+ *
+ *     heatshrink::Encoder<10,4> encoder;
+ *     heatshrink::Decoder<10,4,64> decoder;
+ *
+ * These run the same state machines as the 32-bit variant
+ * (heatshrink_encoder_32bit.cpp, heatshrink_decoder_32bit.cpp), with the
+ * same sink/poll/finish API and results, but all sizes, masks, bit counts
+ * and the break-even point are compile-time constants, so the branches on
+ * them fold away. Any number of configurations can be used side by side in
+ * one binary, and neither needs dynamic allocation.
+ *
+ * The output is the same as the C API's for the same window and lookahead
+ * sizes (greedy matching, i.e. without HEATSHRINK_USE_INDEX, HASH_CHAIN or
+ * LAZY_MATCHING; HEATSHRINK_SEARCH_NEAREST_FIRST applies to both), and either
+ * side can expand the other's. */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <algorithm>
+
+#include "heatshrink_common.h"
+#include "heatshrink_encoder.h"
+#include "heatshrink_decoder.h"
+#include "private/hs_search.hpp"
+
+namespace heatshrink {
+
+/**
+ * @brief Encoder for a window of 2^W bytes and backrefs of up to 2^L bytes.
+ */
+template<uint32_t W, uint32_t L>
+class Encoder {
+    static_assert(W >= HEATSHRINK_MIN_WINDOW_BITS && W <= HEATSHRINK_MAX_WINDOW_BITS,
+        "Window bits out of range.");
+    static_assert(L >= HEATSHRINK_MIN_LOOKAHEAD_BITS && L < W,
+        "Lookahead bits must be at least 3 and less than the window bits.");
+
+public:
+    static constexpr uint32_t WINDOW_BITS = W;
+    static constexpr uint32_t LOOKAHEAD_BITS = L;
+    static constexpr uint32_t WINDOW_SIZE = 1 << W;     /* also the size of the input buffer */
+    static constexpr uint32_t LOOKAHEAD_SIZE = 1 << L;
+    /* Matches must be longer than this to be shorter than the literals. */
+    static constexpr uint32_t BREAK_EVEN_POINT = (1 + W + L) / 8;
+
+    Encoder() noexcept {
+        reset();
+    }
+
+    void reset() noexcept {
+        memset(buffer, 0, sizeof(buffer));
+        input_size = 0;
+        state = NOT_FULL;
+        match_scan_index = 0;
+        match_length = 0;
+        match_pos = 0;
+        flags = 0;
+        bit_index = 0;
+        current_byte = 0x00;
+        outgoing_bits = 0x0000;
+        outgoing_bits_count = 0;
+    }
+
+    /* Preset the window with the last (up to WINDOW_SIZE) of the DICT_SIZE
+     * bytes at DICT, as heatshrink_encoder_set_dictionary. Call after
+     * construction or reset, before the first sink. */
+    HSE_dictionary_res set_dictionary(const uint8_t* dict, size_t dict_size) noexcept {
+        if (dict == nullptr && dict_size != 0) [[unlikely]] {
+            return HSER_DICTIONARY_ERROR_NULL;
+        }
+        if (is_finishing() || state != NOT_FULL || input_size != 0) [[unlikely]] {
+            return HSER_DICTIONARY_ERROR_MISUSE;
+        }
+        const size_t n = std::min(dict_size, (size_t)WINDOW_SIZE);
+        memcpy(&buffer[WINDOW_SIZE - n], dict + (dict_size - n), n);
+        return HSER_DICTIONARY_OK;
+    }
+
+    /* Sink up to SIZE bytes from IN_BUF into the encoder.
+     * INPUT_SIZE is set to the number of bytes actually sunk (in case a
+     * buffer was filled.). */
+    HSE_sink_res sink(const uint8_t* in_buf, size_t size, size_t* input_size) noexcept {
+        if ((in_buf == nullptr) || (input_size == nullptr)) [[unlikely]] {
+            return HSER_SINK_ERROR_NULL;
+        }
+        /* Sinking more content after saying the content is done, tsk tsk */
+        if (is_finishing()) [[unlikely]] { return HSER_SINK_ERROR_MISUSE; }
+        /* Sinking more content before processing is done */
+        if (state != NOT_FULL) [[unlikely]] { return HSER_SINK_ERROR_MISUSE; }
+
+        const uint32_t rem = WINDOW_SIZE - this->input_size;
+        const uint32_t cp_sz = rem < size ? rem : size;
+        memcpy(&buffer[WINDOW_SIZE + this->input_size], in_buf, cp_sz);
+        *input_size = cp_sz;
+        this->input_size += cp_sz;
+        if (cp_sz == rem) {
+            state = FILLED;
+        }
+        return HSER_SINK_OK;
+    }
+
+    /* Poll for output from the encoder, copying at most OUT_BUF_SIZE bytes into
+     * OUT_BUF (setting *OUTPUT_SIZE to the actual amount copied). */
+    HSE_poll_res poll(uint8_t* out_buf, size_t out_buf_size, size_t* output_size) noexcept {
+        if ((out_buf == nullptr) || (output_size == nullptr)) [[unlikely]] {
+            return HSER_POLL_ERROR_NULL;
+        }
+        if (out_buf_size == 0) [[unlikely]] {
+            return HSER_POLL_ERROR_MISUSE;
+        }
+        *output_size = 0;
+
+        output_info oi { out_buf, out_buf_size, output_size };
+
+        while (true) {
+            const uint8_t in_state = state;
+            switch (in_state) {
+            case NOT_FULL:
+                return HSER_POLL_EMPTY;
+            case FILLED:
+                state = SEARCH;
+                break;
+            case SEARCH:
+                state = st_step_search();
+                break;
+            case YIELD_TAG_BIT:
+                state = st_yield_tag_bit(oi);
+                break;
+            case YIELD_LITERAL:
+                state = st_yield_literal(oi);
+                break;
+            case YIELD_BR_INDEX:
+                state = st_yield_br_index(oi);
+                break;
+            case YIELD_BR_LENGTH:
+                state = st_yield_br_length(oi);
+                break;
+            case SAVE_BACKLOG:
+                save_backlog();
+                state = NOT_FULL;
+                break;
+            case FLUSH_BITS:
+                state = st_flush_bit_buffer(oi);
+                break;
+            case DONE:
+                return HSER_POLL_EMPTY;
+            default:
+                [[unlikely]]
+                return HSER_POLL_ERROR_MISUSE;
+            }
+
+            if (state == in_state) {
+                /* Check if output buffer is exhausted. */
+                if (*output_size == out_buf_size) { return HSER_POLL_MORE; }
+            }
+        }
+    }
+
+    /* Notify the encoder that the input stream is finished.
+     * If the return value is HSER_FINISH_MORE, there is still more output, so
+     * call poll and repeat. */
+    HSE_finish_res finish() noexcept {
+        flags |= FLAG_IS_FINISHING;
+        if (state == NOT_FULL) { state = FILLED; }
+        return state == DONE ? HSER_FINISH_DONE : HSER_FINISH_MORE;
+    }
+
+private:
+    enum : uint8_t {
+        NOT_FULL,               /* input buffer not full enough */
+        FILLED,                 /* buffer is full */
+        SEARCH,                 /* searching for patterns */
+        YIELD_TAG_BIT,          /* yield tag bit */
+        YIELD_LITERAL,          /* emit literal byte */
+        YIELD_BR_INDEX,         /* yielding backref index */
+        YIELD_BR_LENGTH,        /* yielding backref length */
+        SAVE_BACKLOG,           /* copying buffer to backlog */
+        FLUSH_BITS,             /* flush bit buffer */
+        DONE,                   /* done */
+    };
+
+    static constexpr uint8_t FLAG_IS_FINISHING = 0x01;
+    static constexpr uint32_t MATCH_NOT_FOUND = (uint32_t)-1;
+
+    struct output_info {
+        uint8_t* buf;               /* output buffer */
+        size_t buf_size;            /* buffer size */
+        size_t* output_size;        /* bytes pushed to buffer, so far */
+    };
+
+    uint32_t input_size;        /* bytes in input buffer */
+    uint32_t match_scan_index;
+    uint32_t match_length;
+    uint32_t match_pos;
+    uint32_t outgoing_bits;     /* enqueued outgoing bits */
+    uint8_t outgoing_bits_count;
+    uint8_t flags;
+    uint8_t state;              /* current state machine node */
+    uint8_t current_byte;       /* current byte of output */
+    uint8_t bit_index;          /* current bit index */
+    /* input buffer and / sliding window for expansion */
+    uint8_t buffer[2 * WINDOW_SIZE];
+
+    bool is_finishing() const noexcept {
+        return (flags & FLAG_IS_FINISHING) != 0;
+    }
+
+    static bool can_take_byte(const output_info& oi) noexcept {
+        return *(oi.output_size) < oi.buf_size;
+    }
+
+    uint8_t st_step_search() noexcept {
+        const uint32_t msi = match_scan_index;
+        if (is_finishing()) [[unlikely]] {
+            if (msi >= input_size) { return FLUSH_BITS; }
+        } else {
+            if (msi + LOOKAHEAD_SIZE > input_size) { return SAVE_BACKLOG; }
+        }
+
+        const uint32_t end = WINDOW_SIZE + msi;
+        const uint32_t max_possible = std::min(input_size - msi, LOOKAHEAD_SIZE);
+
+        uint32_t length = 0;
+        const uint32_t pos = find_longest_match(end - WINDOW_SIZE, end, max_possible, length);
+        if (pos == MATCH_NOT_FOUND) {
+            match_scan_index++;
+            match_length = 0;
+        } else {
+            match_pos = pos;
+            match_length = length;
+        }
+        return YIELD_TAG_BIT;
+    }
+
+    uint32_t find_longest_match(const uint32_t start, const uint32_t end,
+            const uint32_t maxlen, uint32_t& length) const noexcept {
+        if (maxlen <= BREAK_EVEN_POINT) [[unlikely]] {
+            return MATCH_NOT_FOUND;
+        }
+        /* Runs of a byte or of a short pattern first, see find_longest_match()
+         * of the C encoder. */
+        byte_span lm = Locator::find_run(&buffer[end], maxlen, std::min(end - start, (uint32_t)4));
+        if (lm.size_bytes() < maxlen) {
+            const byte_span wm = HEATSHRINK_SEARCH_NEAREST_FIRST ?
+                Locator::find_longest_match_backward(&buffer[end], maxlen, &buffer[start], end - start) :
+                Locator::find_longest_match(&buffer[end], maxlen, &buffer[start], end - start);
+            if (wm.size_bytes() >= lm.size_bytes()) { lm = wm; }
+        }
+        if (lm.size_bytes() <= BREAK_EVEN_POINT) {
+            return MATCH_NOT_FOUND;
+        }
+        length = lm.size_bytes();
+        return end - (lm.data() - buffer);
+    }
+
+    uint8_t st_yield_tag_bit(output_info& oi) noexcept {
+        if (can_take_byte(oi)) {
+            if (match_length == 0) {
+                push_bits(1, HEATSHRINK_LITERAL_MARKER, oi);
+                return YIELD_LITERAL;
+            } else {
+                push_bits(1, HEATSHRINK_BACKREF_MARKER, oi);
+                outgoing_bits = match_pos - 1;
+                outgoing_bits_count = W;
+                return YIELD_BR_INDEX;
+            }
+        } else {
+            return YIELD_TAG_BIT; /* output is full, continue */
+        }
+    }
+
+    uint8_t st_yield_literal(output_info& oi) noexcept {
+        if (can_take_byte(oi)) {
+            push_bits(8, buffer[WINDOW_SIZE + match_scan_index - 1], oi);
+            return SEARCH;
+        } else {
+            return YIELD_LITERAL;
+        }
+    }
+
+    uint8_t st_yield_br_index(output_info& oi) noexcept {
+        if (can_take_byte(oi)) {
+            if (push_outgoing_bits(oi) > 0) {
+                return YIELD_BR_INDEX; /* continue */
+            } else {
+                outgoing_bits = match_length - 1;
+                outgoing_bits_count = L;
+                return YIELD_BR_LENGTH; /* done */
+            }
+        } else {
+            return YIELD_BR_INDEX; /* continue */
+        }
+    }
+
+    uint8_t st_yield_br_length(output_info& oi) noexcept {
+        if (can_take_byte(oi)) {
+            if (push_outgoing_bits(oi) > 0) {
+                return YIELD_BR_LENGTH;
+            } else {
+                match_scan_index += match_length;
+                match_length = 0;
+                return SEARCH;
+            }
+        } else {
+            return YIELD_BR_LENGTH;
+        }
+    }
+
+    uint8_t st_flush_bit_buffer(output_info& oi) noexcept {
+        if (bit_index == 0) {
+            return DONE;
+        } else if (can_take_byte(oi)) {
+            oi.buf[(*oi.output_size)++] = (current_byte << (8 - bit_index));
+            return DONE;
+        } else {
+            return FLUSH_BITS;
+        }
+    }
+
+    void save_backlog() noexcept {
+        /* Copy processed data to beginning of buffer, so it can be
+         * used for future matches. */
+        const uint32_t msi = match_scan_index;
+        memmove(&buffer[0], &buffer[msi], 2 * WINDOW_SIZE - msi);
+        match_scan_index = 0;
+        input_size -= msi;
+    }
+
+    /* Push the enqueued outgoing bits, at most 8 at a time. Only a backref
+     * index of more than 8 bits (W > 8) or a count of more than 8 bits (L > 8)
+     * takes more than one step. */
+    uint32_t push_outgoing_bits(output_info& oi) noexcept {
+        uint32_t count = outgoing_bits_count;
+        if (count != 0) {
+            outgoing_bits_count = 0;
+            uint32_t bits = outgoing_bits;
+            if constexpr (W > 8) {
+                if (count > 8) {
+                    bits = bits >> (count - 8);
+                    outgoing_bits_count = count - 8;
+                    count = 8;
+                }
+            }
+            push_bits(count, bits, oi);
+        }
+        return count;
+    }
+
+    /* Push COUNT (max 8) bits to the output buffer, which has room. */
+    void push_bits(const uint32_t count, const uint32_t bits, output_info& oi) noexcept {
+        uint32_t bit = bit_index;
+        uint32_t out = current_byte;
+        out = (out << count) | (bits & ((1 << count) - 1));
+        bit += count;
+        if (bit >= 8) {
+            oi.buf[(*oi.output_size)++] = out >> (bit - 8);
+            bit -= 8;
+        }
+        bit_index = bit;
+        current_byte = out;
+    }
+};
+
+/**
+ * @brief Decoder for a window of 2^W bytes, backrefs of up to 2^L bytes and
+ * an input buffer of IB bytes.
+ */
+template<uint32_t W, uint32_t L, uint32_t IB>
+class Decoder {
+    static_assert(W >= HEATSHRINK_MIN_WINDOW_BITS && W <= HEATSHRINK_MAX_WINDOW_BITS,
+        "Window bits out of range.");
+    static_assert(L >= HEATSHRINK_MIN_LOOKAHEAD_BITS && L < W,
+        "Lookahead bits must be at least 3 and less than the window bits.");
+    static_assert(IB > 0 && IB <= UINT16_MAX, "Input buffer size out of range.");
+
+public:
+    static constexpr uint32_t WINDOW_BITS = W;
+    static constexpr uint32_t LOOKAHEAD_BITS = L;
+    static constexpr uint32_t INPUT_BUFFER_SIZE = IB;
+    static constexpr uint32_t WINDOW_SIZE = 1 << W;
+
+    Decoder() noexcept {
+        reset();
+    }
+
+    void reset() noexcept {
+        memset(window, 0, sizeof(window));
+        state = TAG_BIT;
+        input_size = 0;
+        input_index = 0;
+        bit_index = 0x00;
+        current_byte = 0x00;
+        output_count = 0;
+        output_index = 0;
+        head_index = 0;
+    }
+
+    /* Preset the window with the same dictionary as the encoder, as
+     * heatshrink_decoder_set_dictionary. Call after construction or reset,
+     * before the first sink. */
+    HSD_dictionary_res set_dictionary(const uint8_t* dict, size_t dict_size) noexcept {
+        if (dict == nullptr && dict_size != 0) [[unlikely]] {
+            return HSDR_DICTIONARY_ERROR_NULL;
+        }
+        if (input_size != 0 || head_index != 0) [[unlikely]] {
+            return HSDR_DICTIONARY_ERROR_MISUSE;
+        }
+        const size_t n = std::min(dict_size, (size_t)WINDOW_SIZE);
+        memcpy(window, dict + (dict_size - n), n);
+        head_index = n & MASK;
+        return HSDR_DICTIONARY_OK;
+    }
+
+    /* Sink at most SIZE bytes from IN_BUF into the decoder. *INPUT_SIZE is set to
+     * indicate how many bytes were actually sunk (in case a buffer was filled). */
+    HSD_sink_res sink(const uint8_t* in_buf, size_t size, size_t* input_size) noexcept {
+        if ((in_buf == nullptr) || (input_size == nullptr)) [[unlikely]] {
+            return HSDR_SINK_ERROR_NULL;
+        }
+        const size_t rem = IB - this->input_size;
+        if (rem == 0) {
+            *input_size = 0;
+            return HSDR_SINK_FULL;
+        }
+        size = rem < size ? rem : size;
+        memcpy(&input[this->input_size], in_buf, size);
+        this->input_size += size;
+        *input_size = size;
+        return HSDR_SINK_OK;
+    }
+
+    /* Poll for output from the decoder, copying at most OUT_BUF_SIZE bytes into
+     * OUT_BUF (setting *OUTPUT_SIZE to the actual amount copied). */
+    HSD_poll_res poll(uint8_t* out_buf, size_t out_buf_size, size_t* output_size) noexcept {
+        if ((out_buf == nullptr) || (output_size == nullptr)) [[unlikely]] {
+            return HSDR_POLL_ERROR_NULL;
+        }
+        *output_size = 0;
+
+        output_info oi { out_buf, out_buf_size, output_size };
+
+        while (true) {
+            const uint8_t in_state = state;
+            switch (in_state) {
+            case TAG_BIT:
+                state = st_tag_bit();
+                break;
+            case YIELD_LITERAL:
+                state = st_yield_literal(oi);
+                break;
+            case BACKREF_INDEX_HIGH:
+                state = st_backref_index_high();
+                break;
+            case BACKREF_INDEX_MSB:
+                state = st_backref_index_msb();
+                break;
+            case BACKREF_INDEX_LSB:
+                state = st_backref_index_lsb();
+                break;
+            case BACKREF_COUNT_HIGH:
+                state = st_backref_count_high();
+                break;
+            case BACKREF_COUNT_MSB:
+                state = st_backref_count_msb();
+                break;
+            case BACKREF_COUNT_LSB:
+                state = st_backref_count_lsb();
+                break;
+            case YIELD_BACKREF:
+                state = st_yield_backref(oi);
+                break;
+            default:
+                return HSDR_POLL_ERROR_UNKNOWN;
+            }
+
+            /* If the current state cannot advance, check if input or output
+             * buffer are exhausted. */
+            if (state == in_state) {
+                if (*output_size == out_buf_size) { return HSDR_POLL_MORE; }
+                return HSDR_POLL_EMPTY;
+            }
+        }
+    }
+
+    /* Notify the decoder that the input stream is finished.
+     * If the return value is HSDR_FINISH_MORE, there is still more output, so
+     * call poll and repeat. */
+    HSD_finish_res finish() const noexcept {
+        switch (state) {
+        case TAG_BIT:
+        /* If we want to finish with no input, but are in these states, it's
+         * because the 0-bit padding to the last byte looks like a backref
+         * marker bit followed by all 0s for index and count bits. */
+        case BACKREF_INDEX_LSB:
+        case BACKREF_INDEX_MSB:
+        case BACKREF_INDEX_HIGH:
+        case BACKREF_COUNT_LSB:
+        case BACKREF_COUNT_MSB:
+        case BACKREF_COUNT_HIGH:
+        /* If the output stream is padded with 0xFFs (possibly due to being in
+         * flash memory), also explicitly check the input size rather than
+         * uselessly returning MORE but yielding 0 bytes when polling. */
+        case YIELD_LITERAL:
+            return input_size == 0 ? HSDR_FINISH_DONE : HSDR_FINISH_MORE;
+        default:
+            return HSDR_FINISH_MORE;
+        }
+    }
+
+private:
+    enum : uint8_t {
+        TAG_BIT,                /* tag bit */
+        YIELD_LITERAL,          /* ready to yield literal byte */
+        BACKREF_INDEX_HIGH,     /* index bits above its 2 low bytes (W > 16) */
+        BACKREF_INDEX_MSB,      /* most significant byte of index */
+        BACKREF_INDEX_LSB,      /* least significant byte of index */
+        BACKREF_COUNT_HIGH,     /* count bits above its 2 low bytes (L > 16) */
+        BACKREF_COUNT_MSB,      /* most significant byte of count */
+        BACKREF_COUNT_LSB,      /* least significant byte of count */
+        YIELD_BACKREF,          /* ready to yield back-reference */
+    };
+
+    static constexpr uint32_t NO_BITS = (uint32_t)-1;
+    static constexpr uint32_t MASK = WINDOW_SIZE - 1;
+
+    struct output_info {
+        uint8_t* buf;               /* output buffer */
+        size_t buf_size;            /* buffer size */
+        size_t* output_size;        /* bytes pushed to buffer, so far */
+    };
+
+    uint32_t input_size;        /* bytes in input buffer */
+    uint32_t input_index;       /* offset to next unprocessed input byte */
+    uint32_t output_count;      /* how many bytes to output */
+    uint32_t output_index;      /* index for bytes to output */
+    uint32_t head_index;        /* head of window buffer */
+    uint8_t state;              /* current state machine node */
+    uint8_t current_byte;       /* current byte of input */
+    uint8_t bit_index;          /* number of bits left in current byte */
+    uint8_t input[IB];          /* input buffer */
+    uint8_t window[WINDOW_SIZE]; /* sliding window for expansion */
+
+    static bool no_bits(const uint32_t bits) noexcept {
+        return (int32_t)bits < 0;
+    }
+
+    uint8_t st_tag_bit() noexcept {
+        const uint32_t bits = get_bits(1);  // get tag bit
+        if (no_bits(bits)) {
+            return TAG_BIT;
+        } else if (bits) {
+            return YIELD_LITERAL;
+        }
+        output_index = 0;
+        if constexpr (W > 16) {
+            return BACKREF_INDEX_HIGH;
+        } else if constexpr (W > 8) {
+            return BACKREF_INDEX_MSB;
+        } else {
+            return BACKREF_INDEX_LSB;
+        }
+    }
+
+    uint8_t st_yield_literal(output_info& oi) noexcept {
+        if (*oi.output_size < oi.buf_size) {
+            const uint32_t byte = get_bits(8);
+            if (no_bits(byte)) { return YIELD_LITERAL; } /* out of input */
+            window[head_index++ & MASK] = byte;
+            oi.buf[(*oi.output_size)++] = byte;
+            return TAG_BIT;
+        } else {
+            return YIELD_LITERAL;
+        }
+    }
+
+    uint8_t st_backref_index_high() noexcept {
+        const uint32_t bits = get_bits(W > 16 ? W - 16 : 0);
+        if (no_bits(bits)) {
+            return BACKREF_INDEX_HIGH;
+        } else {
+            output_index = bits << 16;
+            return BACKREF_INDEX_MSB;
+        }
+    }
+
+    uint8_t st_backref_index_msb() noexcept {
+        const uint32_t bits = get_bits(W > 16 ? 8 : W > 8 ? W - 8 : 0);
+        if (no_bits(bits)) {
+            return BACKREF_INDEX_MSB;
+        } else {
+            output_index |= bits << 8;
+            return BACKREF_INDEX_LSB;
+        }
+    }
+
+    uint8_t st_backref_index_lsb() noexcept {
+        const uint32_t bits = get_bits(W < 8 ? W : 8);
+        if (no_bits(bits)) {
+            return BACKREF_INDEX_LSB;
+        } else {
+            output_index |= bits;
+            output_index++;
+            output_count = 0;
+            if constexpr (L > 16) {
+                return BACKREF_COUNT_HIGH;
+            } else {
+                return (L > 8) ? BACKREF_COUNT_MSB : BACKREF_COUNT_LSB;
+            }
+        }
+    }
+
+    uint8_t st_backref_count_high() noexcept {
+        const uint32_t bits = get_bits(L > 16 ? L - 16 : 0);
+        if (no_bits(bits)) {
+            return BACKREF_COUNT_HIGH;
+        } else {
+            output_count = bits << 16;
+            return BACKREF_COUNT_MSB;
+        }
+    }
+
+    uint8_t st_backref_count_msb() noexcept {
+        const uint32_t bits = get_bits(L > 16 ? 8 : L > 8 ? L - 8 : 0);
+        if (no_bits(bits)) {
+            return BACKREF_COUNT_MSB;
+        } else {
+            output_count |= bits << 8;
+            return BACKREF_COUNT_LSB;
+        }
+    }
+
+    uint8_t st_backref_count_lsb() noexcept {
+        const uint32_t bits = get_bits(L < 8 ? L : 8);
+        if (no_bits(bits)) {
+            return BACKREF_COUNT_LSB;
+        } else {
+            output_count |= bits;
+            output_count++;
+            return YIELD_BACKREF;
+        }
+    }
+
+    uint8_t st_yield_backref(output_info& oi) noexcept {
+        size_t count = oi.buf_size - *oi.output_size;
+        if (count > 0) {
+            if (output_count < count) { count = output_count; }
+            const uint32_t offset = output_index;
+            uint32_t di = head_index & MASK;
+            if (offset <= 4 && count >= 8 && offset <= di && di + count <= MASK + 1) {
+                /* Replicate a short pattern, see st_yield_backref() of the C decoder. */
+                uint8_t* const out = oi.buf + *oi.output_size;
+                uint8_t* const win = &window[di];
+                const uint8_t* const src = win - offset;
+                uint8_t pattern[4];
+                for (uint32_t i = 0; i < 4; i++) { pattern[i] = src[i % offset]; }
+                const uint32_t step = (offset == 3) ? 3 : 4;
+                uint32_t i = 0;
+                for (; i + 4 <= count; i += step) {
+                    memcpy(&win[i], pattern, 4);
+                    memcpy(&out[i], pattern, 4);
+                }
+                for (; i < count; i++) {
+                    win[i] = src[i];
+                    out[i] = win[i];
+                }
+                *oi.output_size += count;
+                head_index = (di + count) & MASK;
+            } else {
+                const uint32_t dend = (di + count) & MASK;
+                uint32_t si = (di - offset) & MASK;
+                uint8_t* out = oi.buf + *oi.output_size;
+                do {
+                    const uint8_t c = window[si];
+                    window[di] = c;
+                    *out++ = c;
+                    di = (di + 1) & MASK;
+                    si = (si + 1) & MASK;
+                } while (di != dend);
+                *oi.output_size = out - oi.buf;
+                head_index = di;
+            }
+            output_count -= count;
+            if (output_count == 0) { return TAG_BIT; }
+        }
+        return YIELD_BACKREF;
+    }
+
+    /* Get the next COUNT (max 8) bits from the input buffer, saving incremental
+     * progress. Returns NO_BITS on end of input. */
+    uint32_t get_bits(uint32_t count) noexcept {
+        uint32_t bi = bit_index;
+        /* If we aren't able to get COUNT bits, suspend immediately, because we
+         * don't track how many bits of COUNT we've accumulated before suspend. */
+        if (bi < count && input_size == 0) {
+            return NO_BITS;
+        }
+
+        uint32_t r = 0;
+        uint32_t cb = current_byte;
+        do {
+            const uint32_t c = count < bi ? count : bi;
+            if (c != 0) {
+                r = (r << c) | ((cb >> (bi - c)) & ((1 << c) - 1));
+                count -= c;
+                bi -= c;
+            }
+            if (count != 0) {
+                cb = input[input_index];
+                current_byte = cb;
+                bi = 8;
+                if (++input_index == input_size) [[unlikely]] {
+                    input_index = 0; /* input is exhausted */
+                    input_size = 0;
+                }
+            }
+        } while (count != 0);
+
+        bit_index = bi;
+        return r;
+    }
+};
+
+} // namespace heatshrink
+
+#endif
@@ -9,8 +9,14 @@
 #define HEATSHRINK_VERSION_MINOR 4
 #define HEATSHRINK_VERSION_PATCH 1
 
+#include "heatshrink_config.h"
+
 #define HEATSHRINK_MIN_WINDOW_BITS 4
+#if HEATSHRINK_WIDE_INDEX
+#define HEATSHRINK_MAX_WINDOW_BITS 20
+#else
 #define HEATSHRINK_MAX_WINDOW_BITS 15
+#endif
 
 #define HEATSHRINK_MIN_LOOKAHEAD_BITS 3
 
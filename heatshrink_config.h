@@ -11,6 +11,19 @@
     #define HEATSHRINK_32BIT 1
 #endif
 
+/* Allow windows of up to 2^20 bytes (HEATSHRINK_MAX_WINDOW_BITS 20 instead of 15), e.g. for
+   archiving large logs on a host. Positions, lengths and the index or hash chain entries of the
+   encoder and decoder become 32 bits wide, and the decoder reads backref indices and counts
+   of up to 3 bytes. The format is unchanged otherwise. Only supported by the 32-bit variant;
+   large windows are best searched with the hash chain, which then defaults to 2^16 heads. */
+#ifndef HEATSHRINK_WIDE_INDEX
+    #define HEATSHRINK_WIDE_INDEX 0
+#endif
+
+#if HEATSHRINK_WIDE_INDEX && !HEATSHRINK_32BIT
+    #error HEATSHRINK_WIDE_INDEX needs HEATSHRINK_32BIT.
+#endif
+
 #if HEATSHRINK_DYNAMIC_ALLOC
     /* Optional replacement of malloc/free */
     #define HEATSHRINK_MALLOC(SZ) malloc(SZ)
@@ -20,15 +33,110 @@
     #define HEATSHRINK_STATIC_INPUT_BUFFER_SIZE 32
     #define HEATSHRINK_STATIC_WINDOW_BITS 8
     #define HEATSHRINK_STATIC_LOOKAHEAD_BITS 4
+    /* Encoder level, HEATSHRINK_LEVEL_DEFAULT (0) or 1..9 (see heatshrink_encoder.h) */
+    #define HEATSHRINK_STATIC_LEVEL 0
 #endif
 
 /* Turn on logging for debugging. */
 #define HEATSHRINK_DEBUGGING_LOGS 0
 
-/* Use indexing for faster compression. (Increases RAM requirement by ~200%, disables use
-   of the 32-bit search functions.) */
+/* Use indexing for faster compression. (Increases RAM requirement by ~200%. The 32-bit
+   variant walks the index for candidates and verifies them with its 32-bit/SIMD compare.) */
 #ifndef HEATSHRINK_USE_INDEX
     #define HEATSHRINK_USE_INDEX 0
 #endif
 
+/* Use a hash chain (hash of the next 3 bytes -> most recent position, plus a chain of
+   previous positions with the same hash) to find matches. Only used by the 32-bit variant;
+   increases RAM requirement for compression by ~200% plus the hash table, like the index. */
+#ifndef HEATSHRINK_USE_HASH_CHAIN
+    #define HEATSHRINK_USE_HASH_CHAIN 0
+#endif
+
+#if HEATSHRINK_USE_HASH_CHAIN
+    /* log2 of the number of hash table entries (4 bytes each) */
+    #ifndef HEATSHRINK_HASH_BITS
+        #if HEATSHRINK_WIDE_INDEX
+            #define HEATSHRINK_HASH_BITS 16
+        #else
+            #define HEATSHRINK_HASH_BITS 10
+        #endif
+    #endif
+    /* Max. number of previous positions checked per search; higher values
+       compress slightly better but make the worst case slower. */
+    #ifndef HEATSHRINK_HASH_CHAIN_MAX_DEPTH
+        #define HEATSHRINK_HASH_CHAIN_MAX_DEPTH 32
+    #endif
+#endif
+
+/* Lazy matching: Before emitting a match, check if the match starting at the next byte
+   is longer; if so, emit a literal and take that one instead. Only used by the 32-bit
+   variant; costs up to one extra search per match for a better compression ratio. */
+#ifndef HEATSHRINK_LAZY_MATCHING
+    #define HEATSHRINK_LAZY_MATCHING 0
+#endif
+
+#if HEATSHRINK_LAZY_MATCHING
+    /* Matches at least this long are good enough to be emitted right away,
+       without checking the next byte. Bounds the extra search cost. */
+    #ifndef HEATSHRINK_LAZY_GOOD_LENGTH
+        #define HEATSHRINK_LAZY_GOOD_LENGTH 8
+    #endif
+    /* The match at the next byte must be at least this many bytes longer to be
+       preferred (>= 1). */
+    #ifndef HEATSHRINK_LAZY_MIN_GAIN
+        #define HEATSHRINK_LAZY_MIN_GAIN 1
+    #endif
+    #if HEATSHRINK_LAZY_MIN_GAIN < 1
+        #error HEATSHRINK_LAZY_MIN_GAIN must be at least 1.
+    #endif
+#endif
+
+/* Search the window backward, nearest position first, so that of several longest matches
+   the one with the smallest offset is emitted (as with the index or hash chain) and searches
+   on local repetition end sooner. Only used by the 32-bit variant without index or hash
+   chain; the compressed size is the same. */
+#ifndef HEATSHRINK_SEARCH_NEAREST_FIRST
+    #define HEATSHRINK_SEARCH_NEAREST_FIRST 0
+#endif
+
+/* Keep the encoder's buffer as a ring, so that no data is moved when the window advances,
+   rather than shifting the window (and index or hash chain) back by the input processed.
+   Only used by the 32-bit variant. Searches whose window crosses the ring's seam take two
+   sweeps, and buffer accesses wrap around, so this is slower where memmove is fast (on x86
+   hosts, about 10% with a 4 KB window and 40% with a 256 byte one). */
+#ifndef HEATSHRINK_CIRCULAR_WINDOW
+    #define HEATSHRINK_CIRCULAR_WINDOW 0
+#endif
+
+/* Have the encoder's ring hold the window plus two lookaheads of input, refilled a lookahead
+   at a time, instead of twice the window. This about halves the encoder's RAM (and the index
+   or hash chain), e.g. 4148 instead of 8192 bytes for a 4 KB window and 16 byte lookahead.
+   Needs HEATSHRINK_CIRCULAR_WINDOW, as moving the window back a lookahead at a time would
+   cost a window-sized memmove every few bytes. heatshrink_encoder_sink then takes at most
+   two lookaheads of input before the encoder needs to be polled (and sinks 0 bytes instead of
+   returning HSER_SINK_ERROR_MISUSE until it is; an API change), and input is taken in
+   smaller steps, which is slower (on x86 hosts, about 5-20% with a 4 KB window and 40-65%
+   with a 256 byte one, including the ring). Encoders at HEATSHRINK_LEVEL_MAX_RATIO keep a
+   window of input, as their parse is planned a buffer at a time. */
+#ifndef HEATSHRINK_COMPACT_ENCODER
+    #define HEATSHRINK_COMPACT_ENCODER 0
+#endif
+
+#if HEATSHRINK_COMPACT_ENCODER && !(HEATSHRINK_32BIT && HEATSHRINK_CIRCULAR_WINDOW)
+    #error HEATSHRINK_COMPACT_ENCODER needs HEATSHRINK_32BIT and HEATSHRINK_CIRCULAR_WINDOW.
+#endif
+
+/* The "heatshrink+" format (see heatshrink_encoder_alloc_plus) models each literal in the
+   context of this many high bits of the byte before it, 0 to 8. Each bit doubles the literal
+   model (512 bytes without context) of the encoder and decoder. On text, 2 bits compress
+   about 1% better and 3 bits about 2%. */
+#ifndef HEATSHRINK_PLUS_LITERAL_CONTEXT_BITS
+    #define HEATSHRINK_PLUS_LITERAL_CONTEXT_BITS 0
+#endif
+
+#if HEATSHRINK_USE_INDEX && HEATSHRINK_USE_HASH_CHAIN
+    #error HEATSHRINK_USE_INDEX and HEATSHRINK_USE_HASH_CHAIN are mutually exclusive.
+#endif
+
 #endif
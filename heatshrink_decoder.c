@@ -84,6 +84,7 @@ heatshrink_decoder *heatshrink_decoder_alloc(uint16_t input_buffer_size,
 }
 
 void heatshrink_decoder_free(heatshrink_decoder *hsd) {
+    if (hsd == NULL) { return; }
     size_t buffers_sz = (1 << hsd->window_sz2) + hsd->input_buffer_size;
     size_t sz = sizeof(heatshrink_decoder) + buffers_sz;
     HEATSHRINK_FREE(hsd, sz);
@@ -108,6 +109,23 @@ void heatshrink_decoder_reset(heatshrink_decoder *hsd) {
 
 }
 
+HSD_dictionary_res heatshrink_decoder_set_dictionary(heatshrink_decoder *hsd,
+        const uint8_t *dict, size_t dict_size) {
+    if ((hsd == NULL) || (dict == NULL && dict_size != 0)) {
+        return HSDR_DICTIONARY_ERROR_NULL;
+    }
+    if (hsd->input_size != 0 || hsd->head_index != 0) {
+        return HSDR_DICTIONARY_ERROR_MISUSE;
+    }
+    /* The last byte of the dictionary is the one just before the output. */
+    uint8_t *buf = &hsd->buffers[HEATSHRINK_DECODER_INPUT_BUFFER_SIZE(hsd)];
+    size_t window_sz = (size_t)1 << HEATSHRINK_DECODER_WINDOW_BITS(hsd);
+    size_t n = dict_size < window_sz ? dict_size : window_sz;
+    memcpy(buf, dict + (dict_size - n), n);
+    hsd->head_index = n & (window_sz - 1);
+    return HSDR_DICTIONARY_OK;
+}
+
 /* Copy SIZE bytes into the decoder's input buffer, if it will fit. */
 HSD_sink_res heatshrink_decoder_sink(heatshrink_decoder *hsd,
         const uint8_t *in_buf, size_t size, size_t *input_size) {
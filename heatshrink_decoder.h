@@ -17,6 +17,12 @@ typedef enum {
     HSDR_SINK_ERROR_NULL=-1,    /* NULL argument */
 } HSD_sink_res;
 
+typedef enum {
+    HSDR_DICTIONARY_OK,             /* dictionary loaded into the window */
+    HSDR_DICTIONARY_ERROR_NULL=-1,  /* NULL argument */
+    HSDR_DICTIONARY_ERROR_MISUSE=-2,/* input was already sunk or expanded */
+} HSD_dictionary_res;
+
 typedef enum {
     HSDR_POLL_EMPTY,            /* input exhausted */
     HSDR_POLL_MORE,             /* more data remaining, call again w/ fresh output buffer */
@@ -30,6 +36,13 @@ typedef enum {
     HSDR_FINISH_ERROR_NULL=-1,  /* NULL arguments */
 } HSD_finish_res;
 
+typedef enum {
+    HSDR_DECOMPRESS_OK,                     /* all input expanded */
+    HSDR_DECOMPRESS_ERROR_NULL=-1,          /* NULL argument */
+    HSDR_DECOMPRESS_ERROR_MISUSE=-2,        /* invalid window/lookahead size */
+    HSDR_DECOMPRESS_ERROR_OUTPUT_FULL=-3,   /* output buffer too small */
+} HSD_decompress_res;
+
 #if HEATSHRINK_DYNAMIC_ALLOC
 #define HEATSHRINK_DECODER_INPUT_BUFFER_SIZE(BUF) \
     ((BUF)->input_buffer_size)
@@ -46,12 +59,19 @@ typedef enum {
     (HEATSHRINK_STATIC_LOOKAHEAD_BITS)
 #endif
 
+#if HEATSHRINK_WIDE_INDEX
+/* Window positions and backref counts. */
+typedef uint32_t hsd_index_t;
+#else
+typedef uint16_t hsd_index_t;
+#endif
+
 typedef struct {
     uint16_t input_size;        /* bytes in input buffer */
     uint16_t input_index;       /* offset to next unprocessed input byte */
-    uint16_t output_count;      /* how many bytes to output */
-    uint16_t output_index;      /* index for bytes to output */
-    uint16_t head_index;        /* head of window buffer */
+    hsd_index_t output_count;   /* how many bytes to output */
+    hsd_index_t output_index;   /* index for bytes to output */
+    hsd_index_t head_index;     /* head of window buffer */
     uint8_t state;              /* current state machine node */
     uint8_t current_byte;       /* current byte of input */
     uint8_t bit_index;          /* current bit index */
@@ -61,6 +81,9 @@ typedef struct {
     uint8_t window_sz2;         /* window buffer bits */
     uint8_t lookahead_sz2;      /* lookahead bits */
     uint16_t input_buffer_size; /* input buffer size */
+#if HEATSHRINK_32BIT
+    struct hs_plus_decoder *plus; /* heatshrink+ format only, else NULL */
+#endif
 
     /* Input buffer, then expansion window buffer */
     uint8_t buffers[];
@@ -80,13 +103,29 @@ typedef struct {
 heatshrink_decoder *heatshrink_decoder_alloc(uint16_t input_buffer_size,
     uint8_t expansion_buffer_sz2, uint8_t lookahead_sz2);
 
-/* Free a decoder. */
+#if HEATSHRINK_32BIT
+/* Allocate a decoder as heatshrink_decoder_alloc, for input in the
+ * "heatshrink+" format (see heatshrink_encoder_alloc_plus). The input ends
+ * with an end marker; anything sunk after it is ignored. The models take
+ * about 1 KB. 32-bit variant only.
+ * Returns NULL on error. */
+heatshrink_decoder *heatshrink_decoder_alloc_plus(uint16_t input_buffer_size,
+    uint8_t expansion_buffer_sz2, uint8_t lookahead_sz2);
+#endif
+
+/* Free a decoder (if HSD is not NULL). */
 void heatshrink_decoder_free(heatshrink_decoder *hsd);
 #endif
 
 /* Reset a decoder. */
 void heatshrink_decoder_reset(heatshrink_decoder *hsd);
 
+/* Preset the window with the same dictionary as the encoder (see
+ * heatshrink_encoder_set_dictionary). Call after alloc or reset, before the
+ * first sink. */
+HSD_dictionary_res heatshrink_decoder_set_dictionary(heatshrink_decoder *hsd,
+    const uint8_t *dict, size_t dict_size);
+
 /* Sink at most SIZE bytes from IN_BUF into the decoder. *INPUT_SIZE is set to
  * indicate how many bytes were actually sunk (in case a buffer was filled). */
 HSD_sink_res heatshrink_decoder_sink(heatshrink_decoder *hsd,
@@ -102,6 +141,17 @@ HSD_poll_res heatshrink_decoder_poll(heatshrink_decoder *hsd,
  * call heatshrink_decoder_poll and repeat. */
 HSD_finish_res heatshrink_decoder_finish(heatshrink_decoder *hsd);
 
+#if HEATSHRINK_32BIT
+/* Expand the IN_SIZE bytes at IN_BUF, compressed with a window of
+ * 2^WINDOW_SZ2 and a lookahead of 2^LOOKAHEAD_SZ2 bytes, into OUT_BUF in one
+ * go, setting *OUTPUT_SIZE to the expanded size (or to what fit into
+ * OUT_BUF_SIZE bytes, on HSDR_DECOMPRESS_ERROR_OUTPUT_FULL). OUT_BUF itself is
+ * used as the window, so this needs no decoder or buffers. 32-bit variant only. */
+HSD_decompress_res heatshrink_decompress(const uint8_t *in_buf, size_t in_size,
+    uint8_t *out_buf, size_t out_buf_size,
+    uint8_t window_sz2, uint8_t lookahead_sz2, size_t *output_size);
+#endif
+
 #endif
 
 #ifdef __cplusplus
@@ -5,7 +5,9 @@
 
 #include <stdlib.h>
 #include <string.h>
+#include <algorithm>
 #include "heatshrink_decoder.h"
+#include "hs_plus.hpp"
 
 
 
@@ -18,6 +20,15 @@ typedef enum {
     HSDS_BACKREF_COUNT_MSB,     /* most significant byte of count */
     HSDS_BACKREF_COUNT_LSB,     /* least significant byte of count */
     HSDS_YIELD_BACKREF,         /* ready to yield back-reference */
+    HSDS_BACKREF_INDEX_HIGH,    /* index bits above its 2 low bytes (HEATSHRINK_WIDE_INDEX) */
+    HSDS_BACKREF_COUNT_HIGH,    /* count bits above its 2 low bytes (HEATSHRINK_WIDE_INDEX) */
+    HSDS_PLUS_START,            /* heatshrink+: first bytes of the code */
+    HSDS_PLUS_TAG,              /* heatshrink+: literal or backref */
+    HSDS_PLUS_LITERAL,          /* heatshrink+: literal byte */
+    HSDS_PLUS_YIELD_LITERAL,    /* heatshrink+: ready to yield literal byte */
+    HSDS_PLUS_LENGTH,           /* heatshrink+: backref length, or end marker */
+    HSDS_PLUS_OFFSET,           /* heatshrink+: backref offset */
+    HSDS_PLUS_END,              /* heatshrink+: end marker seen, input is ignored */
 } HSD_state;
 
 #if HEATSHRINK_DEBUGGING_LOGS
@@ -34,6 +45,15 @@ static const char *state_names[] = {
     "backref_count_msb",
     "backref_count_lsb",
     "yield_backref",
+    "backref_index_high",
+    "backref_count_high",
+    "plus_start",
+    "plus_tag",
+    "plus_literal",
+    "plus_yield_literal",
+    "plus_length",
+    "plus_offset",
+    "plus_end",
 };
 #else
 #define LOG(...) /* no-op */
@@ -48,12 +68,49 @@ typedef struct {
 
 #define NO_BITS ((uint32_t)-1)
 
+/* The bits of a token: up to 1+15+14, or 1+20+19 with HEATSHRINK_WIDE_INDEX. */
+#if HEATSHRINK_WIDE_INDEX
+typedef uint64_t token_t;
+#else
+typedef uint32_t token_t;
+#endif
+
 // static constexpr uint8_t BIT_INDEX_INIT = 
 
+#if HEATSHRINK_DYNAMIC_ALLOC
+/* Input of the heatshrink+ range decoder: the decoder's input buffer. */
+struct plus_input {
+    heatshrink_decoder *hsd;
+
+    /* Returns the next input byte, or -1 if there is none. */
+    int32_t get() {
+        if (hsd->input_size == 0) { return -1; }
+        const uint32_t c = hsd->buffers[hsd->input_index++];
+        if (hsd->input_index == hsd->input_size) {
+            hsd->input_index = 0; /* input is exhausted */
+            hsd->input_size = 0;
+        }
+        return c;
+    }
+};
+
+typedef heatshrink::plus::range_decoder<plus_input> plus_range_decoder;
+
+/* Range decoder and models of the heatshrink+ format. */
+struct hs_plus_decoder {
+    plus_range_decoder rc;
+    heatshrink::plus::number_decoder<plus_input, plus_range_decoder> number;
+    heatshrink::plus::model model;
+    uint32_t node;              /* in the literal tree, then the literal + 0x100 */
+    uint8_t kinds;              /* of the last tokens, for is_literal */
+};
+#endif
+
 /* Forward references. */
 static uint32_t get_bits(heatshrink_decoder *hsd, uint32_t count);
 static bool no_bits(uint32_t bits);
 static void push_byte(heatshrink_decoder *hsd, output_info *oi, uint32_t byte);
+static HSD_state next_token_state(heatshrink_decoder *hsd);
 
 #if HEATSHRINK_DYNAMIC_ALLOC
 heatshrink_decoder *heatshrink_decoder_alloc(uint16_t input_buffer_size,
@@ -73,13 +130,33 @@ heatshrink_decoder *heatshrink_decoder_alloc(uint16_t input_buffer_size,
     hsd->input_buffer_size = input_buffer_size;
     hsd->window_sz2 = window_sz2;
     hsd->lookahead_sz2 = lookahead_sz2;
+    hsd->plus = NULL;
     heatshrink_decoder_reset(hsd);
     LOG("-- allocated decoder with buffer size of %zu (%zu + %u + %u)\n",
         sz, sizeof(heatshrink_decoder), (1 << window_sz2), input_buffer_size);
     return hsd;
 }
 
+heatshrink_decoder *heatshrink_decoder_alloc_plus(uint16_t input_buffer_size,
+                                                  uint8_t window_sz2,
+                                                  uint8_t lookahead_sz2) {
+    heatshrink_decoder *hsd = heatshrink_decoder_alloc(input_buffer_size,
+        window_sz2, lookahead_sz2);
+    if (hsd == NULL) { return NULL; }
+    hsd->plus = (hs_plus_decoder*) HEATSHRINK_MALLOC(sizeof(struct hs_plus_decoder));
+    if (hsd->plus == NULL) {
+        heatshrink_decoder_free(hsd);
+        return NULL;
+    }
+    heatshrink_decoder_reset(hsd);
+    return hsd;
+}
+
 void heatshrink_decoder_free(heatshrink_decoder *hsd) {
+    if (hsd == NULL) { return; }
+    if (hsd->plus != NULL) {
+        HEATSHRINK_FREE(hsd->plus, sizeof(struct hs_plus_decoder));
+    }
     size_t buffers_sz = (1 << hsd->window_sz2) + hsd->input_buffer_size;
     size_t sz = sizeof(heatshrink_decoder) + buffers_sz;
     HEATSHRINK_FREE(hsd, sz);
@@ -99,12 +176,38 @@ void heatshrink_decoder_reset(heatshrink_decoder *hsd) {
     hsd->output_count = 0;
     hsd->output_index = 0;
     hsd->head_index = 0;
+#if HEATSHRINK_DYNAMIC_ALLOC
+    if (hsd->plus != NULL) {
+        hsd->plus->rc.reset();
+        hsd->plus->number.reset();
+        hsd->plus->model.reset();
+        hsd->plus->kinds = 0;
+        hsd->state = HSDS_PLUS_START;
+    }
+#endif
 
 // ESP_LOGI(TAG, "hsd: %" PRIu32 ", size: %" PRIu16, (uint32_t)hsd, hsd->input_size);
 
 }
 
 /* Copy SIZE bytes into the decoder's input buffer, if it will fit. */
+HSD_dictionary_res heatshrink_decoder_set_dictionary(heatshrink_decoder *hsd,
+        const uint8_t *dict, size_t dict_size) {
+    if ((hsd == NULL) || (dict == NULL && dict_size != 0)) {
+        return HSDR_DICTIONARY_ERROR_NULL;
+    }
+    if (hsd->input_size != 0 || hsd->head_index != 0) {
+        return HSDR_DICTIONARY_ERROR_MISUSE;
+    }
+    /* The last byte of the dictionary is the one just before the output. */
+    uint8_t* const buf = &hsd->buffers[HEATSHRINK_DECODER_INPUT_BUFFER_SIZE(hsd)];
+    const size_t window_sz = (size_t)1 << HEATSHRINK_DECODER_WINDOW_BITS(hsd);
+    const size_t n = dict_size < window_sz ? dict_size : window_sz;
+    memcpy(buf, dict + (dict_size - n), n);
+    hsd->head_index = n & (window_sz - 1);
+    return HSDR_DICTIONARY_OK;
+}
+
 HSD_sink_res heatshrink_decoder_sink(heatshrink_decoder *hsd,
         const uint8_t *in_buf, size_t size, size_t *input_size) {
     if ((hsd == NULL) || (in_buf == NULL) || (input_size == NULL)) {
@@ -140,12 +243,26 @@ HSD_sink_res heatshrink_decoder_sink(heatshrink_decoder *hsd,
 static HSD_state st_tag_bit(heatshrink_decoder *hsd);
 static HSD_state st_yield_literal(heatshrink_decoder *hsd,
     output_info *oi);
+#if HEATSHRINK_WIDE_INDEX
+static HSD_state st_backref_index_high(heatshrink_decoder *hsd);
+static HSD_state st_backref_count_high(heatshrink_decoder *hsd);
+#endif
 static HSD_state st_backref_index_msb(heatshrink_decoder *hsd);
 static HSD_state st_backref_index_lsb(heatshrink_decoder *hsd);
 static HSD_state st_backref_count_msb(heatshrink_decoder *hsd);
 static HSD_state st_backref_count_lsb(heatshrink_decoder *hsd);
 static HSD_state st_yield_backref(heatshrink_decoder *hsd,
     output_info *oi);
+#if HEATSHRINK_DYNAMIC_ALLOC
+static HSD_state st_plus_start(heatshrink_decoder *hsd);
+static HSD_state st_plus_tag(heatshrink_decoder *hsd);
+static HSD_state st_plus_literal(heatshrink_decoder *hsd);
+static HSD_state st_plus_yield_literal(heatshrink_decoder *hsd,
+    output_info *oi);
+static HSD_state st_plus_length(heatshrink_decoder *hsd);
+static HSD_state st_plus_offset(heatshrink_decoder *hsd);
+static HSD_state st_plus_end(heatshrink_decoder *hsd);
+#endif
 
 HSD_poll_res heatshrink_decoder_poll(heatshrink_decoder *hsd,
         uint8_t *out_buf, size_t out_buf_size, size_t *output_size) {
@@ -185,6 +302,37 @@ HSD_poll_res heatshrink_decoder_poll(heatshrink_decoder *hsd,
         case HSDS_YIELD_BACKREF:
             hsd->state = st_yield_backref(hsd, &oi);
             break;
+#if HEATSHRINK_WIDE_INDEX
+        case HSDS_BACKREF_INDEX_HIGH:
+            hsd->state = st_backref_index_high(hsd);
+            break;
+        case HSDS_BACKREF_COUNT_HIGH:
+            hsd->state = st_backref_count_high(hsd);
+            break;
+#endif
+#if HEATSHRINK_DYNAMIC_ALLOC
+        case HSDS_PLUS_START:
+            hsd->state = st_plus_start(hsd);
+            break;
+        case HSDS_PLUS_TAG:
+            hsd->state = st_plus_tag(hsd);
+            break;
+        case HSDS_PLUS_LITERAL:
+            hsd->state = st_plus_literal(hsd);
+            break;
+        case HSDS_PLUS_YIELD_LITERAL:
+            hsd->state = st_plus_yield_literal(hsd, &oi);
+            break;
+        case HSDS_PLUS_LENGTH:
+            hsd->state = st_plus_length(hsd);
+            break;
+        case HSDS_PLUS_OFFSET:
+            hsd->state = st_plus_offset(hsd);
+            break;
+        case HSDS_PLUS_END:
+            hsd->state = st_plus_end(hsd);
+            break;
+#endif
         default:
             return HSDR_POLL_ERROR_UNKNOWN;
         }
@@ -205,11 +353,15 @@ static HSD_state st_tag_bit(heatshrink_decoder *hsd) {
         return HSDS_TAG_BIT;
     } else if (bits) {
         return HSDS_YIELD_LITERAL;
-    } else if (HEATSHRINK_DECODER_WINDOW_BITS(hsd) > 8) {
-        return HSDS_BACKREF_INDEX_MSB;
     } else {
         hsd->output_index = 0;
-        return HSDS_BACKREF_INDEX_LSB;
+        if (HEATSHRINK_MAX_WINDOW_BITS > 16 && HEATSHRINK_DECODER_WINDOW_BITS(hsd) > 16) {
+            return HSDS_BACKREF_INDEX_HIGH;
+        } else if (HEATSHRINK_DECODER_WINDOW_BITS(hsd) > 8) {
+            return HSDS_BACKREF_INDEX_MSB;
+        } else {
+            return HSDS_BACKREF_INDEX_LSB;
+        }
     }
 }
 
@@ -235,16 +387,31 @@ static HSD_state st_yield_literal(heatshrink_decoder *hsd,
     }
 }
 
+#if HEATSHRINK_WIDE_INDEX
+static HSD_state st_backref_index_high(heatshrink_decoder *hsd) {
+    const uint32_t bit_ct = BACKREF_INDEX_BITS(hsd);
+    ASSERT(bit_ct > 16);
+    const uint32_t bits = get_bits(hsd, bit_ct - 16);
+    LOG("-- backref index (high), got 0x%04x (+1)\n", bits);
+    if(no_bits(bits)) {
+         return HSDS_BACKREF_INDEX_HIGH;
+    } else {
+        hsd->output_index = bits << 16;
+        return HSDS_BACKREF_INDEX_MSB;
+    }
+}
+#endif
+
 static HSD_state st_backref_index_msb(heatshrink_decoder *hsd) {
     const uint32_t bit_ct = BACKREF_INDEX_BITS(hsd);
     ASSERT(bit_ct > 8);
-    const uint32_t bits = get_bits(hsd, bit_ct - 8);
+    const uint32_t bits = get_bits(hsd, bit_ct < 16 ? bit_ct - 8 : 8);
     LOG("-- backref index (msb), got 0x%04x (+1)\n", bits);
     // if (bits == NO_BITS) {
     if(no_bits(bits)) {        
          return HSDS_BACKREF_INDEX_MSB;
     } else {
-        hsd->output_index = bits << 8;
+        hsd->output_index |= bits << 8;
         return HSDS_BACKREF_INDEX_LSB;
     }
 }
@@ -261,20 +428,38 @@ static HSD_state st_backref_index_lsb(heatshrink_decoder *hsd) {
         hsd->output_index++;
         hsd->output_count = 0;    
         const uint32_t br_bit_ct = BACKREF_COUNT_BITS(hsd);
+        if (HEATSHRINK_MAX_WINDOW_BITS > 16 && br_bit_ct > 16) {
+            return HSDS_BACKREF_COUNT_HIGH;
+        }
         return (br_bit_ct > 8) ? HSDS_BACKREF_COUNT_MSB : HSDS_BACKREF_COUNT_LSB;
     }
 }
 
+#if HEATSHRINK_WIDE_INDEX
+static HSD_state st_backref_count_high(heatshrink_decoder *hsd) {
+    const uint32_t br_bit_ct = BACKREF_COUNT_BITS(hsd);
+    ASSERT(br_bit_ct > 16);
+    const uint32_t bits = get_bits(hsd, br_bit_ct - 16);
+    LOG("-- backref count (high), got 0x%04x (+1)\n", bits);
+    if(no_bits(bits)) {
+      return HSDS_BACKREF_COUNT_HIGH;
+    } else {
+        hsd->output_count = bits << 16;
+        return HSDS_BACKREF_COUNT_MSB;
+    }
+}
+#endif
+
 static HSD_state st_backref_count_msb(heatshrink_decoder *hsd) {
     const uint32_t br_bit_ct = BACKREF_COUNT_BITS(hsd);
     ASSERT(br_bit_ct > 8);
-    const uint32_t bits = get_bits(hsd, br_bit_ct - 8);
+    const uint32_t bits = get_bits(hsd, br_bit_ct < 16 ? br_bit_ct - 8 : 8);
     LOG("-- backref count (msb), got 0x%04x (+1)\n", bits);
     // if (bits == NO_BITS)
     if(no_bits(bits)) {
       return HSDS_BACKREF_COUNT_MSB;
     } else {
-        hsd->output_count = bits << 8;
+        hsd->output_count |= bits << 8;
         return HSDS_BACKREF_COUNT_LSB;
     }
 }
@@ -306,10 +491,32 @@ static HSD_state st_yield_backref(heatshrink_decoder *hsd,
         // ASSERT(neg_offset <= mask + 1);
         ASSERT(count <= (size_t)(1 << BACKREF_COUNT_BITS(hsd)));
 
-        {
-            uint32_t di = hsd->head_index;
+        const uint32_t offset = hsd->output_index;
+        uint32_t di = hsd->head_index & mask;
+        if (offset <= 4 && count >= 8 && offset <= di && di + count <= mask + 1) {
+            /* A run of a byte or of a pattern of up to 4 bytes, not wrapping
+             * around the window: store it a word at a time. */
+            uint8_t* const out = oi->buf + *oi->output_size;
+            uint8_t* const win = &buf[di];
+            const uint8_t* const src = win - offset;
+            uint8_t pattern[4];
+            for (uint32_t i = 0; i < 4; i++) { pattern[i] = src[i % offset]; }
+            /* Each store is a whole number of periods ahead of the previous one. */
+            const uint32_t step = (offset == 3) ? 3 : 4;
+            uint32_t i = 0;
+            for (; i + 4 <= count; i += step) {
+                memcpy(&win[i], pattern, 4);
+                memcpy(&out[i], pattern, 4);
+            }
+            for (; i < count; i++) {
+                win[i] = src[i];
+                out[i] = win[i];
+            }
+            *(oi->output_size) += count;
+            hsd->head_index = (di + count) & mask;
+        } else {
             const uint32_t dend = (di + count) & mask;
-            uint32_t si = (di - hsd->output_index) & mask;
+            uint32_t si = (di - offset) & mask;
             // if(count >= 4 && dend > di && (si + count) <= mask ) {
             //     memmove(buf+di,buf+si,count);
             //     memcpy(oi->buf + *(oi->output_size), buf+si, count);
@@ -340,11 +547,108 @@ static HSD_state st_yield_backref(heatshrink_decoder *hsd,
         //     LOG("  -- ++ 0x%02x\n", c);
         // }
         hsd->output_count -= count;
-        if (hsd->output_count == 0) { return HSDS_TAG_BIT; }
+        if (hsd->output_count == 0) { return next_token_state(hsd); }
+    }
+    return HSDS_YIELD_BACKREF;
+}
+
+#if HEATSHRINK_DYNAMIC_ALLOC
+static HSD_state st_plus_start(heatshrink_decoder *hsd) {
+    plus_input in { hsd };
+    return hsd->plus->rc.start(in) ? HSDS_PLUS_TAG : HSDS_PLUS_START;
+}
+
+static HSD_state st_plus_tag(heatshrink_decoder *hsd) {
+    hs_plus_decoder * const p = hsd->plus;
+    plus_input in { hsd };
+    const int32_t bit = p->rc.bit(p->model.is_literal[p->kinds], in);
+    if (bit < 0) {
+        return HSDS_PLUS_TAG;
+    }
+    p->kinds = heatshrink::plus::next_kinds(p->kinds, bit);
+    if (bit) {
+        p->node = 1;
+        return HSDS_PLUS_LITERAL;
+    } else {
+        return HSDS_PLUS_LENGTH;
+    }
+}
+
+static HSD_state st_plus_literal(heatshrink_decoder *hsd) {
+    hs_plus_decoder * const p = hsd->plus;
+    plus_input in { hsd };
+    /* The literal's context is the byte before it, the last in the window. */
+    const uint8_t* const buf = &hsd->buffers[HEATSHRINK_DECODER_INPUT_BUFFER_SIZE(hsd)];
+    const uint32_t mask = (1 << HEATSHRINK_DECODER_WINDOW_BITS(hsd)) - 1;
+    heatshrink::plus::prob_t* const probs = p->model.literal_tree(buf[(hsd->head_index - 1) & mask]);
+    uint32_t node = p->node;
+    while (node < 0x100) {
+        const int32_t bit = p->rc.bit(probs[node], in);
+        if (bit < 0) {
+            p->node = node;
+            return HSDS_PLUS_LITERAL;
+        }
+        node = (node << 1) | bit;
+    }
+    p->node = node;
+    return HSDS_PLUS_YIELD_LITERAL;
+}
+
+static HSD_state st_plus_yield_literal(heatshrink_decoder *hsd,
+        output_info *oi) {
+    if (*oi->output_size < oi->buf_size) {
+        const uint32_t byte = hsd->plus->node & 0xFF;
+        uint8_t* const buf = &hsd->buffers[HEATSHRINK_DECODER_INPUT_BUFFER_SIZE(hsd)];
+        const uint32_t mask = (1 << HEATSHRINK_DECODER_WINDOW_BITS(hsd)) - 1;
+        buf[hsd->head_index++ & mask] = byte;
+        push_byte(hsd, oi, byte);
+        return HSDS_PLUS_TAG;
+    } else {
+        return HSDS_PLUS_YIELD_LITERAL;
+    }
+}
+
+static HSD_state st_plus_length(heatshrink_decoder *hsd) {
+    hs_plus_decoder * const p = hsd->plus;
+    plus_input in { hsd };
+    const uint32_t value = p->number.decode(p->rc, p->model.length_slot, p->model.length, in);
+    if (value == 0) {
+        return HSDS_PLUS_LENGTH;
+    }
+    const uint32_t length = value - 1;
+    if (length == 0 || length > (1UL << BACKREF_COUNT_BITS(hsd))) {
+        /* The end marker (or corrupt input, which ends the stream too). */
+        LOG("-- end of heatshrink+ stream (length %u)\n", length);
+        return HSDS_PLUS_END;
     }
+    hsd->output_count = length;
+    return HSDS_PLUS_OFFSET;
+}
+
+static HSD_state st_plus_offset(heatshrink_decoder *hsd) {
+    hs_plus_decoder * const p = hsd->plus;
+    plus_input in { hsd };
+    const uint32_t offset = p->number.decode(p->rc, p->model.offset_slot_tree(hsd->output_count),
+        p->model.offset, in);
+    if (offset == 0) {
+        return HSDS_PLUS_OFFSET;
+    }
+    if (offset > (1UL << BACKREF_INDEX_BITS(hsd))) {
+        LOG("-- end of heatshrink+ stream (offset %u)\n", offset);
+        return HSDS_PLUS_END;
+    }
+    LOG("-- backref of %u bytes at -%u\n", (unsigned)hsd->output_count, offset);
+    hsd->output_index = offset;
     return HSDS_YIELD_BACKREF;
 }
 
+static HSD_state st_plus_end(heatshrink_decoder *hsd) {
+    hsd->input_index = 0;
+    hsd->input_size = 0;
+    return HSDS_PLUS_END;
+}
+#endif
+
 /* Get the next COUNT bits from the input buffer, saving incremental progress.
  * Returns NO_BITS on end of input, or if more than 15 bits are requested. */
 static uint32_t get_bits(heatshrink_decoder *hsd, uint32_t count) {
@@ -464,8 +768,21 @@ HSD_finish_res heatshrink_decoder_finish(heatshrink_decoder *hsd) {
      * marker bit followed by all 0s for index and count bits. */
     case HSDS_BACKREF_INDEX_LSB:
     case HSDS_BACKREF_INDEX_MSB:
+    case HSDS_BACKREF_INDEX_HIGH:
     case HSDS_BACKREF_COUNT_LSB:
     case HSDS_BACKREF_COUNT_MSB:
+    case HSDS_BACKREF_COUNT_HIGH:
+        return hsd->input_size == 0 ? HSDR_FINISH_DONE : HSDR_FINISH_MORE;
+
+    /* heatshrink+ input is complete after the end marker, and can't
+     * be decoded any further while waiting for more input. */
+    case HSDS_PLUS_END:
+        return HSDR_FINISH_DONE;
+    case HSDS_PLUS_START:
+    case HSDS_PLUS_TAG:
+    case HSDS_PLUS_LITERAL:
+    case HSDS_PLUS_LENGTH:
+    case HSDS_PLUS_OFFSET:
         return hsd->input_size == 0 ? HSDR_FINISH_DONE : HSDR_FINISH_MORE;
 
     /* If the output stream is padded with 0xFFs (possibly due to being in
@@ -479,10 +796,88 @@ HSD_finish_res heatshrink_decoder_finish(heatshrink_decoder *hsd) {
     }
 }
 
+/* The state at the start of a token. */
+static HSD_state next_token_state(heatshrink_decoder *hsd) {
+#if HEATSHRINK_DYNAMIC_ALLOC
+    if (hsd->plus != NULL) { return HSDS_PLUS_TAG; }
+#endif
+    return HSDS_TAG_BIT;
+    (void)hsd;
+}
+
 static void push_byte(heatshrink_decoder *hsd, output_info *oi, uint32_t byte) {
     LOG(" -- pushing byte: 0x%02x ('%c')\n", byte, isprint(byte) ? byte : '.');
     oi->buf[(*oi->output_size)++] = byte;
     // (void)hsd;
 }
 
+HSD_decompress_res heatshrink_decompress(const uint8_t *in_buf, size_t in_size,
+        uint8_t *out_buf, size_t out_buf_size,
+        uint8_t window_sz2, uint8_t lookahead_sz2, size_t *output_size) {
+    if ((in_buf == NULL && in_size != 0) || out_buf == NULL || output_size == NULL) [[unlikely]] {
+        return HSDR_DECOMPRESS_ERROR_NULL;
+    }
+    if ((window_sz2 < HEATSHRINK_MIN_WINDOW_BITS) ||
+        (window_sz2 > HEATSHRINK_MAX_WINDOW_BITS) ||
+        (lookahead_sz2 < HEATSHRINK_MIN_LOOKAHEAD_BITS) ||
+        (lookahead_sz2 >= window_sz2)) [[unlikely]] {
+        return HSDR_DECOMPRESS_ERROR_MISUSE;
+    }
+
+    const uint8_t *in = in_buf;
+    const uint8_t * const in_end = in_buf + in_size;
+    const uint32_t backref_bits = 1 + window_sz2 + lookahead_sz2;
+    uint64_t acc = 0;           /* the lowest count bits are unread */
+    uint32_t count = 0;
+    size_t pos = 0;
+    HSD_decompress_res res = HSDR_DECOMPRESS_OK;
+
+    while (true) {
+        if (count < 2 * HEATSHRINK_MAX_WINDOW_BITS) { /* a whole token is at most 1+W+(W-1) bits */
+            while (count <= 64 - 8 && in < in_end) {
+                acc = (acc << 8) | *in++;
+                count += 8;
+            }
+        }
+        /* A partial token at the end is the padding of the last byte. */
+        if (count == 0) { break; }
+        if ((acc >> (count - 1)) & 1) {
+            if (count < 1 + 8) { break; }
+            count -= 1 + 8;
+            if (pos == out_buf_size) {
+                res = HSDR_DECOMPRESS_ERROR_OUTPUT_FULL;
+                break;
+            }
+            out_buf[pos++] = acc >> count;
+        } else {
+            if (count < backref_bits) { break; }
+            count -= backref_bits;
+            const token_t token = acc >> count;
+            const size_t offset = ((token >> lookahead_sz2) & ((1 << window_sz2) - 1)) + 1;
+            size_t length = (token & ((1 << lookahead_sz2) - 1)) + 1;
+            LOG("-- backref of %zu bytes at -%zu\n", length, offset);
+            if (out_buf_size - pos < length) {
+                length = out_buf_size - pos;
+                res = HSDR_DECOMPRESS_ERROR_OUTPUT_FULL;
+            }
+            uint8_t * const dst = &out_buf[pos];
+            if (offset > pos) {
+                /* Before the start of the output, the window is all zeros. */
+                const size_t zeros = std::min(offset - pos, length);
+                memset(dst, 0, zeros);
+                for (size_t i = zeros; i < length; i++) { dst[i] = out_buf[pos + i - offset]; }
+            } else if (offset >= length) {
+                memcpy(dst, dst - offset, length);
+            } else {
+                const uint8_t * const src = dst - offset;
+                for (size_t i = 0; i < length; i++) { dst[i] = src[i]; }
+            }
+            pos += length;
+            if (res != HSDR_DECOMPRESS_OK) { break; }
+        }
+    }
+    *output_size = pos;
+    return res;
+}
+
 #endif // HEATSHRINK_32BIT
\ No newline at end of file
@@ -0,0 +1,363 @@
+/* Trains a preset dictionary (see heatshrink_encoder_set_dictionary) on a set
+ * of sample messages, e.g.
+ *
+ *     heatshrink_dict -w 10 -l 5 -o messages.dict samples/
+ *
+ * and reports how much smaller the messages get with it, for every window and
+ * lookahead size up to the ones given.
+ *
+ * A dictionary only helps the first occurrence of a string in a message; later
+ * ones can refer back into the message itself. So a candidate (a string of up
+ * to SEGMENT bytes starting anywhere in the samples) is scored by the bits the
+ * other samples save by one backref into it: Locator::find_longest_match(), the
+ * encoder's own search, finds the longest prefix of the candidate in each of
+ * them. The candidates which save the most bits per byte of the dictionary are
+ * taken until it is full, skipping those it already contains; the best ones go
+ * to its end, where they remain in the window longest and which smaller windows
+ * still see. Every fifth sample (of at least 10) is held out of the training to
+ * measure the gain. */
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+#include <getopt.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <vector>
+
+#include "heatshrink_encoder.h"
+#include "hs_search.hpp"
+
+using heatshrink::Locator;
+
+#define DEF_WINDOW_SZ2 11
+#define DEF_LOOKAHEAD_SZ2 4
+#define DEF_SEGMENT_SIZE 64
+/* Bounds for the training effort: candidates are scored against at most this
+ * many bytes of samples, and only the most promising ones are scored. */
+#define MAX_SCORED_BYTES (256 * 1024)
+#define MAX_CANDIDATES 8192
+/* Search kernels may read a vector's width beyond a match. */
+#define PADDING 64
+
+typedef struct {
+    uint32_t offset;            /* in the sample data */
+    uint32_t size;
+    bool training;
+} sample;
+
+typedef struct {
+    uint32_t pos;               /* in the sample data */
+    uint32_t sample;            /* which it comes from */
+    uint32_t count;             /* samples its first bytes occur in */
+    uint32_t length;            /* that other samples match, after scoring */
+    uint64_t gain;              /* bits saved in other samples, after scoring */
+} candidate;
+
+static std::vector<uint8_t> data;
+static std::vector<sample> samples;
+
+static void usage(void) {
+    fprintf(stderr,
+        "Usage:\n"
+        "  heatshrink_dict [-h] [-w BITS] [-l BITS] [-k SIZE] [-o DICT_FILE] SAMPLE_DIR|SAMPLE_FILE...\n"
+        "\n"
+        "Builds a preset dictionary of up to 2^w bytes for heatshrink -D from sample messages\n"
+        "(the files in the directories given, or the files themselves), and reports\n"
+        "the messages' compressed size with and without it for each -w and -l up to the\n"
+        "ones given.\n"
+        "\n"
+        " -h        print help\n"
+        " -w BITS   window size the dictionary is built for (default %d)\n"
+        " -l BITS   lookahead size the dictionary is built for (default %d)\n"
+        " -k SIZE   longest string to take from the samples at once (default %d)\n"
+        " -o FILE   write the dictionary to FILE (default: only report)\n",
+        DEF_WINDOW_SZ2, DEF_LOOKAHEAD_SZ2, DEF_SEGMENT_SIZE);
+    exit(1);
+}
+
+static void die(const char *msg) {
+    fprintf(stderr, "%s\n", msg);
+    exit(EXIT_FAILURE);
+}
+
+static void load_file(const char *fname) {
+    FILE *f = fopen(fname, "rb");
+    if (f == NULL) { perror(fname); exit(EXIT_FAILURE); }
+    const size_t offset = data.size();
+    uint8_t buf[4096];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), f)) > 0) {
+        data.insert(data.end(), buf, buf + n);
+    }
+    if (ferror(f)) { perror(fname); exit(EXIT_FAILURE); }
+    fclose(f);
+    if (data.size() > offset) {
+        samples.push_back(sample { (uint32_t)offset, (uint32_t)(data.size() - offset), true });
+    }
+}
+
+/* Load the files in directory DNAME (not its subdirectories), in order of
+ * their names. */
+static void load_dir(const char *dname) {
+    DIR *dir = opendir(dname);
+    if (dir == NULL) { perror(dname); exit(EXIT_FAILURE); }
+    std::vector<std::vector<char>> names;
+    const struct dirent *de;
+    while ((de = readdir(dir)) != NULL) {
+        if (de->d_name[0] == '.') { continue; }
+        std::vector<char> path(strlen(dname) + strlen(de->d_name) + 2);
+        snprintf(path.data(), path.size(), "%s/%s", dname, de->d_name);
+        struct stat st;
+        if (stat(path.data(), &st) == 0 && S_ISREG(st.st_mode)) { names.push_back(path); }
+    }
+    closedir(dir);
+    std::sort(names.begin(), names.end(), [](const std::vector<char>& a, const std::vector<char>& b) {
+        return strcmp(a.data(), b.data()) < 0;
+    });
+    for (const std::vector<char>& name : names) { load_file(name.data()); }
+}
+
+/* Bits that backrefs of LENGTH bytes in total save over literals. */
+static uint64_t backref_gain(uint32_t length, uint8_t window_sz2, uint8_t lookahead_sz2) {
+    const uint32_t backrefs = (length + (1 << lookahead_sz2) - 1) >> lookahead_sz2;
+    const uint64_t literal_bits = 9 * (uint64_t)length;
+    const uint64_t backref_bits = backrefs * (uint64_t)(1 + window_sz2 + lookahead_sz2);
+    return literal_bits > backref_bits ? literal_bits - backref_bits : 0;
+}
+
+static uint32_t hash_bytes(const uint8_t *p, uint32_t len) {
+    uint32_t h = 2166136261u;
+    for (uint32_t i = 0; i < len; i++) { h = (h ^ p[i]) * 16777619u; }
+    return h;
+}
+
+/* Candidates: the positions in training samples whose first MIN_LENGTH bytes
+ * (the shortest match worth a backref) occur in at least one other sample,
+ * each string of SEGMENT bytes only once, those occurring most widely first. */
+static std::vector<candidate> find_candidates(uint32_t min_length, uint32_t segment) {
+    /* Open addressing, hash -> (number of samples, last sample counted). */
+    const uint32_t table_bits = 22;
+    const uint32_t mask = (1u << table_bits) - 1;
+    std::vector<uint32_t> count(1u << table_bits, 0);
+    std::vector<uint32_t> last(1u << table_bits, UINT32_MAX);
+    for (uint32_t s = 0; s < samples.size(); s++) {
+        if (!samples[s].training) { continue; }
+        const uint8_t *p = &data[samples[s].offset];
+        for (uint32_t i = 0; i + min_length <= samples[s].size; i++) {
+            const uint32_t h = hash_bytes(&p[i], min_length) & mask;
+            if (last[h] != s) {
+                last[h] = s;
+                count[h]++;
+            }
+        }
+    }
+
+    std::vector<candidate> candidates;
+    std::vector<uint8_t> seen(1u << table_bits, 0);
+    for (uint32_t s = 0; s < samples.size(); s++) {
+        if (!samples[s].training) { continue; }
+        const uint8_t *p = &data[samples[s].offset];
+        for (uint32_t i = 0; i + min_length <= samples[s].size; i++) {
+            const uint32_t c = count[hash_bytes(&p[i], min_length) & mask];
+            if (c < 2) { continue; }
+            const uint32_t h = hash_bytes(&p[i], std::min(segment, samples[s].size - i)) & mask;
+            if (seen[h]) { continue; }
+            seen[h] = 1;
+            candidates.push_back(candidate { samples[s].offset + i, s, c, 0, 0 });
+        }
+    }
+    std::stable_sort(candidates.begin(), candidates.end(), [](const candidate& a, const candidate& b) {
+        return a.count > b.count;
+    });
+    if (candidates.size() > MAX_CANDIDATES) { candidates.resize(MAX_CANDIDATES); }
+    return candidates;
+}
+
+/* Score candidate C against the samples scored (except its own), and cut it
+ * to the longest prefix any of them matches. */
+static void score(candidate& c, uint32_t segment, uint32_t scored,
+        uint8_t window_sz2, uint8_t lookahead_sz2) {
+    const sample& own = samples[c.sample];
+    const uint32_t len = std::min(segment, own.offset + own.size - c.pos);
+    c.gain = 0;
+    c.length = 0;
+    if (len < 2) { return; }
+    for (uint32_t s = 0; s < scored; s++) {
+        if (s == c.sample || !samples[s].training) { continue; }
+        const heatshrink::byte_span m = Locator::find_longest_match(&data[c.pos], len,
+            &data[samples[s].offset], samples[s].size);
+        if (m.size() < 2) { continue; }
+        /* A match may run on into the next sample. */
+        const uint32_t n = std::min((uint32_t)m.size(),
+            (uint32_t)(&data[samples[s].offset + samples[s].size] - m.data()));
+        const uint64_t gain = n >= 2 ? backref_gain(n, window_sz2, lookahead_sz2) : 0;
+        if (gain > 0) {
+            c.gain += gain;
+            c.length = std::max(c.length, n);
+        }
+    }
+}
+
+static std::vector<uint8_t> train(uint8_t window_sz2, uint8_t lookahead_sz2, uint32_t segment) {
+    const uint32_t dict_size = 1u << window_sz2;
+    const uint32_t min_length = (1 + window_sz2 + lookahead_sz2) / 8 + 1;
+    std::vector<candidate> candidates = find_candidates(min_length, segment);
+
+    uint32_t scored = 0;
+    for (uint32_t bytes = 0; scored < samples.size() && bytes < MAX_SCORED_BYTES; scored++) {
+        bytes += samples[scored].size;
+    }
+    for (candidate& c : candidates) { score(c, segment, scored, window_sz2, lookahead_sz2); }
+    std::erase_if(candidates, [](const candidate& c) { return c.gain == 0; });
+    /* Most bits saved per dictionary byte first. */
+    std::stable_sort(candidates.begin(), candidates.end(), [](const candidate& a, const candidate& b) {
+        return a.gain * b.length > b.gain * a.length;
+    });
+
+    /* Collected best first, then reversed so the best end up last. */
+    std::vector<uint8_t> picked;
+    std::vector<uint32_t> ends;
+    picked.reserve(dict_size + segment + PADDING);
+    for (const candidate& c : candidates) {
+        if (picked.size() >= dict_size) { break; }
+        if (!picked.empty()) {
+            picked.resize(picked.size() + PADDING);
+            const heatshrink::byte_span m = Locator::find_longest_match(&data[c.pos], c.length,
+                picked.data(), picked.size() - PADDING);
+            picked.resize(picked.size() - PADDING);
+            if (m.size() == c.length) { continue; }     /* already in there */
+        }
+        picked.insert(picked.end(), &data[c.pos], &data[c.pos + c.length]);
+        ends.push_back(picked.size());
+    }
+
+    std::vector<uint8_t> dict;
+    for (size_t i = ends.size(); i-- > 0; ) {
+        const uint32_t start = (i == 0) ? 0 : ends[i - 1];
+        dict.insert(dict.end(), &picked[start], &picked[ends[i]]);
+    }
+    /* The strings picked last (partly) fell off the start. */
+    if (dict.size() > dict_size) { dict.erase(dict.begin(), dict.end() - dict_size); }
+    return dict;
+}
+
+/* The compressed size of IN, compressed with HSE, which is freed. */
+static size_t compressed_size(heatshrink_encoder *hse, const uint8_t *in, size_t in_size) {
+    uint8_t out[4096];
+    size_t sunk = 0, total = 0, count = 0;
+    while (sunk < in_size) {
+        heatshrink_encoder_sink(hse, &in[sunk], in_size - sunk, &count);
+        sunk += count;
+        while (heatshrink_encoder_poll(hse, out, sizeof(out), &count) == HSER_POLL_MORE) {
+            total += count;
+        }
+        total += count;
+    }
+    while (heatshrink_encoder_finish(hse) == HSER_FINISH_MORE) {
+        heatshrink_encoder_poll(hse, out, sizeof(out), &count);
+        total += count;
+    }
+    heatshrink_encoder_free(hse);
+    return total;
+}
+
+static heatshrink_encoder *new_encoder(uint8_t window_sz2, uint8_t lookahead_sz2,
+        const std::vector<uint8_t> *dict) {
+    heatshrink_encoder *hse = heatshrink_encoder_alloc(window_sz2, lookahead_sz2);
+    if (hse == NULL) { die("failed to init encoder: bad settings"); }
+    if (dict != NULL && heatshrink_encoder_set_dictionary(hse, dict->data(), dict->size()) < 0) {
+        die("set_dictionary");
+    }
+    return hse;
+}
+
+/* Compress every evaluation sample on its own, with and without DICT (of
+ * which smaller windows only see the end). */
+static void report(const std::vector<uint8_t>& dict, uint8_t window_sz2, uint8_t lookahead_sz2,
+        bool held_out) {
+    size_t count = 0, bytes = 0;
+    for (const sample& s : samples) {
+        if (s.training == held_out) { continue; }
+        count++;
+        bytes += s.size;
+    }
+    printf("%zu %s samples, %zu bytes; dictionary of %zu bytes\n\n",
+        count, held_out ? "held-out" : "training", bytes, dict.size());
+    printf("  -w  -l     plain   with -D   ratio   with -D    gain\n");
+    for (int w = std::max(HEATSHRINK_MIN_WINDOW_BITS, window_sz2 - 3); w <= window_sz2; w++) {
+        for (int l = std::max(HEATSHRINK_MIN_LOOKAHEAD_BITS, lookahead_sz2 - 3); l <= lookahead_sz2 && l < w; l++) {
+            size_t plain = 0, with_dict = 0;
+            for (const sample& s : samples) {
+                if (s.training == held_out) { continue; }
+                plain += compressed_size(new_encoder(w, l, NULL), &data[s.offset], s.size);
+                with_dict += compressed_size(new_encoder(w, l, &dict), &data[s.offset], s.size);
+            }
+            printf("  %2u  %2u  %8zu  %8zu  %5.1f%%    %5.1f%%  %5.1f%%\n", w, l, plain, with_dict,
+                100.0 * plain / bytes, 100.0 * with_dict / bytes,
+                100.0 - (100.0 * with_dict) / plain);
+        }
+    }
+}
+
+int main(int argc, char **argv) {
+    uint8_t window_sz2 = DEF_WINDOW_SZ2;
+    uint8_t lookahead_sz2 = DEF_LOOKAHEAD_SZ2;
+    uint32_t segment = DEF_SEGMENT_SIZE;
+    const char *out_fname = NULL;
+
+    int a = 0;
+    while ((a = getopt(argc, argv, "hw:l:k:o:")) != -1) {
+        switch (a) {
+        case 'w':               /* window bits */
+            window_sz2 = atoi(optarg);
+            break;
+        case 'l':               /* lookahead bits */
+            lookahead_sz2 = atoi(optarg);
+            break;
+        case 'k':               /* segment size */
+            segment = atoi(optarg);
+            break;
+        case 'o':               /* dictionary file */
+            out_fname = optarg;
+            break;
+        case 'h':               /* help */
+        case '?':               /* unknown argument */
+        default:
+            usage();
+        }
+    }
+    if (window_sz2 < HEATSHRINK_MIN_WINDOW_BITS || window_sz2 > HEATSHRINK_MAX_WINDOW_BITS ||
+        lookahead_sz2 < HEATSHRINK_MIN_LOOKAHEAD_BITS || lookahead_sz2 >= window_sz2 ||
+        segment < 2) {
+        die("bad settings");
+    }
+    if (optind >= argc) { usage(); }
+    for (int i = optind; i < argc; i++) {
+        struct stat st;
+        if (stat(argv[i], &st) != 0) { perror(argv[i]); exit(EXIT_FAILURE); }
+        if (S_ISDIR(st.st_mode)) {
+            load_dir(argv[i]);
+        } else {
+            load_file(argv[i]);
+        }
+    }
+    if (samples.size() < 2) { die("need at least 2 (non-empty) samples"); }
+    const bool held_out = samples.size() >= 10;
+    if (held_out) {
+        for (size_t i = 4; i < samples.size(); i += 5) { samples[i].training = false; }
+    }
+    data.resize(data.size() + PADDING);
+
+    const std::vector<uint8_t> dict = train(window_sz2, lookahead_sz2, segment);
+    if (out_fname != NULL) {
+        FILE *f = fopen(out_fname, "wb");
+        if (f == NULL || fwrite(dict.data(), 1, dict.size(), f) != dict.size() || fclose(f) != 0) {
+            perror(out_fname);
+            exit(EXIT_FAILURE);
+        }
+    }
+    report(dict, window_sz2, lookahead_sz2, held_out);
+    return 0;
+}
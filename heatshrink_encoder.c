@@ -65,6 +65,7 @@ typedef struct {
 } output_info;
 
 #define MATCH_NOT_FOUND ((uint16_t)-1)
+#define INDEX_NONE ((uint16_t)-1)
 
 static uint16_t get_input_offset(heatshrink_encoder *hse);
 static uint16_t get_input_buffer_size(heatshrink_encoder *hse);
@@ -100,16 +101,16 @@ heatshrink_encoder *heatshrink_encoder_alloc(uint8_t window_sz2,
     if (hse == NULL) { return NULL; }
     hse->window_sz2 = window_sz2;
     hse->lookahead_sz2 = lookahead_sz2;
+    hse->level = HEATSHRINK_LEVEL_DEFAULT;
     heatshrink_encoder_reset(hse);
 
 #if HEATSHRINK_USE_INDEX
     size_t index_sz = buf_sz*sizeof(uint16_t);
-    hse->search_index = (struct hs_index*) HEATSHRINK_MALLOC(index_sz + sizeof(struct hs_index));
+    hse->search_index = (uint16_t*) HEATSHRINK_MALLOC(index_sz);
     if (hse->search_index == NULL) {
         HEATSHRINK_FREE(hse, sizeof(*hse) + buf_sz);
         return NULL;
     }
-    hse->search_index->size = index_sz;
 #endif
 
     LOG("-- allocated encoder with buffer size of %zu (%u byte input size)\n",
@@ -117,10 +118,19 @@ heatshrink_encoder *heatshrink_encoder_alloc(uint8_t window_sz2,
     return hse;
 }
 
+heatshrink_encoder *heatshrink_encoder_alloc_ex(uint8_t window_sz2,
+        uint8_t lookahead_sz2, uint8_t level) {
+    if (level > HEATSHRINK_LEVEL_MAX_RATIO) { return NULL; }
+    heatshrink_encoder *hse = heatshrink_encoder_alloc(window_sz2, lookahead_sz2);
+    if (hse != NULL) { hse->level = level; }
+    return hse;
+}
+
 void heatshrink_encoder_free(heatshrink_encoder *hse) {
+    if (hse == NULL) { return; }
     size_t buf_sz = (2 << HEATSHRINK_ENCODER_WINDOW_BITS(hse));
 #if HEATSHRINK_USE_INDEX
-    size_t index_sz = sizeof(struct hs_index) + hse->search_index->size;
+    size_t index_sz = buf_sz*sizeof(uint16_t);
     HEATSHRINK_FREE(hse->search_index, index_sz);
     (void)index_sz;
 #endif
@@ -148,6 +158,22 @@ void heatshrink_encoder_reset(heatshrink_encoder *hse) {
     #endif
 }
 
+HSE_dictionary_res heatshrink_encoder_set_dictionary(heatshrink_encoder *hse,
+        const uint8_t *dict, size_t dict_size) {
+    if ((hse == NULL) || (dict == NULL && dict_size != 0)) {
+        return HSER_DICTIONARY_ERROR_NULL;
+    }
+    if (is_finishing(hse) || hse->state != HSES_NOT_FULL || hse->input_size != 0) {
+        return HSER_DICTIONARY_ERROR_MISUSE;
+    }
+
+    /* The dictionary ends where the input starts, like the previous block. */
+    uint16_t input_offset = get_input_offset(hse);
+    size_t n = dict_size < input_offset ? dict_size : input_offset;
+    memcpy(&hse->buffer[input_offset - n], dict + (dict_size - n), n);
+    return HSER_DICTIONARY_OK;
+}
+
 HSE_sink_res heatshrink_encoder_sink(heatshrink_encoder *hse,
         const uint8_t *in_buf, size_t size, size_t *input_size) {
     if ((hse == NULL) || (in_buf == NULL) || (input_size == NULL)) {
@@ -420,32 +446,30 @@ static void do_indexing(heatshrink_encoder *hse) {
      * for the previous instances of every byte in the buffer.
      * 
      * For example, if buf[200] == 'x', then index[200] will either
-     * be an offset i such that buf[i] == 'x', or a negative offset
-     * to indicate end-of-list. This significantly speeds up matching,
-     * while only using sizeof(uint16_t)*sizeof(buffer) bytes of RAM.
+     * be an offset i such that buf[i] == 'x', or INDEX_NONE to
+     * indicate end-of-list. (Only the last byte of a 2^16 byte buffer
+     * is at offset 0xFFFF, and it never precedes another one.) This
+     * significantly speeds up matching, while only using
+     * sizeof(uint16_t)*sizeof(buffer) bytes of RAM.
      *
-     * Future optimization options:
-     * 1. Since any negative value represents end-of-list, the other
-     *    15 bits could be used to improve the index dynamically.
-     *    
-     * 2. Likewise, the last lookahead_sz bytes of the index will
-     *    not be usable, so temporary data could be stored there to
-     *    dynamically improve the index.
+     * Future optimization option:
+     * The last lookahead_sz bytes of the index will not be usable,
+     * so temporary data could be stored there to dynamically improve
+     * the index.
      * */
-    struct hs_index *hsi = HEATSHRINK_ENCODER_INDEX(hse);
-    int16_t last[256];
+    uint16_t last[256];
     memset(last, 0xFF, sizeof(last));
 
     uint8_t * const data = hse->buffer;
-    int16_t * const index = hsi->index;
+    uint16_t * const index = HEATSHRINK_ENCODER_INDEX(hse);
 
     const uint16_t input_offset = get_input_offset(hse);
-    const uint16_t end = input_offset + hse->input_size;
+    /* (2^16 with a full buffer at -w 15) */
+    const uint32_t end = input_offset + hse->input_size;
 
-    for (uint16_t i=0; i<end; i++) {
+    for (uint32_t i=0; i<end; i++) {
         uint8_t v = data[i];
-        int16_t lv = last[v];
-        index[i] = lv;
+        index[i] = last[v];
         last[v] = i;
     }
 #else
@@ -475,10 +499,10 @@ static uint16_t find_longest_match(heatshrink_encoder *hse, uint16_t start,
     uint16_t len = 0;
     uint8_t * const needlepoint = &buf[end];
 #if HEATSHRINK_USE_INDEX
-    struct hs_index *hsi = HEATSHRINK_ENCODER_INDEX(hse);
-    int16_t pos = hsi->index[end];
+    const uint16_t * const index = HEATSHRINK_ENCODER_INDEX(hse);
+    uint16_t pos = index[end];
 
-    while (pos - (int16_t)start >= 0) {
+    while (pos != INDEX_NONE && pos >= start) {
         uint8_t * const pospoint = &buf[pos];
         len = 0;
 
@@ -486,7 +510,7 @@ static uint16_t find_longest_match(heatshrink_encoder *hse, uint16_t start,
          * This is redundant with the index if match_maxlen is 0, but the
          * added branch overhead to check if it == 0 seems to be worse. */
         if (pospoint[match_maxlen] != needlepoint[match_maxlen]) {
-            pos = hsi->index[pos];
+            pos = index[pos];
             continue;
         }
 
@@ -499,17 +523,17 @@ static uint16_t find_longest_match(heatshrink_encoder *hse, uint16_t start,
             match_index = pos;
             if (len == maxlen) { break; } /* won't find better */
         }
-        pos = hsi->index[pos];
+        pos = index[pos];
     }
 #else    
-    for (int16_t pos=end - 1; pos - (int16_t)start >= 0; pos--) {
+    for (int32_t pos=end - 1; pos >= start; pos--) {
         uint8_t * const pospoint = &buf[pos];
         if ((pospoint[match_maxlen] == needlepoint[match_maxlen])
             && (*pospoint == *needlepoint)) {
             for (len=1; len<maxlen; len++) {
                 if (0) {
                     LOG("  --> cmp buf[%d] == 0x%02x against %02x (start %u)\n",
-                        pos + len, pospoint[len], needlepoint[len], start);
+                        (int)(pos + len), pospoint[len], needlepoint[len], start);
                 }
                 if (pospoint[len] != needlepoint[len]) { break; }
             }
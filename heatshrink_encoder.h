@@ -19,6 +19,12 @@ typedef enum {
     HSER_SINK_ERROR_MISUSE=-2,  /* API misuse */
 } HSE_sink_res;
 
+typedef enum {
+    HSER_DICTIONARY_OK,             /* dictionary loaded into the window */
+    HSER_DICTIONARY_ERROR_NULL=-1,  /* NULL argument */
+    HSER_DICTIONARY_ERROR_MISUSE=-2,/* input was already sunk */
+} HSE_dictionary_res;
+
 typedef enum {
     HSER_POLL_EMPTY,            /* input exhausted */
     HSER_POLL_MORE,             /* poll again for more output  */
@@ -32,31 +38,107 @@ typedef enum {
     HSER_FINISH_ERROR_NULL=-1,  /* NULL argument */
 } HSE_finish_res;
 
+typedef enum {
+    HSER_COMPRESS_OK,                   /* all input compressed */
+    HSER_COMPRESS_ERROR_NULL=-1,        /* NULL argument */
+    HSER_COMPRESS_ERROR_MISUSE=-2,      /* invalid window/lookahead size */
+    HSER_COMPRESS_ERROR_OUTPUT_FULL=-3, /* output buffer too small */
+} HSE_compress_res;
+
+#if HEATSHRINK_WIDE_INDEX
+/* Buffer positions and distances in the index and hash chain. */
+typedef uint32_t hs_index_t;
+#else
+typedef uint16_t hs_index_t;
+#endif
+
+#if HEATSHRINK_32BIT && HEATSHRINK_CIRCULAR_WINDOW
+/* With HEATSHRINK_CIRCULAR_WINDOW, the buffer is a ring, which data never
+ * moves around in. It holds the window and a window's worth of input or,
+ * with HEATSHRINK_COMPACT_ENCODER, two lookaheads' worth, which is refilled
+ * a lookahead at a time. The ring sits between copies of its last 4 and its
+ * first 2^LOOKAHEAD_SZ2 bytes, so that patterns and matches can be compared
+ * in place across the seam. */
+#define HEATSHRINK_ENCODER_RING_GUARD 4
+#if HEATSHRINK_COMPACT_ENCODER
+#define HEATSHRINK_ENCODER_INPUT_SIZE(WINDOW_SZ2, LOOKAHEAD_SZ2) \
+    (2 << (LOOKAHEAD_SZ2))
+#else
+#define HEATSHRINK_ENCODER_INPUT_SIZE(WINDOW_SZ2, LOOKAHEAD_SZ2) \
+    (1 << (WINDOW_SZ2))
+#endif
+#define HEATSHRINK_ENCODER_RING_SIZE(WINDOW_SZ2, LOOKAHEAD_SZ2) \
+    ((1 << (WINDOW_SZ2)) + HEATSHRINK_ENCODER_INPUT_SIZE(WINDOW_SZ2, LOOKAHEAD_SZ2))
+#define HEATSHRINK_ENCODER_BUFFER_SIZE(WINDOW_SZ2, LOOKAHEAD_SZ2) \
+    (HEATSHRINK_ENCODER_RING_GUARD + HEATSHRINK_ENCODER_RING_SIZE(WINDOW_SZ2, LOOKAHEAD_SZ2) + \
+        (1 << (LOOKAHEAD_SZ2)))
+#else
+/* The buffer holds the window and a window's worth of input. */
+#define HEATSHRINK_ENCODER_RING_GUARD 0
+#define HEATSHRINK_ENCODER_INPUT_SIZE(WINDOW_SZ2, LOOKAHEAD_SZ2) \
+    (1 << (WINDOW_SZ2))
+#define HEATSHRINK_ENCODER_RING_SIZE(WINDOW_SZ2, LOOKAHEAD_SZ2) \
+    (2 << (WINDOW_SZ2))
+#define HEATSHRINK_ENCODER_BUFFER_SIZE(WINDOW_SZ2, LOOKAHEAD_SZ2) \
+    HEATSHRINK_ENCODER_RING_SIZE(WINDOW_SZ2, LOOKAHEAD_SZ2)
+#endif
+
 #if HEATSHRINK_DYNAMIC_ALLOC
 #define HEATSHRINK_ENCODER_WINDOW_BITS(HSE) \
     ((HSE)->window_sz2)
 #define HEATSHRINK_ENCODER_LOOKAHEAD_BITS(HSE) \
     ((HSE)->lookahead_sz2)
+#define HEATSHRINK_ENCODER_LEVEL(HSE) \
+    ((HSE)->level)
 #define HEATSHRINK_ENCODER_INDEX(HSE) \
     ((HSE)->search_index)
+#if HEATSHRINK_32BIT
 struct hs_index {
-    uint16_t size;
-    int16_t index[];
+    uint32_t indexed;       /* buffer positions below this are indexed */
+    uint32_t last[256];     /* last position of each byte value */
+    hs_index_t index[];
 };
+#endif
+#if HEATSHRINK_USE_HASH_CHAIN
+#define HEATSHRINK_ENCODER_HASH_CHAIN(HSE) \
+    ((HSE)->hash_chain)
+struct hs_hash_chain {
+    uint32_t head[1 << HEATSHRINK_HASH_BITS];
+    hs_index_t chain[];
+};
+#endif
 #else
 #define HEATSHRINK_ENCODER_WINDOW_BITS(_) \
     (HEATSHRINK_STATIC_WINDOW_BITS)
 #define HEATSHRINK_ENCODER_LOOKAHEAD_BITS(_) \
     (HEATSHRINK_STATIC_LOOKAHEAD_BITS)
+#define HEATSHRINK_ENCODER_LEVEL(_) \
+    (HEATSHRINK_STATIC_LEVEL)
+#if HEATSHRINK_32BIT
 #define HEATSHRINK_ENCODER_INDEX(HSE) \
     (&(HSE)->search_index)
 struct hs_index {
-    uint16_t size;
-    int16_t index[2 << HEATSHRINK_STATIC_WINDOW_BITS];
+    uint32_t indexed;       /* buffer positions below this are indexed */
+    uint32_t last[256];     /* last position of each byte value */
+    hs_index_t index[HEATSHRINK_ENCODER_RING_SIZE(HEATSHRINK_STATIC_WINDOW_BITS,
+        HEATSHRINK_STATIC_LOOKAHEAD_BITS)];
+};
+#else
+#define HEATSHRINK_ENCODER_INDEX(HSE) \
+    ((HSE)->search_index)
+#endif
+#if HEATSHRINK_USE_HASH_CHAIN
+#define HEATSHRINK_ENCODER_HASH_CHAIN(HSE) \
+    (&(HSE)->hash_chain)
+struct hs_hash_chain {
+    uint32_t head[1 << HEATSHRINK_HASH_BITS];
+    hs_index_t chain[HEATSHRINK_ENCODER_RING_SIZE(HEATSHRINK_STATIC_WINDOW_BITS,
+        HEATSHRINK_STATIC_LOOKAHEAD_BITS)];
 };
 #endif
+#endif
 
-#if 0 && HEATSHRINK_32BIT
+#if HEATSHRINK_WIDE_INDEX
 typedef uint32_t hs_word_t;
 typedef uint32_t hs_hword_t;
 #else
@@ -69,6 +151,20 @@ typedef struct {
     hs_word_t match_scan_index;
     hs_word_t match_length;
     hs_word_t match_pos;
+#if HEATSHRINK_LAZY_MATCHING
+    hs_word_t lazy_length;       /* match already found at match_scan_index, or 0 */
+    hs_word_t lazy_pos;
+#endif
+#if HEATSHRINK_32BIT
+    hs_word_t cached_end;        /* a match of at least cached_length (0: none) bytes */
+    hs_word_t cached_pos;        /* for buf[cached_end] is at buf[cached_pos] */
+    hs_word_t cached_length;
+    hs_word_t misses;            /* searches without a match since the last one */
+    hs_word_t skip_count;        /* positions left to emit as literals w/o searching */
+#if HEATSHRINK_CIRCULAR_WINDOW
+    hs_word_t ring_base;         /* ring index of buffer position 0 */
+#endif
+#endif
     hs_word_t outgoing_bits;     /* enqueued outgoing bits */
     hs_hword_t outgoing_bits_count;
     hs_hword_t flags;
@@ -78,36 +174,105 @@ typedef struct {
 #if HEATSHRINK_DYNAMIC_ALLOC
     hs_hword_t window_sz2;         /* 2^n size of window */
     hs_hword_t lookahead_sz2;      /* 2^n size of lookahead */
+    hs_hword_t level;              /* HEATSHRINK_LEVEL_* */
 #if HEATSHRINK_USE_INDEX
+#if HEATSHRINK_32BIT
     struct hs_index *search_index;
+#else
+    uint16_t *search_index;        /* previous position of the same byte */
+#endif
+#endif
+#if HEATSHRINK_USE_HASH_CHAIN
+    struct hs_hash_chain *hash_chain;
+#endif
+    struct hs_parse *parse;        /* HEATSHRINK_LEVEL_MAX_RATIO only, else NULL */
+#if HEATSHRINK_32BIT
+    struct hs_plus_encoder *plus;  /* heatshrink+ format only, else NULL */
 #endif
     /* input buffer and / sliding window for expansion */
     uint8_t buffer[];
 #else
     #if HEATSHRINK_USE_INDEX
+        #if HEATSHRINK_32BIT
         struct hs_index search_index;
+        #else
+        uint16_t search_index[HEATSHRINK_ENCODER_BUFFER_SIZE(HEATSHRINK_STATIC_WINDOW_BITS,
+            HEATSHRINK_STATIC_LOOKAHEAD_BITS)];
+        #endif
+    #endif
+    #if HEATSHRINK_USE_HASH_CHAIN
+        struct hs_hash_chain hash_chain;
     #endif
     /* input buffer and / sliding window for expansion */
-    uint8_t buffer[2 << HEATSHRINK_ENCODER_WINDOW_BITS(_)];
+    uint8_t buffer[HEATSHRINK_ENCODER_BUFFER_SIZE(HEATSHRINK_STATIC_WINDOW_BITS,
+        HEATSHRINK_STATIC_LOOKAHEAD_BITS)];
 #endif
 } heatshrink_encoder;
 
+/* Encoder levels for heatshrink_encoder_alloc_ex and HEATSHRINK_STATIC_LEVEL. */
+#define HEATSHRINK_LEVEL_DEFAULT 0      /* greedy matching, as heatshrink_encoder_alloc */
+#define HEATSHRINK_LEVEL_FASTEST 1      /* levels 1 to 9 bound the search work per byte */
+#define HEATSHRINK_LEVEL_SLOWEST 9      /* (candidates, distance, good-enough length) */
+#define HEATSHRINK_LEVEL_MAX_RATIO 10   /* optimal parse of each window-sized block; much
+                                         * slower, meant for compressing offline */
+
+#if !HEATSHRINK_DYNAMIC_ALLOC && HEATSHRINK_STATIC_LEVEL > HEATSHRINK_LEVEL_SLOWEST
+#error HEATSHRINK_STATIC_LEVEL must be at most 9 (HEATSHRINK_LEVEL_MAX_RATIO needs dynamic allocation).
+#endif
+
 #if HEATSHRINK_DYNAMIC_ALLOC
+
 /* Allocate a new encoder struct and its buffers.
  * Returns NULL on error. */
 heatshrink_encoder *heatshrink_encoder_alloc(uint8_t window_sz2,
     uint8_t lookahead_sz2);
 
-/* Free an encoder. */
+/* Allocate a new encoder struct and its buffers, compressing at LEVEL
+ * (HEATSHRINK_LEVEL_*). Levels 1 to 9 cap the candidates verified, the
+ * distance searched and the match length that ends the search at each
+ * position, for a predictable cost per byte on incompressible input. The
+ * output of every level can be expanded by the same decoder. Levels above
+ * HEATSHRINK_LEVEL_DEFAULT are only implemented by the 32-bit variant; the
+ * original encoder treats them as the default.
+ * Returns NULL on error. */
+heatshrink_encoder *heatshrink_encoder_alloc_ex(uint8_t window_sz2,
+    uint8_t lookahead_sz2, uint8_t level);
+
+#if HEATSHRINK_32BIT
+/* Allocate a new encoder struct and its buffers, compressing at LEVEL into
+ * the "heatshrink+" format: the same tokens as the regular format, but range
+ * coded with adaptive models, which saves about 15% of the output on text
+ * (up to 30% with large lookaheads) and codes incompressible data in 1%
+ * more than its size. It can only be expanded by a decoder from
+ * heatshrink_decoder_alloc_plus with the same window and lookahead sizes.
+ * The models and coder take about 1.1 KB (see
+ * HEATSHRINK_PLUS_LITERAL_CONTEXT_BITS). 32-bit variant only.
+ * Returns NULL on error. */
+heatshrink_encoder *heatshrink_encoder_alloc_plus(uint8_t window_sz2,
+    uint8_t lookahead_sz2, uint8_t level);
+#endif
+
+/* Free an encoder (if HSE is not NULL). */
 void heatshrink_encoder_free(heatshrink_encoder *hse);
 #endif
 
 /* Reset an encoder. */
 void heatshrink_encoder_reset(heatshrink_encoder *hse);
 
+/* Preset the window with the last (up to 2^window_sz2) of the DICT_SIZE
+ * bytes at DICT, so that the input can refer back to them from its first
+ * byte on; e.g. a sample of typical messages makes short ones compressible.
+ * Call after alloc or reset, before the first sink. The data can only be
+ * expanded by a decoder given the same dictionary. */
+HSE_dictionary_res heatshrink_encoder_set_dictionary(heatshrink_encoder *hse,
+    const uint8_t *dict, size_t dict_size);
+
 /* Sink up to SIZE bytes from IN_BUF into the encoder.
  * INPUT_SIZE is set to the number of bytes actually sunk (in case a
- * buffer was filled.). */
+ * buffer was filled.). Once the buffer is full, the encoder must be
+ * polled before sinking more; until then this returns
+ * HSER_SINK_ERROR_MISUSE, or, with HEATSHRINK_COMPACT_ENCODER (an API
+ * change), HSER_SINK_OK with INPUT_SIZE set to 0. */
 HSE_sink_res heatshrink_encoder_sink(heatshrink_encoder *hse,
     const uint8_t *in_buf, size_t size, size_t *input_size);
 
@@ -121,6 +286,42 @@ HSE_poll_res heatshrink_encoder_poll(heatshrink_encoder *hse,
  * call heatshrink_encoder_poll and repeat. */
 HSE_finish_res heatshrink_encoder_finish(heatshrink_encoder *hse);
 
+/* Worst-case size of IN_SIZE bytes compressed by heatshrink_compress or the
+ * encoder: 9 bits per byte, rounded up. */
+#define HEATSHRINK_COMPRESS_BOUND(IN_SIZE) ((IN_SIZE) + ((IN_SIZE) + 7) / 8)
+
+static inline size_t heatshrink_compress_bound(size_t in_size) {
+    return HEATSHRINK_COMPRESS_BOUND(in_size);
+}
+
+#if HEATSHRINK_32BIT
+/* Compress the IN_SIZE bytes at IN_BUF into OUT_BUF in one go, with a window
+ * of 2^WINDOW_SZ2 and a lookahead of 2^LOOKAHEAD_SZ2 bytes, setting
+ * *OUTPUT_SIZE to the compressed size. IN_BUF itself is searched as the
+ * window, so this needs no encoder or buffers and copies nothing. The output
+ * is expanded by the regular decoder; OUT_BUF_SIZE of
+ * heatshrink_compress_bound(IN_SIZE) is always enough. 32-bit variant only. */
+HSE_compress_res heatshrink_compress(const uint8_t *in_buf, size_t in_size,
+    uint8_t *out_buf, size_t out_buf_size,
+    uint8_t window_sz2, uint8_t lookahead_sz2, size_t *output_size);
+
+/* A token of the encoder's parse: a literal byte, or a backref repeating
+ * LENGTH bytes from OFFSET bytes back. */
+typedef struct {
+    uint32_t offset;            /* 1 to 2^window_sz2, or 0 for a literal */
+    uint32_t length;            /* 1 to 2^lookahead_sz2, or the literal byte */
+} heatshrink_token;
+
+/* Poll for the encoder's parse as tokens rather than packed bits, copying at
+ * most MAX_TOKENS into TOKENS (setting *TOKEN_COUNT to the actual amount).
+ * The tokens are the same ones heatshrink_encoder_poll packs, so the match
+ * finder can feed another output format (or packing can be batched). Use
+ * either this or heatshrink_encoder_poll on an encoder until it is reset.
+ * 32-bit variant only. */
+HSE_poll_res heatshrink_encoder_poll_tokens(heatshrink_encoder *hse,
+    heatshrink_token *tokens, size_t max_tokens, size_t *token_count);
+#endif
+
 #endif
 
 #ifdef __cplusplus
@@ -11,6 +11,7 @@
 #include "heatshrink_encoder.h"
 
 #include "hs_search.hpp"
+#include "hs_plus.hpp"
 
 
 
@@ -21,6 +22,13 @@ extern "C"
 typedef uint32_t uint_t;
 typedef int32_t  int_t;
 
+/* The bits of a token: up to 1+15+14, or 1+20+19 with HEATSHRINK_WIDE_INDEX. */
+#if HEATSHRINK_WIDE_INDEX
+typedef uint64_t token_t;
+#else
+typedef uint32_t token_t;
+#endif
+
 typedef enum {
     HSES_NOT_FULL,              /* input buffer not full enough */
     HSES_FILLED,                /* buffer is full */
@@ -71,6 +79,7 @@ constexpr uint8_t BIT_INDEX_INIT = 0x0;
 // Encoder flags
 enum {
     FLAG_IS_FINISHING = 0x01,
+    FLAG_PLUS_FLUSHED = 0x02,       /* heatshrink+: end marker and code flushed */
 };
 
 typedef struct {
@@ -81,23 +90,142 @@ typedef struct {
 
 #define MATCH_NOT_FOUND ((uint_t)-1)
 
+/* Output room for push_token(): a token and the bits pending from the last
+ * one fit a 64-bit word, which is stored whole. */
+constexpr size_t TOKEN_ROOM = sizeof(uint64_t);
+
+/* Runs of a pattern up to this long are looked for before the window. */
+constexpr uint_t RUN_MAX_DISTANCE = 4;
+
+/* Bounds on the search work at each position, by encoder level. */
+struct hs_level_limits {
+    uint16_t max_candidates;    /* candidates tried (successively longer matches w/o index or hash chain) */
+    uint8_t distance_shift;     /* search only the nearest (window size >> shift) bytes */
+    uint16_t good_length;       /* a match at least this long ends the search */
+    uint8_t skip_shift;         /* after n misses, skip n >> shift positions (0: never) */
+};
+
+/* Max. positions skipped between two searches on incompressible input. */
+constexpr uint_t MAX_SKIP = 64;
+
+#if HEATSHRINK_USE_HASH_CHAIN
+constexpr uint16_t UNBOUNDED_CANDIDATES = HEATSHRINK_HASH_CHAIN_MAX_DEPTH;
+#else
+constexpr uint16_t UNBOUNDED_CANDIDATES = UINT16_MAX;
+#endif
+
+static constexpr hs_level_limits level_limits[HEATSHRINK_LEVEL_MAX_RATIO + 1] = {
+    /* HEATSHRINK_LEVEL_DEFAULT: unbounded, except for the hash chain's depth */
+    { UNBOUNDED_CANDIDATES, 0, UINT16_MAX, 0 },
+    {    2, 4,    8, 3 },      /* HEATSHRINK_LEVEL_FASTEST */
+    {    4, 3,    8, 3 },
+    {    8, 3,   16, 4 },
+    {   16, 2,   16, 4 },
+    {   32, 2,   32, 5 },
+    {   64, 1,   64, 5 },
+    {  128, 1,  128, 6 },
+    {  256, 0,  256, 6 },
+    { 1024, 0, UINT16_MAX, 0 },    /* HEATSHRINK_LEVEL_SLOWEST */
+    /* HEATSHRINK_LEVEL_MAX_RATIO */
+    { UNBOUNDED_CANDIDATES, 0, UINT16_MAX, 0 },
+};
+
+#if HEATSHRINK_DYNAMIC_ALLOC
+/* Optimal parse of the current block, for HEATSHRINK_LEVEL_MAX_RATIO. */
+struct hs_parse_step {
+    hs_word_t length;           /* 0: literal */
+    hs_word_t offset;
+};
+struct hs_parse {
+    uint_t end;                 /* steps are planned for match_scan_index < end */
+    uint_t hashed;              /* positions below this are in the hash chain */
+    struct hs_parse_step *step; /* by match_scan_index */
+    uint32_t *cost;             /* bits needed from match_scan_index to end of block */
+};
+
+/* Range coder and models of the heatshrink+ format. */
+struct hs_plus_encoder {
+    heatshrink::plus::output_queue queue;   /* coded, but not polled yet */
+    heatshrink::plus::range_encoder<heatshrink::plus::output_queue> rc;
+    heatshrink::plus::model model;
+    uint8_t kinds;                          /* of the last tokens, for is_literal */
+};
+#endif
+
 static uint_t get_input_offset(heatshrink_encoder *hse);
 static uint_t get_input_buffer_size(heatshrink_encoder *hse);
+static size_t get_buffer_size(heatshrink_encoder *hse);
+static uint_t get_window_size(heatshrink_encoder *hse);
 static uint_t get_lookahead_size(heatshrink_encoder *hse);
 static void add_tag_bit(heatshrink_encoder *hse, output_info *oi, /* u8 */ uint_t tag);
 static bool can_take_byte(output_info *oi);
+static uint_t get_break_even_point(heatshrink_encoder *hse);
 static bool is_finishing(heatshrink_encoder *hse);
 static void save_backlog(heatshrink_encoder *hse);
 
+[[maybe_unused]] static uint_t get_ring_size(heatshrink_encoder *hse);
+/* Ring index of buffer position POS (POS itself w/o HEATSHRINK_CIRCULAR_WINDOW). */
+static uint_t ring_index(heatshrink_encoder *hse, uint_t pos);
+#if HEATSHRINK_USE_INDEX || HEATSHRINK_USE_HASH_CHAIN
+/* Buffer position of ring index I (I itself w/o HEATSHRINK_CIRCULAR_WINDOW). */
+static uint_t ring_pos(heatshrink_encoder *hse, uint_t i);
+#endif
+/* Buffer position POS, followed by at least the lookahead size of contiguous
+ * bytes and preceded by HEATSHRINK_ENCODER_RING_GUARD. */
+static uint8_t* ring_ptr(heatshrink_encoder *hse, uint_t pos);
+static void ring_write(heatshrink_encoder *hse, uint_t pos, const uint8_t *src, uint_t size);
+#if HEATSHRINK_USE_HASH_CHAIN
+static void hash_chain_insert(heatshrink_encoder *hse, uint_t from, uint_t to);
+#endif
+
 /* Push COUNT (max 8) bits to the output buffer, which has room. */
 static void push_bits(heatshrink_encoder *hse, /* u8 */ uint_t count, /* u8 */ uint_t bits,
     output_info *oi);
 static /* u8 */ uint_t push_outgoing_bits(heatshrink_encoder *hse, output_info *oi);
+/* Push the COUNT (max. 1+15+14) bits of a whole token to the output buffer,
+ * which has TOKEN_ROOM bytes free. */
+static void push_token(heatshrink_encoder *hse, uint_t count, token_t bits,
+    output_info *oi);
 static void push_literal_byte(heatshrink_encoder *hse, output_info *oi);
 
+/* Sizes of the input, the ring (window plus input) and the whole buffer of
+ * an encoder with these parameters. */
+static constexpr size_t input_size_for(uint_t window_sz2, uint_t lookahead_sz2, uint_t level) {
+#if HEATSHRINK_COMPACT_ENCODER
+    /* The optimal parse is planned an input buffer at a time, and would lose
+     * to the greedy one in blocks of two lookaheads. Its plan takes more RAM
+     * than the smaller ring saves anyway. */
+    if (level == HEATSHRINK_LEVEL_MAX_RATIO) {
+        return (size_t)1 << window_sz2;
+    }
+#endif
+    return HEATSHRINK_ENCODER_INPUT_SIZE(window_sz2, lookahead_sz2);
+    (void)lookahead_sz2;
+    (void)level;
+}
+
+static constexpr size_t ring_size_for(uint_t window_sz2, uint_t lookahead_sz2, uint_t level) {
+    return ((size_t)1 << window_sz2) + input_size_for(window_sz2, lookahead_sz2, level);
+}
+
+static constexpr size_t buffer_size_for(uint_t window_sz2, uint_t lookahead_sz2, uint_t level) {
+#if HEATSHRINK_CIRCULAR_WINDOW
+    return HEATSHRINK_ENCODER_RING_GUARD + ring_size_for(window_sz2, lookahead_sz2, level) +
+        ((size_t)1 << lookahead_sz2);
+#else
+    return ring_size_for(window_sz2, lookahead_sz2, level);
+#endif
+}
+
+#if !HEATSHRINK_DYNAMIC_ALLOC
+static_assert(buffer_size_for(HEATSHRINK_STATIC_WINDOW_BITS, HEATSHRINK_STATIC_LOOKAHEAD_BITS,
+    HEATSHRINK_STATIC_LEVEL) == HEATSHRINK_ENCODER_BUFFER_SIZE(HEATSHRINK_STATIC_WINDOW_BITS,
+        HEATSHRINK_STATIC_LOOKAHEAD_BITS));
+#endif
+
 #if HEATSHRINK_DYNAMIC_ALLOC
-heatshrink_encoder *heatshrink_encoder_alloc(const uint8_t window_sz2,
-        const uint8_t lookahead_sz2) {
+static heatshrink_encoder *encoder_alloc(const uint8_t window_sz2,
+        const uint8_t lookahead_sz2, const uint8_t level) {
     if ((window_sz2 < HEATSHRINK_MIN_WINDOW_BITS) ||
         (window_sz2 > HEATSHRINK_MAX_WINDOW_BITS) ||
         (lookahead_sz2 < HEATSHRINK_MIN_LOOKAHEAD_BITS) ||
@@ -108,49 +236,116 @@ heatshrink_encoder *heatshrink_encoder_alloc(const uint8_t window_sz2,
     /* Note: 2 * the window size is used because the buffer needs to fit
      * (1 << window_sz2) bytes for the current input, and an additional
      * (1 << window_sz2) bytes for the previous buffer of input, which
-     * will be scanned for useful backreferences. */
-    size_t buf_sz = (2 << window_sz2);
-
-    // TODO buf_sz = (1<<window_sz2) + (1<<lookahead_sz2);
+     * will be scanned for useful backreferences.
+     * With HEATSHRINK_COMPACT_ENCODER, the input is refilled in
+     * lookahead-sized steps instead, so only 2 * (1 << lookahead_sz2)
+     * bytes are needed for it. */
+    [[maybe_unused]] const size_t ring_sz = ring_size_for(window_sz2, lookahead_sz2, level);
+    const size_t buf_sz = buffer_size_for(window_sz2, lookahead_sz2, level);
 
     heatshrink_encoder *hse = (heatshrink_encoder*) HEATSHRINK_MALLOC(sizeof(*hse) + buf_sz);
     if (hse == NULL) { return NULL; }
     hse->window_sz2 = window_sz2;
     hse->lookahead_sz2 = lookahead_sz2;
-    heatshrink_encoder_reset(hse);
+    hse->level = level;
+    hse->parse = NULL;
+    hse->plus = NULL;
 
 #if HEATSHRINK_USE_INDEX
-    size_t index_sz = buf_sz*sizeof(uint16_t);
+    size_t index_sz = ring_sz*sizeof(hs_index_t);
     hse->search_index = (hs_index*) HEATSHRINK_MALLOC(index_sz + sizeof(struct hs_index));
     if (hse->search_index == NULL) {
         HEATSHRINK_FREE(hse, sizeof(*hse) + buf_sz);
         return NULL;
     }
-    hse->search_index->size = index_sz;
 #endif
 
+#if HEATSHRINK_USE_HASH_CHAIN
+    size_t chain_sz = sizeof(struct hs_hash_chain) + ring_sz*sizeof(hs_index_t);
+    hse->hash_chain = (hs_hash_chain*) HEATSHRINK_MALLOC(chain_sz);
+    if (hse->hash_chain == NULL) {
+        HEATSHRINK_FREE(hse, sizeof(*hse) + buf_sz);
+        return NULL;
+    }
+#endif
+
+    heatshrink_encoder_reset(hse);
+
     LOG("-- allocated encoder with buffer size of %zu (%u byte input size)\n",
         buf_sz, get_input_buffer_size(hse));
     return hse;
 }
 
+heatshrink_encoder *heatshrink_encoder_alloc(const uint8_t window_sz2,
+        const uint8_t lookahead_sz2) {
+    return encoder_alloc(window_sz2, lookahead_sz2, HEATSHRINK_LEVEL_DEFAULT);
+}
+
+heatshrink_encoder *heatshrink_encoder_alloc_ex(const uint8_t window_sz2,
+        const uint8_t lookahead_sz2, const uint8_t level) {
+    if (level > HEATSHRINK_LEVEL_MAX_RATIO) {
+        return NULL;
+    }
+    heatshrink_encoder *hse = encoder_alloc(window_sz2, lookahead_sz2, level);
+    if (hse == NULL) { return NULL; }
+
+    if (level == HEATSHRINK_LEVEL_MAX_RATIO) {
+        const size_t input_buf_sz = get_input_buffer_size(hse);
+        struct hs_parse *parse = (hs_parse*) HEATSHRINK_MALLOC(sizeof(struct hs_parse) +
+            input_buf_sz*sizeof(struct hs_parse_step) + (input_buf_sz+1)*sizeof(uint32_t));
+        if (parse == NULL) {
+            heatshrink_encoder_free(hse);
+            return NULL;
+        }
+        parse->end = 0;
+        parse->hashed = 0;
+        parse->step = (struct hs_parse_step*)&parse[1];
+        parse->cost = (uint32_t*)&parse->step[input_buf_sz];
+        hse->parse = parse;
+    }
+    return hse;
+}
+
+heatshrink_encoder *heatshrink_encoder_alloc_plus(const uint8_t window_sz2,
+        const uint8_t lookahead_sz2, const uint8_t level) {
+    heatshrink_encoder *hse = heatshrink_encoder_alloc_ex(window_sz2, lookahead_sz2, level);
+    if (hse == NULL) { return NULL; }
+    hse->plus = (hs_plus_encoder*) HEATSHRINK_MALLOC(sizeof(struct hs_plus_encoder));
+    if (hse->plus == NULL) {
+        heatshrink_encoder_free(hse);
+        return NULL;
+    }
+    heatshrink_encoder_reset(hse);
+    return hse;
+}
+
 void heatshrink_encoder_free(heatshrink_encoder *hse) {
-#if HEATSHRINK_USE_INDEX
-    {
-    // const size_t index_sz = sizeof(struct hs_index) + hse->search_index->size;
-    HEATSHRINK_FREE(hse->search_index, /*index_sz*/ (sizeof(struct hs_index) + hse->search_index->size));
+    if (hse == NULL) { return; }
+    if (hse->plus != NULL) {
+        HEATSHRINK_FREE(hse->plus, sizeof(struct hs_plus_encoder));
     }
-#endif
-    {
-    // const size_t buf_sz = (2 << HEATSHRINK_ENCODER_WINDOW_BITS(hse));
-    HEATSHRINK_FREE(hse, (sizeof(heatshrink_encoder) + /* buf_sz */ (2 << HEATSHRINK_ENCODER_WINDOW_BITS(hse))));
+    if (hse->parse != NULL) {
+        [[maybe_unused]] const size_t input_buf_sz = get_input_buffer_size(hse);
+        HEATSHRINK_FREE(hse->parse, (sizeof(struct hs_parse) +
+            input_buf_sz*sizeof(struct hs_parse_step) + (input_buf_sz+1)*sizeof(uint32_t)));
     }
+#if HEATSHRINK_USE_INDEX
+    HEATSHRINK_FREE(hse->search_index, (sizeof(struct hs_index) +
+        get_ring_size(hse)*sizeof(hs_index_t)));
+#endif
+#if HEATSHRINK_USE_HASH_CHAIN
+    HEATSHRINK_FREE(hse->hash_chain, (sizeof(struct hs_hash_chain) +
+        get_ring_size(hse)*sizeof(hs_index_t)));
+#endif
+    HEATSHRINK_FREE(hse, (sizeof(heatshrink_encoder) + get_buffer_size(hse)));
 }
 #endif
 
 void heatshrink_encoder_reset(heatshrink_encoder *hse) {
-    size_t buf_sz = (2 << HEATSHRINK_ENCODER_WINDOW_BITS(hse));
-    memset(hse->buffer, 0, buf_sz);
+    memset(hse->buffer, 0, get_buffer_size(hse));
+#if HEATSHRINK_CIRCULAR_WINDOW
+    hse->ring_base = 0;
+#endif
     hse->input_size = 0;
     hse->state = HSES_NOT_FULL;
     hse->match_scan_index = 0;
@@ -158,15 +353,70 @@ void heatshrink_encoder_reset(heatshrink_encoder *hse) {
     hse->bit_index = BIT_INDEX_INIT;
     hse->current_byte = 0x00;
     hse->match_length = 0;
+#if HEATSHRINK_LAZY_MATCHING
+    hse->lazy_length = 0;
+#endif
+    hse->cached_length = 0;
+    hse->misses = 0;
+    hse->skip_count = 0;
+#if HEATSHRINK_DYNAMIC_ALLOC
+    if (hse->parse != NULL) {
+        hse->parse->end = 0;
+        hse->parse->hashed = 0;
+    }
+    if (hse->plus != NULL) {
+        hse->plus->queue.reset();
+        hse->plus->rc.reset();
+        hse->plus->model.reset();
+        hse->plus->kinds = 0;
+    }
+#endif
 
     hse->outgoing_bits = 0x0000;
     hse->outgoing_bits_count = 0;
 
+#if HEATSHRINK_USE_INDEX
+    struct hs_index *hsi = HEATSHRINK_ENCODER_INDEX(hse);
+    hsi->indexed = 0;
+    memset(hsi->last, 0xFF, sizeof(hsi->last));
+#endif
+#if HEATSHRINK_USE_HASH_CHAIN
+    struct hs_hash_chain *hc = HEATSHRINK_ENCODER_HASH_CHAIN(hse);
+    memset(hc->head, 0xFF, sizeof(hc->head));
+#endif
+
     #ifdef LOOP_DETECT
     hse->loop_detect = (uint32_t)-1;
     #endif
 }
 
+HSE_dictionary_res heatshrink_encoder_set_dictionary(heatshrink_encoder *hse,
+        const uint8_t *dict, size_t dict_size) {
+    if ((hse == NULL) || (dict == NULL && dict_size != 0)) [[unlikely]] {
+        return HSER_DICTIONARY_ERROR_NULL;
+    }
+    if (is_finishing(hse) || hse->state != HSES_NOT_FULL || hse->input_size != 0) [[unlikely]] {
+        return HSER_DICTIONARY_ERROR_MISUSE;
+    }
+
+    /* The dictionary ends where the input starts, like the previous block
+     * would; the (zeroed) window before it stays as it is. */
+    const uint_t window_sz = get_window_size(hse);
+    const uint_t n = dict_size < window_sz ? dict_size : window_sz;
+    const uint_t input_offset = get_input_offset(hse);
+    ring_write(hse, input_offset - n, dict + (dict_size - n), n);
+    LOG("-- set dictionary of %u bytes (of %zu)\n", n, dict_size);
+
+#if HEATSHRINK_USE_HASH_CHAIN
+    /* Positions are only hashed as the search passes them, so the
+     * dictionary is hashed here (except its last bytes, whose hash would
+     * reach into the input). */
+    hash_chain_insert(hse, input_offset - n, input_offset);
+#endif
+    /* (The index covers the window from position 0 on anyway.) */
+    return HSER_DICTIONARY_OK;
+}
+
 HSE_sink_res heatshrink_encoder_sink(heatshrink_encoder *hse,
         const uint8_t *in_buf, size_t size, size_t *input_size) {
     if ((hse == NULL) || (in_buf == NULL) || (input_size == NULL)) [[unlikely]] {
@@ -177,14 +427,22 @@ HSE_sink_res heatshrink_encoder_sink(heatshrink_encoder *hse,
     if (is_finishing(hse)) [[unlikely]] { return HSER_SINK_ERROR_MISUSE; }
 
     /* Sinking more content before processing is done */
-    if (hse->state != HSES_NOT_FULL) [[unlikely]] { return HSER_SINK_ERROR_MISUSE; }
+    if (hse->state != HSES_NOT_FULL) [[unlikely]] {
+#if HEATSHRINK_COMPACT_ENCODER
+        /* The small input buffer fills up often; sink nothing until polled. */
+        *input_size = 0;
+        return HSER_SINK_OK;
+#else
+        return HSER_SINK_ERROR_MISUSE;
+#endif
+    }
 
     uint_t write_offset = get_input_offset(hse) + hse->input_size;
     uint_t ibs = get_input_buffer_size(hse);
     uint_t rem = ibs - hse->input_size;
     uint_t cp_sz = rem < size ? rem : size;
 
-    memcpy(&hse->buffer[write_offset], in_buf, cp_sz);
+    ring_write(hse, write_offset, in_buf, cp_sz);
     *input_size = cp_sz;
     hse->input_size += cp_sz;
 
@@ -206,10 +464,16 @@ HSE_sink_res heatshrink_encoder_sink(heatshrink_encoder *hse,
 static uint_t find_longest_match(heatshrink_encoder *hse, uint_t start,
     uint_t end, const uint_t maxlen, uint_t& match_length);
 static void do_indexing(heatshrink_encoder *hse);
+#if HEATSHRINK_DYNAMIC_ALLOC
+static HSE_state step_planned(heatshrink_encoder *hse, uint_t limit);
+#endif
 
 static HSE_state st_step_search(heatshrink_encoder *hse);
 static HSE_state st_yield_tag_bit(heatshrink_encoder *hse,
     output_info *oi);
+/* Take the token st_step_search found (as st_yield_tag_bit would emit it)
+ * into TOKEN, and move on past it. */
+static void take_token(heatshrink_encoder *hse, heatshrink_token *token);
 static HSE_state st_yield_literal(heatshrink_encoder *hse,
     output_info *oi);
 static HSE_state st_yield_br_index(heatshrink_encoder *hse,
@@ -219,6 +483,12 @@ static HSE_state st_yield_br_length(heatshrink_encoder *hse,
 static HSE_state st_save_backlog(heatshrink_encoder *hse);
 static HSE_state st_flush_bit_buffer(heatshrink_encoder *hse,
     output_info *oi);
+#if HEATSHRINK_DYNAMIC_ALLOC
+static HSE_state st_plus_yield_token(heatshrink_encoder *hse,
+    output_info *oi);
+static HSE_state st_plus_flush(heatshrink_encoder *hse,
+    output_info *oi);
+#endif
 
 HSE_poll_res heatshrink_encoder_poll(heatshrink_encoder *hse,
         uint8_t *out_buf, size_t out_buf_size, size_t *output_size) {
@@ -252,6 +522,12 @@ HSE_poll_res heatshrink_encoder_poll(heatshrink_encoder *hse,
             hse->state = st_step_search(hse);
             break;
         case HSES_YIELD_TAG_BIT:
+#if HEATSHRINK_DYNAMIC_ALLOC
+            if (hse->plus != NULL) {
+                hse->state = st_plus_yield_token(hse, &oi);
+                break;
+            }
+#endif
             hse->state = st_yield_tag_bit(hse, &oi);
             break;
         case HSES_YIELD_LITERAL:
@@ -267,6 +543,12 @@ HSE_poll_res heatshrink_encoder_poll(heatshrink_encoder *hse,
             hse->state = st_save_backlog(hse);
             break;
         case HSES_FLUSH_BITS:
+#if HEATSHRINK_DYNAMIC_ALLOC
+            if (hse->plus != NULL) {
+                hse->state = st_plus_flush(hse, &oi);
+                break;
+            }
+#endif
             hse->state = st_flush_bit_buffer(hse, &oi);
             // [[fallthrough]];
             break;
@@ -285,6 +567,52 @@ HSE_poll_res heatshrink_encoder_poll(heatshrink_encoder *hse,
     }
 }
 
+HSE_poll_res heatshrink_encoder_poll_tokens(heatshrink_encoder *hse,
+        heatshrink_token *tokens, size_t max_tokens, size_t *token_count) {
+    if ((hse == NULL) || (tokens == NULL) || (token_count == NULL)) [[unlikely]] {
+        return HSER_POLL_ERROR_NULL;
+    }
+    if (max_tokens == 0) [[unlikely]] {
+        LOG("-- MISUSE: token buffer size is 0\n");
+        return HSER_POLL_ERROR_MISUSE;
+    }
+    *token_count = 0;
+
+    /* The same states as heatshrink_encoder_poll, except that a token found
+     * is taken whole in place of its tag bit, and nothing is packed. */
+    while (1) {
+        switch (hse->state) {
+        case HSES_NOT_FULL:
+            return HSER_POLL_EMPTY;
+        case HSES_FILLED:
+            do_indexing(hse);
+            hse->state = HSES_SEARCH;
+            break;
+        case HSES_SEARCH:
+            hse->state = st_step_search(hse);
+            break;
+        case HSES_YIELD_TAG_BIT:
+            if (*token_count == max_tokens) { return HSER_POLL_MORE; }
+            take_token(hse, &tokens[(*token_count)++]);
+            hse->state = HSES_SEARCH;
+            break;
+        case HSES_SAVE_BACKLOG:
+            hse->state = st_save_backlog(hse);
+            break;
+        case HSES_FLUSH_BITS:
+            hse->state = HSES_DONE;
+            break;
+        case HSES_DONE:
+            return HSER_POLL_EMPTY;
+        default:
+            /* Mid-way through packing a token for heatshrink_encoder_poll. */
+            [[unlikely]]
+            LOG("-- bad state %s\n", state_names[hse->state]);
+            return HSER_POLL_ERROR_MISUSE;
+        }
+    }
+}
+
 HSE_finish_res heatshrink_encoder_finish(heatshrink_encoder *hse) {
     if (hse == NULL) [[unlikely]] { return HSER_FINISH_ERROR_NULL; }
     LOG("-- setting is_finishing flag\n");
@@ -297,14 +625,17 @@ static HSE_state st_step_search(heatshrink_encoder *hse) {
     uint_t start;
     uint_t end;
     uint_t max_possible;
+#if HEATSHRINK_LAZY_MATCHING
+    bool can_look_ahead; /* is the next byte still searchable in this block? */
+#endif
     {
         const uint_t lookahead_sz = get_lookahead_size(hse);
         const uint_t msi = hse->match_scan_index;
         #if HEATSHRINK_DEBUGGING_LOGS
         {
-        const uint_t window_length = get_input_buffer_size(hse);
+        const uint_t input_buf_sz = get_input_buffer_size(hse);
         LOG("## step_search, scan @ +%d (%d/%d), input size %d\n",
-            msi, hse->input_size + msi, 2*window_length, hse->input_size);
+            msi, hse->input_size + msi, input_buf_sz, hse->input_size);
         }
         #endif
         {
@@ -319,6 +650,17 @@ static HSE_state st_step_search(heatshrink_encoder *hse) {
                     return HSES_SAVE_BACKLOG;
                 }
             }
+            #if HEATSHRINK_DYNAMIC_ALLOC
+            if (hse->parse != NULL) {
+                return step_planned(hse,
+                    fin ? hse->input_size : hse->input_size - lookahead_sz + 1);
+            }
+            #endif
+            #if HEATSHRINK_LAZY_MATCHING
+            can_look_ahead = fin ?
+                (msi + 1 < hse->input_size) :
+                (msi + 1 <= (uint_t)(hse->input_size - lookahead_sz));
+            #endif
             // if (msi > hse->input_size - (fin ? 1 : lookahead_sz)) {
             //     /* Current search buffer is exhausted, copy it into the
             //     * backlog and await more input. */
@@ -328,21 +670,75 @@ static HSE_state st_step_search(heatshrink_encoder *hse) {
         }
 
         end = get_input_offset(hse) + msi;
-        start = end - get_input_buffer_size(hse) /* window_length */;
+        start = end - get_window_size(hse);
         max_possible = std::min((uint_t)(hse->input_size-msi), lookahead_sz);
     }
 
     uint_t match_length = 0;
-    const uint_t match_pos = find_longest_match(hse,
-        start, end, max_possible, match_length);
+    uint_t match_pos;
+#if HEATSHRINK_LAZY_MATCHING
+    if (hse->lazy_length != 0) {
+        /* Found when the previous step looked ahead. */
+        match_pos = hse->lazy_pos;
+        match_length = hse->lazy_length;
+        hse->lazy_length = 0;
+    } else
+#endif
+    if (hse->skip_count != 0) {
+        /* Accelerating through input which doesn't compress. */
+        hse->skip_count--;
+        match_pos = MATCH_NOT_FOUND;
+    } else {
+        match_pos = find_longest_match(hse,
+            start, end, max_possible, match_length);
+        if (match_pos == MATCH_NOT_FOUND) {
+            /* The more searches fail in a row, the more positions are
+             * emitted as literals without one, like LZ4's acceleration. */
+            const uint_t skip_shift = level_limits[HEATSHRINK_ENCODER_LEVEL(hse)].skip_shift;
+            if (skip_shift != 0) {
+                if ((uint_t)(hse->misses >> skip_shift) < MAX_SKIP) { hse->misses++; }
+                hse->skip_count = hse->misses >> skip_shift;
+            }
+        } else {
+            hse->misses = 0;
+        }
+    }
 
     if (match_pos == MATCH_NOT_FOUND) {
         LOG("ss Match not found\n");
+        #if HEATSHRINK_USE_HASH_CHAIN
+        hash_chain_insert(hse, end, end + 1);
+        #endif
         hse->match_scan_index++;
         hse->match_length = 0;
         return HSES_YIELD_TAG_BIT;
     } else {
         LOG("ss Found match of %d bytes at %d\n", match_length, match_pos);
+        #if HEATSHRINK_USE_HASH_CHAIN
+        hash_chain_insert(hse, end, end + 1);
+        #endif
+        #if HEATSHRINK_LAZY_MATCHING
+        if (match_length < HEATSHRINK_LAZY_GOOD_LENGTH && can_look_ahead) {
+            /* If the next byte starts a longer match, emit a literal now and
+             * keep that match for the next step. */
+            const uint_t next_possible = std::min(max_possible, (uint_t)(hse->input_size - hse->match_scan_index - 1));
+            uint_t next_length = 0;
+            const uint_t next_pos = find_longest_match(hse,
+                start + 1, end + 1, next_possible, next_length);
+            if (next_pos != MATCH_NOT_FOUND &&
+                next_length >= match_length + HEATSHRINK_LAZY_MIN_GAIN) {
+                LOG("ss Deferring to match of %d bytes at next byte\n", next_length);
+                hse->lazy_pos = next_pos;
+                hse->lazy_length = next_length;
+                hse->match_scan_index++;
+                hse->match_length = 0;
+                return HSES_YIELD_TAG_BIT;
+            }
+        }
+        #endif
+        #if HEATSHRINK_USE_HASH_CHAIN
+        hash_chain_insert(hse, end + 1, end + match_length);
+        #endif
         hse->match_pos = match_pos;
         hse->match_length = match_length;
         ASSERT(match_pos <= 1 << HEATSHRINK_ENCODER_WINDOW_BITS(hse) /*window_length*/);
@@ -351,8 +747,109 @@ static HSE_state st_step_search(heatshrink_encoder *hse) {
     }
 }
 
+#if HEATSHRINK_DYNAMIC_ALLOC
+/* Plan the optimal parse of the block from match_scan_index FROM up to
+ * (excluding) LIMIT, i.e. the sequence of literals and backrefs that
+ * takes the fewest bits to cover it. First, find the longest match at every
+ * position; a backref can then cover any length from break-even up to that
+ * at the same offset, at a cost independent of length and offset. Going
+ * backwards, the cost of each position is the cheapest choice plus the cost
+ * of the position after it.
+ * The costs are calculated up to the end of the input rather than to LIMIT,
+ * so that a backref reaching beyond LIMIT gets credit for the input it
+ * covers there; that part is planned again with the next block. */
+static void plan_parse(heatshrink_encoder *hse, const uint_t from, const uint_t limit) {
+    struct hs_parse *parse = hse->parse;
+    struct hs_parse_step *step = parse->step;
+    uint32_t *cost = parse->cost;
+    const uint_t horizon = hse->input_size;
+    const uint_t input_offset = get_input_offset(hse);
+    const uint_t window_length = get_window_size(hse);
+    const uint_t lookahead_sz = get_lookahead_size(hse);
+    const uint_t break_even_point = get_break_even_point(hse);
+    const uint32_t literal_cost = 1 + 8;
+    const uint32_t backref_cost = 1 + HEATSHRINK_ENCODER_WINDOW_BITS(hse) +
+        HEATSHRINK_ENCODER_LOOKAHEAD_BITS(hse);
+
+    for (uint_t msi = from; msi < horizon; msi++) {
+        const uint_t end = input_offset + msi;
+        const uint_t max_possible = std::min((uint_t)(horizon - msi), lookahead_sz);
+        uint_t match_length = 0;
+        const uint_t match_pos = find_longest_match(hse,
+            end - window_length, end, max_possible, match_length);
+        #if HEATSHRINK_USE_HASH_CHAIN
+        if (msi >= parse->hashed) {
+            hash_chain_insert(hse, end, end + 1);
+        }
+        #endif
+        if (match_pos == MATCH_NOT_FOUND) {
+            step[msi].length = 0;
+        } else {
+            step[msi].length = match_length;
+            step[msi].offset = match_pos;
+        }
+    }
+    if (horizon > parse->hashed) { parse->hashed = horizon; }
+
+    cost[horizon] = 0;
+    for (uint_t msi = horizon; msi-- > from; ) {
+        uint32_t best = literal_cost + cost[msi + 1];
+        uint_t best_length = 0;
+        /* Longer backrefs win ties, and backrefs win ties with literals. */
+        for (uint_t len = break_even_point + 1; len <= step[msi].length; len++) {
+            const uint32_t c = backref_cost + cost[msi + len];
+            if (c <= best) {
+                best = c;
+                best_length = len;
+            }
+        }
+        cost[msi] = best;
+        step[msi].length = best_length;
+    }
+    parse->end = limit;
+}
+
+/* HEATSHRINK_LEVEL_MAX_RATIO: Take the next step of the planned parse,
+ * planning the block up to LIMIT first if needed. */
+static HSE_state step_planned(heatshrink_encoder *hse, const uint_t limit) {
+    const uint_t msi = hse->match_scan_index;
+    if (msi >= hse->parse->end) {
+        plan_parse(hse, msi, limit);
+    }
+    const struct hs_parse_step *step = &hse->parse->step[msi];
+    if (step->length == 0) {
+        LOG("ss Planned literal\n");
+        hse->match_scan_index++;
+        hse->match_length = 0;
+    } else {
+        LOG("ss Planned match of %d bytes at %d\n", step->length, step->offset);
+        hse->match_pos = step->offset;
+        hse->match_length = step->length;
+    }
+    return HSES_YIELD_TAG_BIT;
+}
+#endif
+
 static HSE_state st_yield_tag_bit(heatshrink_encoder *hse,
         output_info *oi) {
+    if constexpr (BIT_INDEX_INIT == 0) {
+        if (oi->buf_size - *oi->output_size >= TOKEN_ROOM) [[likely]] {
+            /* Room for the whole token: skip the literal/backref states. */
+            if (hse->match_length == 0) {
+                const uint_t c = *ring_ptr(hse, get_input_offset(hse) + hse->match_scan_index - 1);
+                LOG("-- yielding literal token 0x%02x\n", c);
+                push_token(hse, 1 + 8, (HEATSHRINK_LITERAL_MARKER << 8) | c, oi);
+            } else {
+                LOG("-- yielding backref token %u, %u\n", hse->match_pos, hse->match_length);
+                const uint_t lookahead_bits = HEATSHRINK_ENCODER_LOOKAHEAD_BITS(hse);
+                push_token(hse, 1 + HEATSHRINK_ENCODER_WINDOW_BITS(hse) + lookahead_bits,
+                    ((token_t)(hse->match_pos - 1) << lookahead_bits) | (hse->match_length - 1), oi);
+                hse->match_scan_index += hse->match_length;
+                hse->match_length = 0;
+            }
+            return HSES_SEARCH;
+        }
+    }
     if (can_take_byte(oi)) {
         if (hse->match_length == 0) {
             add_tag_bit(hse, oi, HEATSHRINK_LITERAL_MARKER);
@@ -368,6 +865,18 @@ static HSE_state st_yield_tag_bit(heatshrink_encoder *hse,
     }
 }
 
+static void take_token(heatshrink_encoder *hse, heatshrink_token *token) {
+    if (hse->match_length == 0) {
+        token->offset = 0;
+        token->length = *ring_ptr(hse, get_input_offset(hse) + hse->match_scan_index - 1);
+    } else {
+        token->offset = hse->match_pos;
+        token->length = hse->match_length;
+        hse->match_scan_index += hse->match_length;
+        hse->match_length = 0;
+    }
+}
+
 static HSE_state st_yield_literal(heatshrink_encoder *hse,
         output_info *oi) {
     if (can_take_byte(oi)) {
@@ -431,6 +940,64 @@ static HSE_state st_flush_bit_buffer(heatshrink_encoder *hse,
     }
 }
 
+#if HEATSHRINK_DYNAMIC_ALLOC
+/* Move coded heatshrink+ output to the output buffer. Returns true once
+ * all of it is polled. */
+static bool plus_drain(heatshrink_encoder *hse, output_info *oi) {
+    *oi->output_size += hse->plus->queue.drain(oi->buf + *oi->output_size,
+        oi->buf_size - *oi->output_size);
+    return hse->plus->queue.empty();
+}
+
+static HSE_state st_plus_yield_token(heatshrink_encoder *hse,
+        output_info *oi) {
+    if (!plus_drain(hse, oi)) {
+        return HSES_YIELD_TAG_BIT; /* output is full, continue */
+    }
+    hs_plus_encoder * const p = hse->plus;
+    heatshrink::plus::model& m = p->model;
+    if (hse->match_length == 0) {
+        const uint_t prev = *ring_ptr(hse, get_input_offset(hse) + hse->match_scan_index - 2);
+        heatshrink_token token;
+        take_token(hse, &token);
+        LOG("-- coding literal 0x%02x\n", token.length);
+        p->rc.bit(m.is_literal[p->kinds], 1, p->queue);
+        p->rc.tree(m.literal_tree(prev), token.length, 8, p->queue);
+        p->kinds = heatshrink::plus::next_kinds(p->kinds, true);
+    } else {
+        heatshrink_token token;
+        take_token(hse, &token);
+        LOG("-- coding backref %u, %u\n", token.offset, token.length);
+        p->rc.bit(m.is_literal[p->kinds], 0, p->queue);
+        p->rc.number(m.length_slot, m.length, token.length + 1, p->queue);
+        p->rc.number(m.offset_slot_tree(token.length), m.offset, token.offset, p->queue);
+        p->kinds = heatshrink::plus::next_kinds(p->kinds, false);
+    }
+    plus_drain(hse, oi);
+    return HSES_SEARCH;
+}
+
+static HSE_state st_plus_flush(heatshrink_encoder *hse,
+        output_info *oi) {
+    if (!plus_drain(hse, oi)) {
+        return HSES_FLUSH_BITS;
+    }
+    if ((hse->flags & FLAG_PLUS_FLUSHED) == 0) {
+        hs_plus_encoder * const p = hse->plus;
+        LOG("-- coding end marker\n");
+        p->rc.bit(p->model.is_literal[p->kinds], 0, p->queue);
+        p->rc.number(p->model.length_slot, p->model.length, heatshrink::plus::END_MARKER, p->queue);
+        p->rc.flush(p->queue);
+        hse->flags |= FLAG_PLUS_FLUSHED;
+        if (!plus_drain(hse, oi)) {
+            return HSES_FLUSH_BITS;
+        }
+    }
+    LOG("-- done!\n");
+    return HSES_DONE;
+}
+#endif
+
 static void add_tag_bit(heatshrink_encoder *hse, output_info *oi, /* u8 */ uint_t tag) {
     LOG("-- adding tag bit: %d\n", tag);
     push_bits(hse, 1, tag, oi);
@@ -443,6 +1010,18 @@ static uint_t get_input_offset(heatshrink_encoder *hse) {
 
 
 static uint_t get_input_buffer_size(heatshrink_encoder *hse) {
+    return input_size_for(HEATSHRINK_ENCODER_WINDOW_BITS(hse),
+        HEATSHRINK_ENCODER_LOOKAHEAD_BITS(hse), HEATSHRINK_ENCODER_LEVEL(hse));
+    (void)hse;
+}
+
+static size_t get_buffer_size(heatshrink_encoder *hse) {
+    return buffer_size_for(HEATSHRINK_ENCODER_WINDOW_BITS(hse),
+        HEATSHRINK_ENCODER_LOOKAHEAD_BITS(hse), HEATSHRINK_ENCODER_LEVEL(hse));
+    (void)hse;
+}
+
+static uint_t get_window_size(heatshrink_encoder *hse) {
     return (1 << HEATSHRINK_ENCODER_WINDOW_BITS(hse));
     (void)hse;
 }
@@ -452,41 +1031,168 @@ static uint_t get_lookahead_size(heatshrink_encoder *hse) {
     (void)hse;
 }
 
+static uint_t get_ring_size(heatshrink_encoder *hse) {
+    return ring_size_for(HEATSHRINK_ENCODER_WINDOW_BITS(hse),
+        HEATSHRINK_ENCODER_LOOKAHEAD_BITS(hse), HEATSHRINK_ENCODER_LEVEL(hse));
+    (void)hse;
+}
+
+static uint_t ring_index(heatshrink_encoder *hse, const uint_t pos) {
+#if HEATSHRINK_CIRCULAR_WINDOW
+    const uint_t i = hse->ring_base + pos;
+    const uint_t ring_sz = get_ring_size(hse);
+    return i >= ring_sz ? i - ring_sz : i;
+#else
+    return pos;
+    (void)hse;
+#endif
+}
+
+#if HEATSHRINK_USE_INDEX || HEATSHRINK_USE_HASH_CHAIN
+static uint_t ring_pos(heatshrink_encoder *hse, const uint_t i) {
+#if HEATSHRINK_CIRCULAR_WINDOW
+    return i >= hse->ring_base ? i - hse->ring_base : i + get_ring_size(hse) - hse->ring_base;
+#else
+    return i;
+    (void)hse;
+#endif
+}
+#endif
+
+static uint8_t* ring_ptr(heatshrink_encoder *hse, const uint_t pos) {
+    return &hse->buffer[HEATSHRINK_ENCODER_RING_GUARD + ring_index(hse, pos)];
+}
+
+/* Copy SIZE bytes from SRC to buffer positions [POS, POS+SIZE), and to the
+ * guard bytes which mirror the ring's first and last bytes. */
+static void ring_write(heatshrink_encoder *hse, const uint_t pos, const uint8_t *src, uint_t size) {
+    if (size == 0) { return; }  /* SRC may be NULL then */
+#if HEATSHRINK_CIRCULAR_WINDOW
+    uint8_t* const ring = &hse->buffer[HEATSHRINK_ENCODER_RING_GUARD];
+    const uint_t ring_sz = get_ring_size(hse);
+    const uint_t lookahead_sz = get_lookahead_size(hse);
+    uint_t i = ring_index(hse, pos);
+    while (size != 0) {
+        const uint_t n = std::min(size, ring_sz - i);
+        memcpy(&ring[i], src, n);
+        if (i < lookahead_sz) {
+            memcpy(&ring[ring_sz + i], src, std::min(n, lookahead_sz - i));
+        }
+        if (i + n > ring_sz - HEATSHRINK_ENCODER_RING_GUARD) {
+            memcpy(&hse->buffer[0], &ring[ring_sz - HEATSHRINK_ENCODER_RING_GUARD],
+                HEATSHRINK_ENCODER_RING_GUARD);
+        }
+        src += n;
+        size -= n;
+        i = 0;
+    }
+#else
+    memcpy(&hse->buffer[pos], src, size);
+#endif
+}
+
+/* Matches must be longer than this to be shorter than the literals. */
+static uint_t get_break_even_point(heatshrink_encoder *hse) {
+    return (1 + HEATSHRINK_ENCODER_WINDOW_BITS(hse) +
+        HEATSHRINK_ENCODER_LOOKAHEAD_BITS(hse)) / 8;
+    (void)hse;
+}
+
+#if HEATSHRINK_USE_HASH_CHAIN
+/* Not a ring index, even at HEATSHRINK_MAX_WINDOW_BITS. */
+constexpr uint32_t HASH_CHAIN_EMPTY = UINT32_MAX;
+
+/* The hash covers the shortest match worth emitting, but at most 3 bytes:
+ * If 2-byte matches already beat two literals (small window and lookahead
+ * sizes), only 2 bytes are hashed so that those are found too. */
+static uint_t get_hash_len(heatshrink_encoder *hse) {
+    const uint_t break_even_point = get_break_even_point(hse);
+    return break_even_point >= 3 ? 4 : break_even_point >= 2 ? 3 : 2;
+}
+
+static uint_t hash_at(const uint8_t* const p, const uint_t hash_len) {
+    uint32_t v = p[0] | ((uint32_t)p[1] << 8);
+    if (hash_len > 2) { v |= (uint32_t)p[2] << 16; }
+    if (hash_len > 3) { v |= (uint32_t)p[3] << 24; }
+    return (v * 2654435761u) >> (32 - HEATSHRINK_HASH_BITS);
+}
+
+/* Add buffer positions [FROM, TO) to the hash chain. Positions are added in
+ * increasing order as match_scan_index passes them, so the chain of a hash
+ * always leads from the most recent position back to older ones.
+ *
+ * The chain holds the distance back to the previous position with the same
+ * hash (0: none) rather than the position itself, so it stays valid when
+ * save_backlog shifts it along with the buffer. The heads are ring indices,
+ * so in a ring they don't need to be rebased either. */
+static void hash_chain_insert(heatshrink_encoder *hse, uint_t from, uint_t to) {
+    struct hs_hash_chain *hc = HEATSHRINK_ENCODER_HASH_CHAIN(hse);
+    const uint_t hash_len = get_hash_len(hse);
+    const uint_t window_sz = get_window_size(hse);
+
+    /* Don't hash beyond the end of input. */
+    const uint_t limit = get_input_offset(hse) + hse->input_size - (hash_len - 1);
+    if (to > limit) { to = limit; }
+
+    for (uint_t pos = from; pos < to; pos++) {
+        const uint_t h = hash_at(ring_ptr(hse, pos), hash_len);
+        const uint_t prev = hc->head[h];
+        /* A head in a ring which has since been overwritten can be at any
+         * position; if it isn't before this one, it's out of the window. */
+        const uint_t dist = pos - ring_pos(hse, prev);
+        const uint_t i = ring_index(hse, pos);
+        hc->chain[i] = (prev == HASH_CHAIN_EMPTY || dist > window_sz) ? 0 : dist;
+        hc->head[h] = i;
+    }
+}
+#endif
+
+#if HEATSHRINK_USE_INDEX
+/* Not a ring index, even at HEATSHRINK_MAX_WINDOW_BITS. */
+constexpr uint32_t INDEX_NONE = UINT32_MAX;
+
+/* The 32-bit variant stores the distance back to the previous instance of
+ * the same byte in the index (0: none), rather than its position. */
+static hs_index_t* get_index(heatshrink_encoder *hse) {
+    return HEATSHRINK_ENCODER_INDEX(hse)->index;
+}
+#endif
+
 static void do_indexing(heatshrink_encoder *hse) {
 #if HEATSHRINK_USE_INDEX
-    /* Build an index array I that contains flattened linked lists
+    /* Extend an index array I that contains flattened linked lists
      * for the previous instances of every byte in the buffer.
      *
      * For example, if buf[200] == 'x', then index[200] will either
-     * be an offset i such that buf[i] == 'x', or a negative offset
-     * to indicate end-of-list. This significantly speeds up matching,
-     * while only using sizeof(uint16_t)*sizeof(buffer) bytes of RAM.
-     *
-     * Future optimization options:
-     * 1. Since any negative value represents end-of-list, the other
-     *    15 bits could be used to improve the index dynamically.
+     * be a distance d such that buf[200-d] == 'x', or 0 to indicate
+     * end-of-list. This significantly speeds up matching, while only
+     * using sizeof(hs_index_t)*sizeof(buffer) bytes of RAM.
      *
-     * 2. Likewise, the last lookahead_sz bytes of the index will
-     *    not be usable, so temporary data could be stored there to
-     *    dynamically improve the index.
-     * */
+     * Only the input added since the last call is indexed; the entries
+     * before it are relative, so save_backlog just moves them along with
+     * the buffer. The last positions are ring indices, so in a ring they
+     * don't need to be rebased either. */
     struct hs_index *hsi = HEATSHRINK_ENCODER_INDEX(hse);
-    int16_t last[256];
-    memset(last, 0xFF, sizeof(last));
+    uint32_t * const last = hsi->last;
 
-    uint8_t * const data = hse->buffer;
-    int16_t * const index = hsi->index;
+    hs_index_t * const index = get_index(hse);
 
     const uint_t input_offset = get_input_offset(hse);
     const uint_t end = input_offset + hse->input_size;
-
-    for (uint_t i=0; i<end; i++) {
-        /* u8 */ uint_t v = data[i];
-        int_t lv = last[v];
-        index[i] = lv;
-        last[v] = i;
+    const uint_t window_sz = get_window_size(hse);
+
+    for (uint_t i=hsi->indexed; i<end; i++) {
+        /* u8 */ uint_t v = *ring_ptr(hse, i);
+        uint_t lv = last[v];
+        /* (Out of the window if it has since been overwritten in a ring.) */
+        const uint_t dist = i - ring_pos(hse, lv);
+        const uint_t ri = ring_index(hse, i);
+        index[ri] = (lv == INDEX_NONE || dist > window_sz) ? 0 : dist;
+        last[v] = ri;
     }
+    hsi->indexed = end;
 #endif
+    (void)hse;
 }
 
 static bool is_finishing(heatshrink_encoder *hse) {
@@ -505,76 +1211,175 @@ static uint_t find_longest_match(heatshrink_encoder* const hse, uint_t start,
     LOG("-- scanning for match of buf[%u:%u] between buf[%u:%u] (max %u bytes)\n",
         end, end + maxlen, start, end + maxlen - 1, maxlen);
 
-#if !HEATSHRINK_USE_INDEX
-    const size_t break_even_point =
-      (1 + HEATSHRINK_ENCODER_WINDOW_BITS(hse) +
-          HEATSHRINK_ENCODER_LOOKAHEAD_BITS(hse)) / 8;
+    const hs_level_limits& limits = level_limits[HEATSHRINK_ENCODER_LEVEL(hse)];
+    {
+        const uint_t max_distance = get_window_size(hse) >> limits.distance_shift;
+        if (end - start > max_distance) { start = end - max_distance; }
+    }
+    /* A match this long ends the search. */
+    const uint_t good_length = std::min(maxlen, (uint_t)limits.good_length);
+
+    const uint8_t* const needlepoint = ring_ptr(hse, end);
+
+    /* If the previous position was searched, its longest match less its
+     * first byte is a match here too, so only longer ones or the first/nearest
+     * one as long need to be looked for. */
+    uint_t known_length = 0;
+    uint_t known_pos = MATCH_NOT_FOUND;
+    if (hse->cached_length > 1 && hse->cached_end == end) {
+        known_pos = hse->cached_pos;
+        known_length = heatshrink::Locator::cmp(ring_ptr(hse, known_pos), needlepoint, maxlen);
+    }
+    /* Runs of a byte or of a short pattern match right before themselves;
+     * a run as long as needed makes the window search unnecessary. */
+    if (known_length < good_length) {
+        static_assert(!HEATSHRINK_CIRCULAR_WINDOW || RUN_MAX_DISTANCE <= HEATSHRINK_ENCODER_RING_GUARD);
+        const heatshrink::byte_span run = heatshrink::Locator::find_run(needlepoint, maxlen,
+            std::min(end - start, (uint_t)RUN_MAX_DISTANCE));
+        if (run.size_bytes() > known_length) {
+            known_pos = end - (needlepoint - run.data());
+            known_length = run.size_bytes();
+        }
+    }
+
+#if HEATSHRINK_USE_HASH_CHAIN
+    const uint_t break_even_point = get_break_even_point(hse);
 
     if(maxlen <= break_even_point) [[unlikely]] {
         return MATCH_NOT_FOUND;
     }
 
-    uint32_t match_maxlen = 0;
-    uint32_t match_index = MATCH_NOT_FOUND;
-    {
-        const uint8_t* const buf = hse->buffer;
+    struct hs_hash_chain *hc = HEATSHRINK_ENCODER_HASH_CHAIN(hse);
 
-        const uint8_t* const data = buf+start;
-        const uint8_t* const pattern = buf+end;
-        const uint32_t dataLen = end-start;
-        const heatshrink::byte_span lm = heatshrink::Locator::find_longest_match(pattern,maxlen,data,dataLen);
+    uint_t match_maxlen = known_length > 1 ? known_length - 1 : 0;
+    uint_t match_index = MATCH_NOT_FOUND;
 
-        if(lm.empty()) {
-            return MATCH_NOT_FOUND;
-        } else {
-            match_index = lm.data()-buf;
-            match_maxlen = lm.size_bytes();
+    uint_t pos = hc->head[hash_at(needlepoint, get_hash_len(hse))];
+    if (pos != HASH_CHAIN_EMPTY) { pos = ring_pos(hse, pos); }
+    /* The optimal parse hashes ahead of the position searched. */
+    while (pos != HASH_CHAIN_EMPTY && pos >= end) [[unlikely]] {
+        const uint_t dist = hc->chain[ring_index(hse, pos)];
+        pos = (dist == 0) ? HASH_CHAIN_EMPTY : pos - dist;
+    }
+    if (pos != HASH_CHAIN_EMPTY && known_length < good_length) {
+        uint_t depth = limits.max_candidates;
+        while (pos >= start) {
+            const uint8_t* const pospoint = ring_ptr(hse, pos);
+            /* Only check matches that will potentially beat the current maxlen;
+             * this also skips most hash collisions. */
+            if (pospoint[match_maxlen] == needlepoint[match_maxlen]) {
+                const uint_t len = heatshrink::Locator::cmp(pospoint, needlepoint, maxlen);
+                if (len > match_maxlen) {
+                    match_maxlen = len;
+                    match_index = pos;
+                    if (len >= good_length) { break; } /* won't find better, or good enough */
+                }
+            }
+            const uint_t dist = hc->chain[ring_index(hse, pos)];
+            if (dist == 0 || dist > pos - start || --depth == 0) { break; }
+            pos -= dist;
         }
     }
 
+#elif !HEATSHRINK_USE_INDEX
+    const size_t break_even_point = get_break_even_point(hse);
+
+    if(maxlen <= break_even_point) [[unlikely]] {
+        return MATCH_NOT_FOUND;
+    }
+
+    uint32_t match_maxlen = 0;
+    uint32_t match_index = MATCH_NOT_FOUND;
+    /* Don't sweep the window for a match no better than the known one. */
+    if (known_length < good_length) {
+        /* Sweep buffer positions [FROM, TO), which are contiguous in memory.
+         * Returns true if a good enough match was found. */
+        const auto sweep = [&](const uint_t from, const uint_t to) -> bool {
+            const uint8_t* const data = ring_ptr(hse, from);
+            const uint32_t dataLen = to - from;
+#if HEATSHRINK_SEARCH_NEAREST_FIRST
+            const heatshrink::byte_span lm = heatshrink::Locator::find_longest_match_backward(needlepoint,maxlen,data,dataLen,
+                limits.max_candidates, good_length);
 #else
+            const heatshrink::byte_span lm = heatshrink::Locator::find_longest_match(needlepoint,maxlen,data,dataLen,
+                limits.max_candidates, good_length);
+#endif
 
-    const uint8_t* const buf = hse->buffer;
+            if(lm.size_bytes() > match_maxlen) {
+                match_index = from + (lm.data()-data);
+                match_maxlen = lm.size_bytes();
+            }
+            return match_maxlen >= good_length;
+        };
+#if HEATSHRINK_CIRCULAR_WINDOW
+        /* If the window wraps around the ring, its two segments are swept
+         * in search order. Matches may cross the seam either way; the ring's
+         * guard bytes make both contiguous for as far as a match can reach. */
+        const uint_t seam = get_ring_size(hse) - hse->ring_base;
+        if (start < seam && seam < end) {
+#if HEATSHRINK_SEARCH_NEAREST_FIRST
+            if (!sweep(seam, end)) { sweep(start, seam); }
+#else
+            if (!sweep(start, seam)) { sweep(seam, end); }
+#endif
+        } else
+#endif
+        {
+            sweep(start, end);
+        }
+    }
+#else
 
-    uint_t match_maxlen = 0;
+    uint_t match_maxlen = known_length > 1 ? known_length - 1 : 0;
     uint_t match_index = MATCH_NOT_FOUND;
 
     uint_t len = 0;
-    const uint8_t* const needlepoint = &buf[end];
 
-    struct hs_index *hsi = HEATSHRINK_ENCODER_INDEX(hse);
-    int_t pos = hsi->index[end];
+    const hs_index_t* const index = get_index(hse);
+    uint_t pos = end;
+    uint_t candidates = known_length < good_length ? limits.max_candidates : 0;
+
+    while(candidates-- != 0) {
+        const uint_t dist = index[ring_index(hse, pos)];
+        if (dist == 0 || dist > pos - start) { break; }
+        pos -= dist;
 
-    while(pos >= (int_t)start) {
-        const uint8_t * const pospoint = &buf[pos];
+        const uint8_t * const pospoint = ring_ptr(hse, pos);
         len = 0;
 
         /* Only check matches that will potentially beat the current maxlen.
          * This is redundant with the index if match_maxlen is 0, but the
          * added branch overhead to check if it == 0 seems to be worse. */
         if (pospoint[match_maxlen] != needlepoint[match_maxlen]) {
-            pos = hsi->index[pos];
             continue;
         }
 
-        for (len = 1; len < maxlen; len++) {
-            if (pospoint[len] != needlepoint[len]) break;
-        }
-        // len = 1+heatshrink::Locator::cmp8(pospoint+1,needlepoint+1,maxlen-1);
+        /* Verify the candidate with the word-wide/SIMD compare. */
+        len = heatshrink::Locator::cmp(pospoint, needlepoint, maxlen);
 
         if (len > match_maxlen) {
             match_maxlen = len;
             match_index = pos;
-            if (len == maxlen) { break; } /* won't find better */
+            if (len >= good_length) { break; } /* won't find better, or good enough */
         }
-        pos = hsi->index[pos];
     }
 
-    const size_t break_even_point =
-      (1 + HEATSHRINK_ENCODER_WINDOW_BITS(hse) +
-          HEATSHRINK_ENCODER_LOOKAHEAD_BITS(hse)) / 8;
+    const size_t break_even_point = get_break_even_point(hse);
 
 #endif
+    if (known_length > 1 && (match_index == MATCH_NOT_FOUND || match_maxlen < known_length)) {
+        /* The search was skipped or bounded before it got to the known match. */
+        match_index = known_pos;
+        match_maxlen = known_length;
+    }
+    if (match_index != MATCH_NOT_FOUND && match_maxlen > 2) {
+        hse->cached_end = end + 1;
+        hse->cached_pos = match_index + 1;
+        hse->cached_length = match_maxlen - 1;
+    } else {
+        hse->cached_length = 0;
+    }
+
     /* Instead of comparing break_even_point against 8*match_maxlen,
      * compare match_maxlen against break_even_point/8 to avoid
      * overflow. Since MIN_WINDOW_BITS and MIN_LOOKAHEAD_BITS are 4 and
@@ -652,10 +1457,27 @@ static void push_bits(heatshrink_encoder *hse, /* u8 */ uint_t count, /* u8 */ u
     }
 }
 
+static void push_token(heatshrink_encoder *hse, uint_t count, token_t bits,
+        output_info *oi) {
+    static_assert(BIT_INDEX_INIT == 0);
+    LOG("++ push_token: %d bits, input of 0x%08llx\n", count, (unsigned long long)bits);
+    const uint_t total = hse->bit_index + count;
+    /* The pending bits are the lowest bit_index ones of current_byte. */
+    const uint64_t acc = ((uint64_t)hse->current_byte << count) | bits;
+    uint64_t word = acc << (64 - total);
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    word = __builtin_bswap64(word);
+#endif
+    memcpy(oi->buf + *oi->output_size, &word, sizeof(word));
+    *oi->output_size += total / 8;
+    hse->bit_index = total % 8;
+    hse->current_byte = acc;
+}
+
 static void push_literal_byte(heatshrink_encoder *hse, output_info *oi) {
     uint_t processed_offset = hse->match_scan_index - 1;
     uint_t input_offset = get_input_offset(hse) + processed_offset;
-    /* u8 */ uint_t c = hse->buffer[input_offset];
+    /* u8 */ uint_t c = *ring_ptr(hse, input_offset);
     LOG("-- yielded literal byte 0x%02x ('%c') from +%d\n",
         c, isprint(c) ? c : '.', input_offset);
     push_bits(hse, 8, c, oi);
@@ -666,21 +1488,220 @@ static void save_backlog(heatshrink_encoder *hse) {
 
     uint_t msi = hse->match_scan_index;
 
-    /* Copy processed data to beginning of buffer, so it can be
-     * used for future matches. Don't bother checking whether the
-     * input is less than the maximum size, because if it isn't,
-     * we're done anyway. */
+    /* Make processed data the backlog, so it can be used for future
+     * matches. Don't bother checking whether the input is less than
+     * the maximum size, because if it isn't, we're done anyway. */
     uint_t rem = input_buf_sz - msi; // unprocessed bytes
+#if HEATSHRINK_CIRCULAR_WINDOW
+    /* Rotate the buffer positions in the ring; no data is moved. */
+    hse->ring_base = ring_index(hse, input_buf_sz - rem);
+#else
+    /* Copy the data to the beginning of the buffer. */
     uint_t shift_sz = input_buf_sz + rem;
 
     memmove(&hse->buffer[0],
         &hse->buffer[input_buf_sz - rem],
         shift_sz);
+#endif
+
+#if HEATSHRINK_USE_INDEX
+    {
+        /* Move the (relative) index along with the buffer and rebase
+         * the last positions, unless the buffer is a ring, so only new
+         * input needs to be indexed. */
+        struct hs_index *hsi = HEATSHRINK_ENCODER_INDEX(hse);
+        const uint_t shift = input_buf_sz - rem;
+        const uint_t indexed = hsi->indexed > shift ? hsi->indexed - shift : 0;
+#if !HEATSHRINK_CIRCULAR_WINDOW
+        memmove(&hsi->index[0],
+            &hsi->index[shift],
+            indexed*sizeof(hs_index_t));
+#endif
+        hsi->indexed = indexed;
+#if !HEATSHRINK_CIRCULAR_WINDOW
+        for (uint_t v=0; v < 256; v++) {
+            const uint_t pos = hsi->last[v];
+            hsi->last[v] = (pos == INDEX_NONE || pos < shift) ? INDEX_NONE : pos - shift;
+        }
+#endif
+    }
+#endif
+
+    if (hse->cached_pos >= msi) {
+        hse->cached_end -= msi;
+        hse->cached_pos -= msi;
+    } else {
+        hse->cached_length = 0;
+    }
+
+#if HEATSHRINK_DYNAMIC_ALLOC
+    if (hse->parse != NULL) {
+        hse->parse->end = 0;
+        hse->parse->hashed = hse->parse->hashed > msi ? hse->parse->hashed - msi : 0;
+    }
+#endif
+
+#if HEATSHRINK_USE_HASH_CHAIN
+    {
+#if !HEATSHRINK_CIRCULAR_WINDOW
+        /* The chain is relative and moves with the buffer; heads are
+         * rebased, dropping any which now point before the buffer.
+         * In a ring, neither needs to change. */
+        struct hs_hash_chain *hc = HEATSHRINK_ENCODER_HASH_CHAIN(hse);
+        memmove(&hc->chain[0],
+            &hc->chain[input_buf_sz - rem],
+            shift_sz*sizeof(hs_index_t));
+        const uint_t shift = input_buf_sz - rem;
+        for (uint_t h=0; h < (1 << HEATSHRINK_HASH_BITS); h++) {
+            const uint_t pos = hc->head[h];
+            hc->head[h] = (pos == HASH_CHAIN_EMPTY || pos < shift) ? HASH_CHAIN_EMPTY : pos - shift;
+        }
+#endif
+    }
+#endif
 
     hse->match_scan_index = 0;
     hse->input_size -= input_buf_sz - rem;
 }
 
+/* Bit writer for heatshrink_compress(). */
+struct bit_writer {
+    uint8_t *buf;
+    size_t size;
+    size_t pos;
+    uint64_t acc;               /* the lowest count bits are pending */
+    uint_t count;
+};
+
+/* Push a token of COUNT bits. Returns false if the output is full. */
+static bool write_token(bit_writer& bw, const uint_t count, const token_t bits) {
+    bw.acc = (bw.acc << count) | bits;
+    bw.count += count;
+    if (bw.size - bw.pos >= sizeof(uint64_t)) [[likely]] {
+        uint64_t word = bw.acc << (64 - bw.count);
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+        word = __builtin_bswap64(word);
+#endif
+        memcpy(bw.buf + bw.pos, &word, sizeof(word));
+        bw.pos += bw.count / 8;
+        bw.count %= 8;
+    } else {
+        while (bw.count >= 8) {
+            if (bw.pos == bw.size) { return false; }
+            bw.count -= 8;
+            bw.buf[bw.pos++] = bw.acc >> bw.count;
+        }
+    }
+    return true;
+}
+
+/* Return the longest match for IN[end:end+maxlen] at most WINDOW_SIZE bytes
+ * back, searching IN itself as the window. IN has SIZE bytes and no slack
+ * after them, so searches near its end must not read ahead. */
+static heatshrink::byte_span find_longest_match_in(const uint8_t *in, const uint_t size,
+        const uint_t end, const uint_t maxlen, const uint_t window_size) {
+    heatshrink::byte_span lm = heatshrink::Locator::find_run(&in[end], maxlen,
+        std::min(end, RUN_MAX_DISTANCE));
+    if (lm.size_bytes() < maxlen) {
+        const uint_t start = end > window_size ? end - window_size : 0;
+        if (end - start > 0) {
+#if HEATSHRINK_SEARCH_NEAREST_FIRST
+            /* The backward search reads nothing beyond the pattern. */
+            (void)size;
+            const heatshrink::byte_span wm = heatshrink::Locator::find_longest_match_backward(
+                &in[end], maxlen, &in[start], end - start);
+#else
+            const heatshrink::byte_span wm =
+                (size - (end + maxlen) < heatshrink::Locator::MAX_OVERREAD) ?
+                heatshrink::Locator::find_longest_match_bounded(
+                    &in[end], maxlen, &in[start], end - start) :
+                heatshrink::Locator::find_longest_match(
+                    &in[end], maxlen, &in[start], end - start);
+#endif
+            if (wm.size_bytes() >= lm.size_bytes()) { lm = wm; }
+        }
+    }
+    return lm;
+}
+
+HSE_compress_res heatshrink_compress(const uint8_t *in_buf, size_t in_size,
+        uint8_t *out_buf, size_t out_buf_size,
+        uint8_t window_sz2, uint8_t lookahead_sz2, size_t *output_size) {
+    if ((in_buf == NULL && in_size != 0) || out_buf == NULL || output_size == NULL) [[unlikely]] {
+        return HSER_COMPRESS_ERROR_NULL;
+    }
+    if ((window_sz2 < HEATSHRINK_MIN_WINDOW_BITS) ||
+        (window_sz2 > HEATSHRINK_MAX_WINDOW_BITS) ||
+        (lookahead_sz2 < HEATSHRINK_MIN_LOOKAHEAD_BITS) ||
+        (lookahead_sz2 >= window_sz2) ||
+        ((uint64_t)in_size > UINT32_MAX)) [[unlikely]] {
+        return HSER_COMPRESS_ERROR_MISUSE;
+    }
+    *output_size = 0;
+
+    const uint_t window_size = 1 << window_sz2;
+    const uint_t lookahead_size = 1 << lookahead_sz2;
+    const uint_t break_even_point = (1 + window_sz2 + lookahead_sz2) / 8;
+    const uint_t size = in_size;
+
+    bit_writer bw { out_buf, out_buf_size, 0, 0, 0 };
+
+    uint_t pos = 0;
+#if HEATSHRINK_LAZY_MATCHING
+    heatshrink::byte_span lazy {};
+#endif
+    while (pos < size) {
+        const uint_t maxlen = std::min(lookahead_size, size - pos);
+        heatshrink::byte_span lm {};
+#if HEATSHRINK_LAZY_MATCHING
+        if (!lazy.empty()) {
+            lm = lazy;
+            lazy = heatshrink::byte_span {};
+        } else
+#endif
+        if (maxlen > break_even_point) {
+            lm = find_longest_match_in(in_buf, size, pos, maxlen, window_size);
+        }
+#if HEATSHRINK_LAZY_MATCHING
+        if (lm.size_bytes() > break_even_point && lm.size_bytes() < HEATSHRINK_LAZY_GOOD_LENGTH &&
+            std::min(lookahead_size, size - pos - 1) >= lm.size_bytes() + HEATSHRINK_LAZY_MIN_GAIN) {
+            /* If the next byte starts a longer match, emit a literal now.
+             * (Only if there's room for one: the search reads at least two
+             * bytes of the pattern, and IN has no slack after its end.) */
+            const uint_t next_maxlen = std::min(lookahead_size, size - pos - 1);
+            const heatshrink::byte_span next = find_longest_match_in(in_buf, size, pos + 1,
+                next_maxlen, window_size);
+            if (next.size_bytes() >= lm.size_bytes() + HEATSHRINK_LAZY_MIN_GAIN) {
+                lazy = next;
+                lm = heatshrink::byte_span {};
+            }
+        }
+#endif
+        bool ok;
+        if (lm.size_bytes() > break_even_point) {
+            const uint_t offset = &in_buf[pos] - lm.data();
+            ok = write_token(bw, 1 + window_sz2 + lookahead_sz2,
+                ((token_t)(offset - 1) << lookahead_sz2) | (lm.size_bytes() - 1));
+            pos += lm.size_bytes();
+        } else {
+            ok = write_token(bw, 1 + 8, (HEATSHRINK_LITERAL_MARKER << 8) | in_buf[pos]);
+            pos++;
+        }
+        if (!ok) {
+            *output_size = bw.pos;
+            return HSER_COMPRESS_ERROR_OUTPUT_FULL;
+        }
+    }
+    if (bw.count != 0) {
+        if (bw.pos == bw.size) {
+            *output_size = bw.pos;
+            return HSER_COMPRESS_ERROR_OUTPUT_FULL;
+        }
+        bw.buf[bw.pos++] = bw.acc << (8 - bw.count);
+    }
+    *output_size = bw.pos;
+    return HSER_COMPRESS_OK;
+}
 
 } // extern "C"
 
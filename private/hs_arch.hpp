@@ -9,7 +9,8 @@ namespace heatshrink {
 
     /**
      * @brief Provides feature flags of the architecture we're building for.
-     * (Only for Xtensa because the RISC-V's don't have any useful features for our use case.)
+     * (Only for Xtensa because the RISC-V's don't have any useful features for our use case,
+     * plus x86 for compressing on Linux hosts.)
      * 
      */
     struct Arch {
@@ -68,5 +69,55 @@ namespace heatshrink {
             #else
                 false;
             #endif
+
+        /**
+         * @brief Are we building for an x86 (32- or 64-bit) host?
+         * 
+         */
+        static constexpr bool X86 =
+            #if defined(__x86_64__) || defined(__i386__)
+                true;
+            #else
+                false;
+            #endif
+
+        /**
+         * @brief Is SSE2 part of the baseline ISA we're building for? (Always true on x86-64.)
+         * 
+         */
+        static constexpr bool X86_SSE2 =
+            #if defined(__SSE2__)
+                true;
+            #else
+                false;
+            #endif
+
+        /**
+         * @brief Is AVX2 part of the baseline ISA we're building for (e.g. \c -mavx2 or
+         * \c -march=native)? If not, AVX2 support is detected at runtime.
+         * 
+         */
+        static constexpr bool X86_AVX2 =
+            #if defined(__AVX2__)
+                true;
+            #else
+                false;
+            #endif
+
+        /**
+         * @brief Use the target-neutral search functions built on GCC's vector extensions
+         * (\c __attribute__((vector_size))) when no hand-written SIMD variant exists for the target?
+         * Enabled by default if the compiler targets a CPU with vector units (RISC-V V, NEON, SSE,
+         * AltiVec); can be forced on or off by defining \c HEATSHRINK_VECTOR_EXT to 1 or 0.
+         * 
+         */
+        static constexpr bool VECTOR_EXT =
+            #if defined(HEATSHRINK_VECTOR_EXT)
+                (HEATSHRINK_VECTOR_EXT != 0);
+            #elif defined(__GNUC__) && (defined(__riscv_vector) || defined(__ARM_NEON) || defined(__SSE2__) || defined(__ALTIVEC__))
+                true;
+            #else
+                false;
+            #endif
     };
 }
\ No newline at end of file
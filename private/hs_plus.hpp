@@ -0,0 +1,399 @@
+/*
+
+    Copyright 2024, <https://github.com/BitsForPeople>
+
+    This program is free software: you can redistribute it and/or modify it
+    under the terms of the GNU General Public License as published by the
+    Free Software Foundation, either version 3 of the License, or (at your
+    option) any later version.
+
+    This program is distributed in the hope that it will be useful, bu
+    WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+    or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+    for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program. If not, see <https://www.gnu.org/licenses/>.
+*/
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <algorithm>
+
+
+namespace heatshrink {
+
+    /**
+     * @brief The "heatshrink+" format: the same LZSS tokens as the regular format, but
+     * coded with an adaptive binary range coder (as in LZMA) instead of as fixed-width
+     * fields.
+     *
+     * Every binary decision is coded with a probability which adapts to the data coded
+     * so far, so no tables are transmitted and the models take a fixed amount of RAM:
+     * - the token kind, in the context of the kinds of the two previous tokens;
+     * - a literal's bits, as a binary tree in the context of the preceding byte's
+     *   HEATSHRINK_PLUS_LITERAL_CONTEXT_BITS high bits;
+     * - a backref's length + 1 and then its offset, each as a "number": the position
+     *   of its highest bit (the slot), followed by the bits below it. Up to 4 of those
+     *   are modeled (all of them in slots 1 to 4, else the lowest 4), the rest are
+     *   coded at a fixed 1/2 probability. The offset's slot is modeled per length up
+     *   to 5, because short matches tend to be near.
+     * A length + 1 of 1 marks the end of the stream.
+     */
+    namespace plus {
+
+        using prob_t = uint16_t;
+
+        static constexpr uint32_t PROB_BITS = 11;
+        static constexpr prob_t PROB_INIT = 1 << (PROB_BITS - 1);
+        static constexpr uint32_t MOVE_BITS = 5;
+        static constexpr uint32_t TOP = 1 << 24;
+
+        static constexpr uint32_t SLOT_BITS = 5;
+        static constexpr uint32_t LOW_SLOTS = 5;        // slots 1 to 4 have all their bits modeled
+        static constexpr uint32_t ALIGN_BITS = 4;       // the lowest bits of larger numbers
+        static constexpr uint32_t LENGTH_STATES = 4;    // offset slot contexts, for lengths 2, 3, 4, 5+
+        static constexpr uint32_t LITERAL_CONTEXT_BITS = HEATSHRINK_PLUS_LITERAL_CONTEXT_BITS;
+
+        /* Length + 1 of the end marker */
+        static constexpr uint32_t END_MARKER = 1;
+
+        struct number_model {
+            prob_t low[1 << LOW_SLOTS];     // bit tree of slot s at [(1 << s) + node]
+            prob_t align[1 << ALIGN_BITS];
+        };
+
+        struct model {
+            prob_t is_literal[4];
+            prob_t length_slot[1 << SLOT_BITS];
+            prob_t offset_slot[LENGTH_STATES][1 << SLOT_BITS];
+            number_model length;
+            number_model offset;
+            prob_t literal[256 << LITERAL_CONTEXT_BITS];
+
+            void reset() {
+                std::fill_n(&is_literal[0], sizeof(*this) / sizeof(prob_t), PROB_INIT);
+            }
+
+            prob_t* literal_tree(const uint32_t prev_byte) {
+                return &literal[(prev_byte >> (8 - LITERAL_CONTEXT_BITS)) << 8];
+            }
+
+            prob_t* offset_slot_tree(const uint32_t length) {
+                return offset_slot[std::min(std::max(length, 2u), LENGTH_STATES + 1) - 2];
+            }
+        };
+
+        static_assert(sizeof(model) % sizeof(prob_t) == 0);
+
+        /**
+         * @brief The next is_literal context after a token.
+         */
+        static constexpr uint32_t next_kinds(const uint32_t kinds, const bool literal) {
+            return ((kinds << 1) | literal) & 3;
+        }
+
+        static constexpr uint32_t slot_of(const uint32_t value) {
+            return 31 - __builtin_clz(value);
+        }
+
+        static inline void adapt(prob_t& p, const uint32_t bit) {
+            if (bit) {
+                p -= p >> MOVE_BITS;
+            } else {
+                p += ((1 << PROB_BITS) - p) >> MOVE_BITS;
+            }
+        }
+
+        /**
+         * @brief Range encoder. Output bytes are handed to OUT.put(byte, count, run_byte),
+         * which emits BYTE and then COUNT times RUN_BYTE: a run of bytes held back until
+         * it was known whether a carry would ripple through it.
+         */
+        template<typename Out>
+        class range_encoder {
+            uint64_t low;
+            uint32_t range;
+            uint32_t cache_size;
+            uint8_t cache;
+
+            void shift_low(Out& out) {
+                if ((uint32_t)low < 0xFF000000 || (low >> 32) != 0) {
+                    const uint32_t carry = low >> 32;
+                    out.put(cache + carry, cache_size - 1, 0xFF + carry);
+                    cache_size = 0;
+                    cache = low >> 24;
+                }
+                cache_size++;
+                low = (low & 0x00FFFFFF) << 8;
+            }
+
+            void normalize(Out& out) {
+                while (range < TOP) {
+                    range <<= 8;
+                    shift_low(out);
+                }
+            }
+
+            public:
+            void reset() {
+                low = 0;
+                range = 0xFFFFFFFF;
+                cache_size = 1;
+                cache = 0;
+            }
+
+            void bit(prob_t& p, const uint32_t bit, Out& out) {
+                const uint32_t bound = (range >> PROB_BITS) * p;
+                if (bit) {
+                    low += bound;
+                    range -= bound;
+                } else {
+                    range = bound;
+                }
+                adapt(p, bit);
+                normalize(out);
+            }
+
+            /* COUNT bits of VALUE, MSB first, at a fixed 1/2 probability */
+            void direct(const uint32_t value, uint32_t count, Out& out) {
+                while (count != 0) {
+                    count--;
+                    range >>= 1;
+                    if ((value >> count) & 1) { low += range; }
+                    normalize(out);
+                }
+            }
+
+            /* COUNT bits of VALUE, MSB first, as a binary tree with probabilities
+             * PROBS[1 .. 2^COUNT - 1] */
+            void tree(prob_t* const probs, const uint32_t value, uint32_t count, Out& out) {
+                uint32_t node = 1;
+                while (count != 0) {
+                    count--;
+                    const uint32_t b = (value >> count) & 1;
+                    bit(probs[node], b, out);
+                    node = (node << 1) | b;
+                }
+            }
+
+            /* VALUE (>= 1) as a number, with its slot coded in SLOT_PROBS */
+            void number(prob_t* const slot_probs, number_model& m, const uint32_t value, Out& out) {
+                const uint32_t slot = slot_of(value);
+                tree(slot_probs, slot, SLOT_BITS, out);
+                const uint32_t extra = value - (1 << slot);
+                if (slot < LOW_SLOTS) {
+                    tree(&m.low[1 << slot], extra, slot, out);
+                } else {
+                    direct(extra >> ALIGN_BITS, slot - ALIGN_BITS, out);
+                    tree(m.align, extra & ((1 << ALIGN_BITS) - 1), ALIGN_BITS, out);
+                }
+            }
+
+            /* Push out the rest of the code, so that the decoder can read all of it. */
+            void flush(Out& out) {
+                for (uint32_t i = 0; i < 5; i++) { shift_low(out); }
+            }
+        };
+
+        /**
+         * @brief Output of the range encoder, until it is polled. The encoder only codes a
+         * token when this is empty, so only the first run put can be arbitrarily long. The
+         * rest of a token (or the flush) moves the code on by at most 1 + 6 bits per modeled
+         * bit (the least probable bit is 31/2048) and 1 per direct bit, < 24 bytes.
+         */
+        class output_queue {
+            static constexpr uint32_t TAIL_SIZE = 32;
+
+            uint32_t run;               // times RUN_BYTE follows HEAD
+            uint8_t head;
+            uint8_t run_byte;
+            bool has_head;
+            uint8_t tail_count;
+            uint8_t tail_read;
+            uint8_t tail[TAIL_SIZE];
+
+            public:
+            void reset() {
+                run = 0;
+                has_head = false;
+                tail_count = 0;
+                tail_read = 0;
+            }
+
+            bool empty() const {
+                return !has_head && run == 0 && tail_read == tail_count;
+            }
+
+            void put(const uint8_t byte, uint32_t count, const uint8_t rb) {
+                if (empty()) {
+                    tail_count = 0;
+                    tail_read = 0;
+                    head = byte;
+                    has_head = true;
+                    run = count;
+                    run_byte = rb;
+                } else {
+                    tail[tail_count++] = byte;
+                    while (count != 0) {
+                        tail[tail_count++] = rb;
+                        count--;
+                    }
+                }
+            }
+
+            /* Move up to SIZE bytes to OUT. Returns the number moved. */
+            size_t drain(uint8_t* out, const size_t size) {
+                size_t n = 0;
+                if (has_head && n < size) {
+                    out[n++] = head;
+                    has_head = false;
+                }
+                while (run != 0 && n < size) {
+                    out[n++] = run_byte;
+                    run--;
+                }
+                while (tail_read != tail_count && n < size) {
+                    out[n++] = tail[tail_read++];
+                }
+                return n;
+            }
+        };
+
+        /**
+         * @brief Resumable decoding of a number (see range_encoder::number()).
+         */
+        template<typename In, typename Decoder>
+        class number_decoder {
+            enum : uint8_t { SLOT, LOW, DIRECT, ALIGN };
+            uint32_t node;
+            uint32_t extra;
+            uint8_t slot;
+            uint8_t bits;               // left in this phase
+            uint8_t phase;
+
+            public:
+            void reset() {
+                node = 1;
+                extra = 0;
+                phase = SLOT;
+            }
+
+            /* Returns the number, or 0 if out of input. */
+            uint32_t decode(Decoder& rc, prob_t* const slot_probs, number_model& m, In& in) {
+                if (phase == SLOT) {
+                    while (node < (1 << SLOT_BITS)) {
+                        const int32_t b = rc.bit(slot_probs[node], in);
+                        if (b < 0) { return 0; }
+                        node = (node << 1) | b;
+                    }
+                    slot = node - (1 << SLOT_BITS);
+                    node = 1;
+                    if (slot < LOW_SLOTS) {
+                        bits = slot;
+                        phase = LOW;
+                    } else {
+                        bits = slot - ALIGN_BITS;
+                        phase = DIRECT;
+                    }
+                }
+                if (phase == DIRECT) {
+                    while (bits != 0) {
+                        const int32_t b = rc.direct(in);
+                        if (b < 0) { return 0; }
+                        extra = (extra << 1) | b;
+                        bits--;
+                    }
+                    bits = ALIGN_BITS;
+                    phase = ALIGN;
+                }
+                /* The modeled bits: all of a low slot's, or the lowest of the others */
+                prob_t* const probs = (phase == LOW) ? &m.low[1 << slot] : m.align;
+                while (bits != 0) {
+                    const int32_t b = rc.bit(probs[node], in);
+                    if (b < 0) { return 0; }
+                    node = (node << 1) | b;
+                    bits--;
+                }
+                if (phase == LOW) {
+                    extra = node - (1 << slot);
+                } else {
+                    extra = (extra << ALIGN_BITS) | (node - (1 << ALIGN_BITS));
+                }
+                const uint32_t value = (1u << slot) + extra;
+                reset();
+                return value;
+            }
+        };
+
+        /**
+         * @brief Range decoder, decoding one bit at a time from input which may run out
+         * at any bit: each bit needs at most one more input byte, which IN.get() returns,
+         * or -1 if there is none. Nothing is changed then, so the same call can be made
+         * again once there is input.
+         */
+        template<typename In>
+        class range_decoder {
+            uint32_t range;
+            uint32_t code;
+            uint32_t init;              // bytes left to read before the first bit
+
+            bool normalize(In& in) {
+                if (range < TOP) [[unlikely]] {
+                    const int32_t c = in.get();
+                    if (c < 0) { return false; }
+                    range <<= 8;
+                    code = (code << 8) | c;
+                }
+                return true;
+            }
+
+            public:
+            void reset() {
+                range = 0xFFFFFFFF;
+                code = 0;
+                init = 5;
+            }
+
+            /* Read the code's first bytes. Returns false if out of input. */
+            bool start(In& in) {
+                while (init != 0) {
+                    const int32_t c = in.get();
+                    if (c < 0) { return false; }
+                    code = (code << 8) | c;
+                    init--;
+                }
+                return true;
+            }
+
+            /* Returns the bit, or -1 if out of input. */
+            int32_t bit(prob_t& p, In& in) {
+                if (!normalize(in)) { return -1; }
+                const uint32_t bound = (range >> PROB_BITS) * p;
+                uint32_t b;
+                if (code < bound) {
+                    range = bound;
+                    b = 0;
+                } else {
+                    code -= bound;
+                    range -= bound;
+                    b = 1;
+                }
+                adapt(p, b);
+                return b;
+            }
+
+            int32_t direct(In& in) {
+                if (!normalize(in)) { return -1; }
+                range >>= 1;
+                if (code >= range) {
+                    code -= range;
+                    return 1;
+                }
+                return 0;
+            }
+        };
+
+    } // namespace plus
+
+} // namespace heatshrink
@@ -25,6 +25,10 @@
 
 #include "hs_arch.hpp"
 
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
 // #include "probe.hpp"
 
 // namespace perf {
@@ -81,6 +85,8 @@ namespace heatshrink {
      * beneficial for subsequent entropy coding.
      * However, using the S3's PIE to iterate in the backward direction would be somewhat clumsy,
      * so ...
+     * the backward (nearest-first) variants, ::find_pattern_backward() and
+     * ::find_longest_match_backward(), exist for the scalar, x86 and vector extension backends only.
      *
      */
     class Locator {
@@ -278,8 +284,9 @@ namespace heatshrink {
 
                         constexpr uint32_t LOOP_UNROLL_FACTOR = 8;
 
-                        const uint32_t vl = as<uint32_t>(pattern) << 8; 
-                        const uint32_t vh = vl >> 8;
+                        // Load only the 3 bytes of the pattern; there may be nothing readable after them.
+                        const uint32_t vh = pattern[0] | (pattern[1] << 8) | (pattern[2] << 16);
+                        const uint32_t vl = vh << 8;
 
                         // Loop unrolled 8x.
                         const uint8_t* const e8 = data + multof<LOOP_UNROLL_FACTOR>(dataLen);
@@ -452,6 +459,38 @@ namespace heatshrink {
                 }
             }
 
+            /**
+             * @brief 16 x \c uint8_t, for the search functions built on GCC's vector extensions.
+             */
+            typedef uint8_t u8x16_t __attribute__((vector_size(16)));
+            typedef uint64_t u64x2_t __attribute__((vector_size(16)));
+
+            static u8x16_t __attribute__((always_inline)) vload(const void* const ptr) noexcept {
+                u8x16_t v;
+                __builtin_memcpy(&v, ptr, sizeof(v));
+                return v;
+            }
+
+            /**
+             * @brief Collects the lanes of a vector comparison result into a bit mask, i.e. a
+             * portable stand-in for x86's \c PMOVMSKB.
+             *
+             * @param m result of a vector comparison (all lanes either 0x00 or 0xff)
+             * @return bit \c n is set iff lane \c n of \p m is non-zero
+             */
+            static uint32_t __attribute__((always_inline)) lane_mask(const u8x16_t m) noexcept {
+                // Every lane 0 or 1, then gather the 8 lanes of each 64-bit half via multiplication.
+                const u64x2_t w = (u64x2_t)(m & (uint8_t)1);
+                uint64_t lo = w[0];
+                uint64_t hi = w[1];
+                if constexpr (__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__) {
+                    lo = __builtin_bswap64(lo);
+                    hi = __builtin_bswap64(hi);
+                }
+                constexpr uint64_t GATHER = 0x0102040810204080ull;
+                return (uint32_t)((lo * GATHER) >> 56) | ((uint32_t)((hi * GATHER) >> 56) << 8);
+            }
+
         public:
 
             /**
@@ -604,21 +643,27 @@ namespace heatshrink {
 
                     return (const uint8_t*)d1-(end-len);
 
+                } else
+                if constexpr (Arch::VECTOR_EXT) {
+                    return cmp_vec(d1, d2, len);
                 } else {
-                    {
-                        const void* const end32 = p<uint8_t>(d1) + multof<4>(len);
-                        while (d1 < end32 && as<uint32_t>(d1) == as<uint32_t>(d2)) {
-                            incptr<4>(d1);
-                            incptr<4>(d2);
-                        }
+                    const void* const end32 = p<uint8_t>(d1) + multof<4>(len);
+                    while (d1 < end32 && as<uint32_t>(d1) == as<uint32_t>(d2)) {
+                        incptr<4>(d1);
+                        incptr<4>(d2);
                     }
 
-                    if(d1 < end) {
-                        // Find any common prefix in (d1+0)...(d1+sizeof(uint32_t)-1)
+                    if(d1 < end32) {
+                        // Find the common prefix in (d1+0)...(d1+sizeof(uint32_t)-1)
                         const uint32_t sml = subword_match_len(d1,d2);
-                        return std::min(len, (uint32_t)(((p<uint8_t>(d1)+len)-end)+sml));
+                        return (uint32_t)(((p<uint8_t>(d1)+len)-end)+sml);
                     } else {
-                        return len;
+                        // Compare the remaining 0..3 bytes without reading beyond them.
+                        while (d1 < end && *p<uint8_t>(d1) == *p<uint8_t>(d2)) {
+                            incptr<1>(d1);
+                            incptr<1>(d2);
+                        }
+                        return (uint32_t)((p<uint8_t>(d1)+len)-end);
                     }
 
                 }
@@ -645,9 +690,210 @@ namespace heatshrink {
 
 
 
+            /**
+             * @brief Like ::cmp(), but compares 16 bytes at a time using GCC's vector extensions.
+             *
+             * @param d1 pointer to memory to compare against \p d2
+             * @param d2 pointer to memory to compare against \p d1
+             * @param len maximum number of bytes to compare
+             * @return common prefix length of \p *d1 and \p *d2
+             */
+            static uint32_t cmp_vec(const void* d1, const void* d2, const uint32_t len) noexcept {
+                constexpr uint32_t VW = sizeof(u8x16_t);
+                uint32_t i = 0;
+                while(i + VW <= len) {
+                    const u8x16_t ne = (u8x16_t)(vload(p<uint8_t>(d1)+i) != vload(p<uint8_t>(d2)+i));
+                    const u64x2_t w = (u64x2_t)ne;
+                    if((w[0] | w[1]) != 0) {
+                        return i + __builtin_ctz(lane_mask(ne));
+                    }
+                    i += VW;
+                }
+                return i + cmp8(p<uint8_t>(d1)+i, p<uint8_t>(d2)+i, len-i);
+            }
+
+            /**
+             * @brief Target-neutral SIMD pattern search using GCC's vector extensions; same
+             * first-byte/last-byte candidate filter as the S3 and x86 variants, 16 bytes at a time.
+             *
+             * @param pattern start of pattern to search for
+             * @param patLen length of pattern to search for
+             * @param data start of data to search
+             * @param dataLen length of data to search
+             * @return first start of pattern in data, or \c nullptr if not found
+             */
+            static const uint8_t* find_pattern_vec(const uint8_t* const pattern, const uint32_t patLen, const uint8_t* const data, const uint32_t dataLen) noexcept {
+                constexpr uint32_t VW = sizeof(u8x16_t);
+
+                if(dataLen < VW) {
+                    return find_pattern_scalar(pattern, patLen, data, dataLen);
+                }
+
+                const u8x16_t vf = u8x16_t{} + pattern[0];
+                const u8x16_t vl = u8x16_t{} + pattern[patLen-1];
+
+                const uint8_t* const pat1 = pattern+1;
+                // We won't need to compare the first and the last byte of pattern a second time.
+                const uint32_t cmpLen = patLen - std::min(patLen,(uint32_t)2);
+
+                // The last block is re-aligned to end exactly at the end of data, so that we never
+                // read beyond data+dataLen+patLen-1.
+                const uint8_t* const lastBlock = data + dataLen - VW;
+
+                const uint8_t* first = data;
+                uint32_t done = 0; // Mask of positions in the current block which were already checked.
+                while(true) {
+                    const u8x16_t m = (u8x16_t)((vload(first) == vf) & (vload(first + patLen - 1) == vl));
+                    // Cheap check for any candidate before extracting the positions.
+                    const u64x2_t w = (u64x2_t)m;
+                    uint32_t bits = ((w[0] | w[1]) != 0) ? (lane_mask(m) & ~done) : 0;
+
+                    while(bits != 0) {
+                        const uint8_t* const s = first + __builtin_ctz(bits);
+                        if(cmpLen == 0 || cmp8(s+1,pat1,cmpLen) >= cmpLen) {
+                            return s;
+                        }
+                        bits &= bits - 1;
+                    }
+
+                    if(first >= lastBlock) {
+                        return nullptr;
+                    }
+                    first += VW;
+                    if(first > lastBlock) {
+                        done = (1u << (first - lastBlock)) - 1;
+                        first = lastBlock;
+                    }
+                }
+            }
+
+            #if defined(__x86_64__) || defined(__i386__)
+            /**
+             * @brief SSE2 pattern search. Like the S3's SIMD variant, this compares 16 bytes at a time
+             * against the first and the last byte of \p pattern and only looks at the remaining bytes
+             * of a candidate if both match.
+             *
+             * @param pattern start of pattern to search for
+             * @param patLen length of pattern to search for
+             * @param data start of data to search
+             * @param dataLen length of data to search
+             * @return first start of pattern in data, or \c nullptr if not found
+             */
+            static const uint8_t* __attribute__((target("sse2"))) find_pattern_sse2(const uint8_t* const pattern, const uint32_t patLen, const uint8_t* const data, const uint32_t dataLen) noexcept {
+                constexpr uint32_t VW = sizeof(__m128i);
+
+                if(dataLen < VW) {
+                    return find_pattern_scalar(pattern, patLen, data, dataLen);
+                }
+
+                const __m128i vf = _mm_set1_epi8((char)pattern[0]);
+                const __m128i vl = _mm_set1_epi8((char)pattern[patLen-1]);
+
+                const uint8_t* const pat1 = pattern+1;
+                // We won't need to compare the first and the last byte of pattern a second time.
+                const uint32_t cmpLen = patLen - std::min(patLen,(uint32_t)2);
+
+                // The last block is re-aligned to end exactly at the end of data, so that we never
+                // read beyond data+dataLen+patLen-1.
+                const uint8_t* const lastBlock = data + dataLen - VW;
+
+                const uint8_t* first = data;
+                uint32_t done = 0; // Mask of positions in the current block which were already checked.
+                while(true) {
+                    const __m128i f = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)first), vf);
+                    const __m128i l = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(first + patLen - 1)), vl);
+                    uint32_t bits = (uint32_t)_mm_movemask_epi8(_mm_and_si128(f,l)) & ~done;
+
+                    while(bits != 0) {
+                        const uint8_t* const s = first + __builtin_ctz(bits);
+                        if(cmpLen == 0 || cmp8(s+1,pat1,cmpLen) >= cmpLen) {
+                            return s;
+                        }
+                        bits &= bits - 1;
+                    }
+
+                    if(first >= lastBlock) {
+                        return nullptr;
+                    }
+                    first += VW;
+                    if(first > lastBlock) {
+                        done = (1u << (first - lastBlock)) - 1;
+                        first = lastBlock;
+                    }
+                }
+            }
+
+            /**
+             * @brief AVX2 variant of ::find_pattern_sse2(), comparing 32 bytes at a time.
+             * Only call this if the CPU supports AVX2, see ::cpu_has_avx2().
+             *
+             * @param pattern start of pattern to search for
+             * @param patLen length of pattern to search for
+             * @param data start of data to search
+             * @param dataLen length of data to search
+             * @return first start of pattern in data, or \c nullptr if not found
+             */
+            static const uint8_t* __attribute__((target("avx2"))) find_pattern_avx2(const uint8_t* const pattern, const uint32_t patLen, const uint8_t* const data, const uint32_t dataLen) noexcept {
+                constexpr uint32_t VW = sizeof(__m256i);
+
+                if(dataLen < VW) {
+                    return find_pattern_sse2(pattern, patLen, data, dataLen);
+                }
+
+                const __m256i vf = _mm256_set1_epi8((char)pattern[0]);
+                const __m256i vl = _mm256_set1_epi8((char)pattern[patLen-1]);
+
+                const uint8_t* const pat1 = pattern+1;
+                const uint32_t cmpLen = patLen - std::min(patLen,(uint32_t)2);
+
+                const uint8_t* const lastBlock = data + dataLen - VW;
+
+                const uint8_t* first = data;
+                uint32_t done = 0;
+                while(true) {
+                    const __m256i f = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)first), vf);
+                    const __m256i l = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)(first + patLen - 1)), vl);
+                    uint32_t bits = (uint32_t)_mm256_movemask_epi8(_mm256_and_si256(f,l)) & ~done;
+
+                    while(bits != 0) {
+                        const uint8_t* const s = first + __builtin_ctz(bits);
+                        if(cmpLen == 0 || cmp8(s+1,pat1,cmpLen) >= cmpLen) {
+                            return s;
+                        }
+                        bits &= bits - 1;
+                    }
+
+                    if(first >= lastBlock) {
+                        return nullptr;
+                    }
+                    first += VW;
+                    if(first > lastBlock) {
+                        done = (1u << (first - lastBlock)) - 1;
+                        first = lastBlock;
+                    }
+                }
+            }
+
+            /**
+             * @brief Checks (once, via \c cpuid) if the CPU we're running on supports AVX2.
+             *
+             * @return true if AVX2 instructions can be used
+             */
+            static bool cpu_has_avx2() noexcept {
+                static const bool avx2 = [](){
+                    __builtin_cpu_init();
+                    return __builtin_cpu_supports("avx2") != 0;
+                }();
+                return Arch::X86_AVX2 || avx2;
+            }
+            #endif
+
+
             /**
              * @brief Searches \p data for the first occurence of a \p pattern.
-             * On ESP32-S3 targets, this uses SIMD instructions; delegates to ::find_pattern_scalar() on other targets.
+             * On ESP32-S3 targets, this uses SIMD instructions; on x86 it uses SSE2 or, if the CPU supports it,
+             * AVX2; other targets with vector units use ::find_pattern_vec() (see Arch::VECTOR_EXT), the
+             * rest delegates to ::find_pattern_scalar().
              *
              * @param pattern start of pattern to search for
              * @param patLen length of pattern to search for
@@ -817,6 +1063,18 @@ namespace heatshrink {
                     } while(first < flimit);
                     return nullptr;
 
+                } else
+                #if defined(__x86_64__) || defined(__i386__)
+                if constexpr (Arch::X86_SSE2) {
+                    if(cpu_has_avx2()) {
+                        return find_pattern_avx2(pattern, patLen, data, dataLen);
+                    } else {
+                        return find_pattern_sse2(pattern, patLen, data, dataLen);
+                    }
+                } else
+                #endif
+                if constexpr (Arch::VECTOR_EXT) {
+                    return find_pattern_vec(pattern, patLen, data, dataLen);
                 } else {
                     return find_pattern_scalar(pattern, patLen, data, dataLen);
                 }
@@ -824,19 +1082,28 @@ namespace heatshrink {
             }
 
             /**
-             * @brief Searches \p data for the longest prefix of \p pattern that can be found.
+             * @brief Searches \p data for the longest prefix of \p pattern by repeated
+             * ::find_pattern() scans: after every match found, the scan restarts behind it with a
+             * pattern one byte longer than that match.
+             * This is the variant used where there is no single-sweep one (ESP32-S3, scalar targets).
              *
              * @param pattern
              * @param patLen length of the pattern; must be >= 2
              * @param data
              * @param dataLen
+             * @param maxMatches stop after this many successively longer matches
+             * @param goodLen a match at least this long ends the search
+             * @tparam SCALAR scan with ::find_pattern_scalar() instead of ::find_pattern()
              * @return a std::span of the match found in data, or an empty std::span if no prefix was found.
              */
-            static byte_span find_longest_match(
+            template<bool SCALAR = false>
+            static byte_span find_longest_match_rescan(
                 const uint8_t* const pattern,
                 const uint32_t patLen,
                 const uint8_t* data,
-                uint32_t dataLen) noexcept {
+                uint32_t dataLen,
+                uint32_t maxMatches = UINT32_MAX,
+                const uint32_t goodLen = UINT32_MAX) noexcept {
 
                 const uint8_t* bestMatch {nullptr};
                 uint32_t matchLen {0};
@@ -847,7 +1114,11 @@ namespace heatshrink {
                     const uint8_t* match;
                     uint32_t searchLen = 2;
                     do {
-                        match = find_pattern(pattern, searchLen, data, dataLen);
+                        if constexpr (SCALAR) {
+                            match = find_pattern_scalar(pattern, searchLen, data, dataLen);
+                        } else {
+                            match = find_pattern(pattern, searchLen, data, dataLen);
+                        }
                         if(match) {
                             bestMatch = match;
                             matchLen = searchLen;
@@ -861,13 +1132,678 @@ namespace heatshrink {
 
                             searchLen = matchLen+1; // Next match must beat the current one.
                         }
-                    } while(match && searchLen <= patLen && data < end);
+                    } while(match && searchLen <= patLen && data < end &&
+                        matchLen < goodLen && --maxMatches != 0);
                 }
 
                 return byte_span {bestMatch,matchLen};
 
             }
 
+        private:
+            /**
+             * @brief Checks one candidate of a single-sweep search, i.e. a position whose first byte
+             * matches \p pattern. Keeps it in \p best / \p bestLen if it is longer than the best
+             * match so far.
+             *
+             * @return true if the search can stop
+             */
+            static bool __attribute__((always_inline)) sweep_candidate(const uint8_t* const s,
+                const uint8_t* const pattern, const uint32_t patLen,
+                const uint8_t*& best, uint32_t& bestLen,
+                uint32_t& maxMatches, const uint32_t goodLen) noexcept {
+
+                // The candidate filter may be from before the last improvement; a longer match must
+                // also have pattern[bestLen] in common.
+                const uint32_t li = std::max(bestLen, (uint32_t)1);
+                if(s[li] != pattern[li]) {
+                    return false;
+                }
+                const uint32_t len = 1 + cmp(s+1, pattern+1, patLen-1);
+                if(len > bestLen) {
+                    best = s;
+                    bestLen = len;
+                    return len >= patLen || len >= goodLen || --maxMatches == 0;
+                }
+                return false;
+            }
+
+        public:
+
+            /**
+             * @brief Single-sweep search for the longest prefix of \p pattern in \p data, using
+             * GCC's vector extensions: one traversal of \p data, 16 bytes at a time, in which
+             * every position that matches the first byte of \p pattern and the byte a longer match
+             * needs (pattern[bestLen]) is extended with ::cmp(). Returns the same match as
+             * ::find_longest_match_rescan() (the first of the longest), without rescanning \p data
+             * after every improvement.
+             *
+             * @param pattern
+             * @param patLen length of the pattern; must be >= 2
+             * @param data
+             * @param dataLen
+             * @param maxMatches stop after this many successively longer matches
+             * @param goodLen a match at least this long ends the search
+             * @return a std::span of the match found in data, or an empty std::span if no prefix was found.
+             */
+            static byte_span find_longest_match_vec(
+                const uint8_t* const pattern,
+                const uint32_t patLen,
+                const uint8_t* const data,
+                const uint32_t dataLen,
+                uint32_t maxMatches = UINT32_MAX,
+                const uint32_t goodLen = UINT32_MAX) noexcept {
+                constexpr uint32_t VW = sizeof(u8x16_t);
+
+                if(dataLen < VW) {
+                    return find_longest_match_rescan(pattern, patLen, data, dataLen, maxMatches, goodLen);
+                }
+
+                const uint8_t* best {nullptr};
+                uint32_t bestLen {0};
+
+                const u8x16_t vf = u8x16_t{} + pattern[0];
+                uint32_t li = 1; // Index of the second byte every candidate must have in common with pattern.
+                u8x16_t vl = u8x16_t{} + pattern[li];
+
+                // As in ::find_pattern_vec(), the last block ends exactly at the end of data, and
+                // loads never go beyond data+dataLen+patLen-1.
+                const uint8_t* const lastBlock = data + dataLen - VW;
+
+                const uint8_t* first = data;
+                uint32_t done = 0;
+                while(true) {
+                    const u8x16_t m = (u8x16_t)((vload(first) == vf) & (vload(first + li) == vl));
+                    const u64x2_t w = (u64x2_t)m;
+                    uint32_t bits = ((w[0] | w[1]) != 0) ? (lane_mask(m) & ~done) : 0;
+
+                    if(bits != 0) {
+                        do {
+                            if(sweep_candidate(first + __builtin_ctz(bits), pattern, patLen, best, bestLen, maxMatches, goodLen)) {
+                                return byte_span {best,bestLen};
+                            }
+                            bits &= bits - 1;
+                        } while(bits != 0);
+                        if(bestLen > li) {
+                            li = bestLen;
+                            vl = u8x16_t{} + pattern[li];
+                        }
+                    }
+
+                    if(first >= lastBlock) {
+                        return byte_span {best,bestLen};
+                    }
+                    first += VW;
+                    if(first > lastBlock) {
+                        done = (1u << (first - lastBlock)) - 1;
+                        first = lastBlock;
+                    }
+                }
+            }
+
+            #if defined(__x86_64__) || defined(__i386__)
+            /**
+             * @brief SSE2 variant of ::find_longest_match_vec().
+             */
+            static byte_span __attribute__((target("sse2"))) find_longest_match_sse2(
+                const uint8_t* const pattern,
+                const uint32_t patLen,
+                const uint8_t* const data,
+                const uint32_t dataLen,
+                uint32_t maxMatches = UINT32_MAX,
+                const uint32_t goodLen = UINT32_MAX) noexcept {
+                constexpr uint32_t VW = sizeof(__m128i);
+
+                if(dataLen < VW) {
+                    return find_longest_match_rescan(pattern, patLen, data, dataLen, maxMatches, goodLen);
+                }
+
+                const uint8_t* best {nullptr};
+                uint32_t bestLen {0};
+
+                const __m128i vf = _mm_set1_epi8((char)pattern[0]);
+                uint32_t li = 1;
+                __m128i vl = _mm_set1_epi8((char)pattern[li]);
+
+                const uint8_t* const lastBlock = data + dataLen - VW;
+
+                const uint8_t* first = data;
+                uint32_t done = 0;
+                while(true) {
+                    const __m128i f = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)first), vf);
+                    const __m128i l = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(first + li)), vl);
+                    uint32_t bits = (uint32_t)_mm_movemask_epi8(_mm_and_si128(f,l)) & ~done;
+
+                    if(bits != 0) {
+                        do {
+                            if(sweep_candidate(first + __builtin_ctz(bits), pattern, patLen, best, bestLen, maxMatches, goodLen)) {
+                                return byte_span {best,bestLen};
+                            }
+                            bits &= bits - 1;
+                        } while(bits != 0);
+                        if(bestLen > li) {
+                            li = bestLen;
+                            vl = _mm_set1_epi8((char)pattern[li]);
+                        }
+                    }
+
+                    if(first >= lastBlock) {
+                        return byte_span {best,bestLen};
+                    }
+                    first += VW;
+                    if(first > lastBlock) {
+                        done = (1u << (first - lastBlock)) - 1;
+                        first = lastBlock;
+                    }
+                }
+            }
+
+            /**
+             * @brief AVX2 variant of ::find_longest_match_vec(), 32 bytes at a time.
+             * Only call this if the CPU supports AVX2, see ::cpu_has_avx2().
+             */
+            static byte_span __attribute__((target("avx2"))) find_longest_match_avx2(
+                const uint8_t* const pattern,
+                const uint32_t patLen,
+                const uint8_t* const data,
+                const uint32_t dataLen,
+                uint32_t maxMatches = UINT32_MAX,
+                const uint32_t goodLen = UINT32_MAX) noexcept {
+                constexpr uint32_t VW = sizeof(__m256i);
+
+                if(dataLen < VW) {
+                    return find_longest_match_sse2(pattern, patLen, data, dataLen, maxMatches, goodLen);
+                }
+
+                const uint8_t* best {nullptr};
+                uint32_t bestLen {0};
+
+                const __m256i vf = _mm256_set1_epi8((char)pattern[0]);
+                uint32_t li = 1;
+                __m256i vl = _mm256_set1_epi8((char)pattern[li]);
+
+                const uint8_t* const lastBlock = data + dataLen - VW;
+
+                const uint8_t* first = data;
+                uint32_t done = 0;
+                while(true) {
+                    const __m256i f = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)first), vf);
+                    const __m256i l = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)(first + li)), vl);
+                    uint32_t bits = (uint32_t)_mm256_movemask_epi8(_mm256_and_si256(f,l)) & ~done;
+
+                    if(bits != 0) {
+                        do {
+                            if(sweep_candidate(first + __builtin_ctz(bits), pattern, patLen, best, bestLen, maxMatches, goodLen)) {
+                                return byte_span {best,bestLen};
+                            }
+                            bits &= bits - 1;
+                        } while(bits != 0);
+                        if(bestLen > li) {
+                            li = bestLen;
+                            vl = _mm256_set1_epi8((char)pattern[li]);
+                        }
+                    }
+
+                    if(first >= lastBlock) {
+                        return byte_span {best,bestLen};
+                    }
+                    first += VW;
+                    if(first > lastBlock) {
+                        done = (1u << (first - lastBlock)) - 1;
+                        first = lastBlock;
+                    }
+                }
+            }
+            #endif
+
+            /**
+             * @brief Searches \p data for the longest prefix of \p pattern that can be found.
+             * On x86 and targets with vector units (see Arch::VECTOR_EXT), this is a single sweep over
+             * \p data; elsewhere (incl. the ESP32-S3, whose ::find_pattern() is hand-written), it
+             * delegates to ::find_longest_match_rescan(). Either way, the result is the first of the
+             * longest matches.
+             *
+             * @param pattern
+             * @param patLen length of the pattern; must be >= 2
+             * @param data
+             * @param dataLen
+             * @param maxMatches stop after this many successively longer matches
+             * @param goodLen a match at least this long ends the search
+             * @return a std::span of the match found in data, or an empty std::span if no prefix was found.
+             */
+            static byte_span find_longest_match(
+                const uint8_t* const pattern,
+                const uint32_t patLen,
+                const uint8_t* data,
+                uint32_t dataLen,
+                uint32_t maxMatches = UINT32_MAX,
+                const uint32_t goodLen = UINT32_MAX) noexcept {
+
+                if constexpr (Arch::ESP32S3) {
+                    return find_longest_match_rescan(pattern, patLen, data, dataLen, maxMatches, goodLen);
+                } else
+                #if defined(__x86_64__) || defined(__i386__)
+                if constexpr (Arch::X86_SSE2) {
+                    if(cpu_has_avx2()) {
+                        return find_longest_match_avx2(pattern, patLen, data, dataLen, maxMatches, goodLen);
+                    } else {
+                        return find_longest_match_sse2(pattern, patLen, data, dataLen, maxMatches, goodLen);
+                    }
+                } else
+                #endif
+                if constexpr (Arch::VECTOR_EXT) {
+                    return find_longest_match_vec(pattern, patLen, data, dataLen, maxMatches, goodLen);
+                } else {
+                    return find_longest_match_rescan(pattern, patLen, data, dataLen, maxMatches, goodLen);
+                }
+            }
+
+            /**
+             * @brief How many bytes ::find_longest_match() may read beyond
+             * \p data + \p dataLen + \p patLen - 1, i.e. the slack a buffer needs after the
+             * pattern. The ESP32-S3's ::find_pattern() loads aligned 16-byte blocks up to 47 bytes
+             * ahead; the other kernels read nothing beyond it.
+             */
+            static constexpr uint32_t MAX_OVERREAD = Arch::ESP32S3 ? 64 : 0;
+
+            /**
+             * @brief Like ::find_longest_match(), but never reads beyond \p pattern + \p patLen,
+             * for searches near the end of a buffer without ::MAX_OVERREAD bytes of slack. Uses
+             * the scalar ::find_longest_match_rescan() where the fast path would read further.
+             */
+            static byte_span find_longest_match_bounded(
+                const uint8_t* const pattern,
+                const uint32_t patLen,
+                const uint8_t* data,
+                uint32_t dataLen,
+                uint32_t maxMatches = UINT32_MAX,
+                const uint32_t goodLen = UINT32_MAX) noexcept {
+                if constexpr (MAX_OVERREAD != 0) {
+                    return find_longest_match_rescan<true>(pattern, patLen, data, dataLen, maxMatches, goodLen);
+                } else {
+                    return find_longest_match(pattern, patLen, data, dataLen, maxMatches, goodLen);
+                }
+            }
+
+            /**
+             * @brief Scalar backward pattern search, i.e. from the end of \p data to its start.
+             *
+             * @param pattern start of pattern to search for
+             * @param patLen length of pattern to search for; must be >= 1
+             * @param data start of data to search
+             * @param dataLen length of data to search
+             * @return last start of pattern in data, or \c nullptr if not found
+             */
+            static const uint8_t* find_pattern_backward_scalar(const uint8_t* const pattern, const uint32_t patLen, const uint8_t* const data, const uint32_t dataLen) noexcept {
+                const uint8_t f = pattern[0];
+                const uint8_t l = pattern[patLen-1];
+                for(const uint8_t* s = data + dataLen; s-- != data;) {
+                    if(s[0] == f && s[patLen-1] == l) {
+                        if(patLen <= 2 || cmp8(s+1,pattern+1,patLen-2) >= patLen-2) {
+                            return s;
+                        }
+                    }
+                }
+                return nullptr;
+            }
+
+            /**
+             * @brief Backward variant of ::find_pattern_vec(): the same first-byte/last-byte
+             * candidate filter, 16 bytes at a time, starting at the end of \p data.
+             *
+             * @param pattern start of pattern to search for
+             * @param patLen length of pattern to search for; must be >= 1
+             * @param data start of data to search
+             * @param dataLen length of data to search
+             * @return last start of pattern in data, or \c nullptr if not found
+             */
+            static const uint8_t* find_pattern_backward_vec(const uint8_t* const pattern, const uint32_t patLen, const uint8_t* const data, const uint32_t dataLen) noexcept {
+                constexpr uint32_t VW = sizeof(u8x16_t);
+
+                if(dataLen < VW) {
+                    return find_pattern_backward_scalar(pattern, patLen, data, dataLen);
+                }
+
+                const u8x16_t vf = u8x16_t{} + pattern[0];
+                const u8x16_t vl = u8x16_t{} + pattern[patLen-1];
+
+                const uint8_t* const pat1 = pattern+1;
+                const uint32_t cmpLen = patLen - std::min(patLen,(uint32_t)2);
+
+                // The first block ends exactly at the end of data; the last one is re-aligned to
+                // start exactly at data.
+                const uint8_t* first = data + dataLen - VW;
+                uint32_t keep = (1u << VW) - 1; // Mask of positions in the current block not checked yet.
+                while(true) {
+                    const u8x16_t m = (u8x16_t)((vload(first) == vf) & (vload(first + patLen - 1) == vl));
+                    const u64x2_t w = (u64x2_t)m;
+                    uint32_t bits = ((w[0] | w[1]) != 0) ? (lane_mask(m) & keep) : 0;
+
+                    while(bits != 0) {
+                        const uint32_t i = 31 - __builtin_clz(bits);
+                        const uint8_t* const s = first + i;
+                        if(cmpLen == 0 || cmp8(s+1,pat1,cmpLen) >= cmpLen) {
+                            return s;
+                        }
+                        bits &= ~(1u << i);
+                    }
+
+                    if(first == data) {
+                        return nullptr;
+                    }
+                    if((uint32_t)(first - data) < VW) {
+                        keep = (1u << (first - data)) - 1;
+                        first = data;
+                    } else {
+                        first -= VW;
+                    }
+                }
+            }
+
+            /**
+             * @brief Searches \p data backward for the last occurence of a \p pattern, i.e. the
+             * one nearest to the end of \p data.
+             * Targets with vector units (see Arch::VECTOR_EXT, incl. x86) use
+             * ::find_pattern_backward_vec(), the rest (incl. the ESP32-S3, where the PIE's loads
+             * only increment) ::find_pattern_backward_scalar().
+             *
+             * @param pattern start of pattern to search for
+             * @param patLen length of pattern to search for; must be >= 1
+             * @param data start of data to search
+             * @param dataLen length of data to search
+             * @return last start of pattern in data, or \c nullptr if not found
+             */
+            static const uint8_t* find_pattern_backward(const uint8_t* const pattern, const uint32_t patLen, const uint8_t* data, const uint32_t dataLen) noexcept {
+                if constexpr (Arch::VECTOR_EXT) {
+                    return find_pattern_backward_vec(pattern, patLen, data, dataLen);
+                } else {
+                    return find_pattern_backward_scalar(pattern, patLen, data, dataLen);
+                }
+            }
+
+            /**
+             * @brief Scalar nearest-first variant of ::find_longest_match(): a single sweep from the
+             * end of \p data to its start, which returns the last (nearest) of the longest matches.
+             *
+             * @param pattern
+             * @param patLen length of the pattern; must be >= 2
+             * @param data
+             * @param dataLen
+             * @param maxMatches stop after this many successively longer matches
+             * @param goodLen a match at least this long ends the search
+             * @return a std::span of the match found in data, or an empty std::span if no prefix was found.
+             */
+            static byte_span find_longest_match_backward_scalar(
+                const uint8_t* const pattern,
+                const uint32_t patLen,
+                const uint8_t* const data,
+                const uint32_t dataLen,
+                uint32_t maxMatches = UINT32_MAX,
+                const uint32_t goodLen = UINT32_MAX) noexcept {
+
+                const uint8_t* best {nullptr};
+                uint32_t bestLen {0};
+
+                const uint8_t f = pattern[0];
+                for(const uint8_t* s = data + dataLen; s-- != data;) {
+                    if(s[0] == f &&
+                        sweep_candidate(s, pattern, patLen, best, bestLen, maxMatches, goodLen)) {
+                        break;
+                    }
+                }
+                return byte_span {best,bestLen};
+            }
+
+            /**
+             * @brief Nearest-first variant of ::find_longest_match_vec(), sweeping from the end of
+             * \p data to its start, 16 bytes at a time.
+             *
+             * @param pattern
+             * @param patLen length of the pattern; must be >= 2
+             * @param data
+             * @param dataLen
+             * @param maxMatches stop after this many successively longer matches
+             * @param goodLen a match at least this long ends the search
+             * @return a std::span of the match found in data, or an empty std::span if no prefix was found.
+             */
+            static byte_span find_longest_match_backward_vec(
+                const uint8_t* const pattern,
+                const uint32_t patLen,
+                const uint8_t* const data,
+                const uint32_t dataLen,
+                uint32_t maxMatches = UINT32_MAX,
+                const uint32_t goodLen = UINT32_MAX) noexcept {
+                constexpr uint32_t VW = sizeof(u8x16_t);
+
+                if(dataLen < VW) {
+                    return find_longest_match_backward_scalar(pattern, patLen, data, dataLen, maxMatches, goodLen);
+                }
+
+                const uint8_t* best {nullptr};
+                uint32_t bestLen {0};
+
+                const u8x16_t vf = u8x16_t{} + pattern[0];
+                uint32_t li = 1;
+                u8x16_t vl = u8x16_t{} + pattern[li];
+
+                const uint8_t* first = data + dataLen - VW;
+                uint32_t keep = (1u << VW) - 1;
+                while(true) {
+                    const u8x16_t m = (u8x16_t)((vload(first) == vf) & (vload(first + li) == vl));
+                    const u64x2_t w = (u64x2_t)m;
+                    uint32_t bits = ((w[0] | w[1]) != 0) ? (lane_mask(m) & keep) : 0;
+
+                    if(bits != 0) {
+                        do {
+                            const uint32_t i = 31 - __builtin_clz(bits);
+                            if(sweep_candidate(first + i, pattern, patLen, best, bestLen, maxMatches, goodLen)) {
+                                return byte_span {best,bestLen};
+                            }
+                            bits &= ~(1u << i);
+                        } while(bits != 0);
+                        if(bestLen > li) {
+                            li = bestLen;
+                            vl = u8x16_t{} + pattern[li];
+                        }
+                    }
+
+                    if(first == data) {
+                        return byte_span {best,bestLen};
+                    }
+                    if((uint32_t)(first - data) < VW) {
+                        keep = (1u << (first - data)) - 1;
+                        first = data;
+                    } else {
+                        first -= VW;
+                    }
+                }
+            }
+
+            #if defined(__x86_64__) || defined(__i386__)
+            /**
+             * @brief SSE2 variant of ::find_longest_match_backward_vec().
+             */
+            static byte_span __attribute__((target("sse2"))) find_longest_match_backward_sse2(
+                const uint8_t* const pattern,
+                const uint32_t patLen,
+                const uint8_t* const data,
+                const uint32_t dataLen,
+                uint32_t maxMatches = UINT32_MAX,
+                const uint32_t goodLen = UINT32_MAX) noexcept {
+                constexpr uint32_t VW = sizeof(__m128i);
+
+                if(dataLen < VW) {
+                    return find_longest_match_backward_scalar(pattern, patLen, data, dataLen, maxMatches, goodLen);
+                }
+
+                const uint8_t* best {nullptr};
+                uint32_t bestLen {0};
+
+                const __m128i vf = _mm_set1_epi8((char)pattern[0]);
+                uint32_t li = 1;
+                __m128i vl = _mm_set1_epi8((char)pattern[li]);
+
+                const uint8_t* first = data + dataLen - VW;
+                uint32_t keep = (1u << VW) - 1;
+                while(true) {
+                    const __m128i f = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)first), vf);
+                    const __m128i l = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(first + li)), vl);
+                    uint32_t bits = (uint32_t)_mm_movemask_epi8(_mm_and_si128(f,l)) & keep;
+
+                    if(bits != 0) {
+                        do {
+                            const uint32_t i = 31 - __builtin_clz(bits);
+                            if(sweep_candidate(first + i, pattern, patLen, best, bestLen, maxMatches, goodLen)) {
+                                return byte_span {best,bestLen};
+                            }
+                            bits &= ~(1u << i);
+                        } while(bits != 0);
+                        if(bestLen > li) {
+                            li = bestLen;
+                            vl = _mm_set1_epi8((char)pattern[li]);
+                        }
+                    }
+
+                    if(first == data) {
+                        return byte_span {best,bestLen};
+                    }
+                    if((uint32_t)(first - data) < VW) {
+                        keep = (1u << (first - data)) - 1;
+                        first = data;
+                    } else {
+                        first -= VW;
+                    }
+                }
+            }
+
+            /**
+             * @brief AVX2 variant of ::find_longest_match_backward_vec(), 32 bytes at a time.
+             * Only call this if the CPU supports AVX2, see ::cpu_has_avx2().
+             */
+            static byte_span __attribute__((target("avx2"))) find_longest_match_backward_avx2(
+                const uint8_t* const pattern,
+                const uint32_t patLen,
+                const uint8_t* const data,
+                const uint32_t dataLen,
+                uint32_t maxMatches = UINT32_MAX,
+                const uint32_t goodLen = UINT32_MAX) noexcept {
+                constexpr uint32_t VW = sizeof(__m256i);
+
+                if(dataLen < VW) {
+                    return find_longest_match_backward_sse2(pattern, patLen, data, dataLen, maxMatches, goodLen);
+                }
+
+                const uint8_t* best {nullptr};
+                uint32_t bestLen {0};
+
+                const __m256i vf = _mm256_set1_epi8((char)pattern[0]);
+                uint32_t li = 1;
+                __m256i vl = _mm256_set1_epi8((char)pattern[li]);
+
+                const uint8_t* first = data + dataLen - VW;
+                uint32_t keep = UINT32_MAX;
+                while(true) {
+                    const __m256i f = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)first), vf);
+                    const __m256i l = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)(first + li)), vl);
+                    uint32_t bits = (uint32_t)_mm256_movemask_epi8(_mm256_and_si256(f,l)) & keep;
+
+                    if(bits != 0) {
+                        do {
+                            const uint32_t i = 31 - __builtin_clz(bits);
+                            if(sweep_candidate(first + i, pattern, patLen, best, bestLen, maxMatches, goodLen)) {
+                                return byte_span {best,bestLen};
+                            }
+                            bits &= ~(1u << i);
+                        } while(bits != 0);
+                        if(bestLen > li) {
+                            li = bestLen;
+                            vl = _mm256_set1_epi8((char)pattern[li]);
+                        }
+                    }
+
+                    if(first == data) {
+                        return byte_span {best,bestLen};
+                    }
+                    if((uint32_t)(first - data) < VW) {
+                        keep = (1u << (first - data)) - 1;
+                        first = data;
+                    } else {
+                        first -= VW;
+                    }
+                }
+            }
+            #endif
+
+            /**
+             * @brief Searches \p data for the longest prefix of \p pattern, nearest first: of
+             * several longest matches, this returns the last one in \p data, i.e. the one with the
+             * smallest offset from \p pattern, and on local repetition the search tends to end
+             * early. Uses SSE2 or AVX2 on x86, else dispatches like ::find_pattern_backward().
+             *
+             * @param pattern
+             * @param patLen length of the pattern; must be >= 2
+             * @param data
+             * @param dataLen
+             * @param maxMatches stop after this many successively longer matches
+             * @param goodLen a match at least this long ends the search
+             * @return a std::span of the match found in data, or an empty std::span if no prefix was found.
+             */
+            static byte_span find_longest_match_backward(
+                const uint8_t* const pattern,
+                const uint32_t patLen,
+                const uint8_t* data,
+                uint32_t dataLen,
+                uint32_t maxMatches = UINT32_MAX,
+                const uint32_t goodLen = UINT32_MAX) noexcept {
+                #if defined(__x86_64__) || defined(__i386__)
+                if constexpr (Arch::X86_SSE2) {
+                    if(cpu_has_avx2()) {
+                        return find_longest_match_backward_avx2(pattern, patLen, data, dataLen, maxMatches, goodLen);
+                    } else {
+                        return find_longest_match_backward_sse2(pattern, patLen, data, dataLen, maxMatches, goodLen);
+                    }
+                } else
+                #endif
+                if constexpr (Arch::VECTOR_EXT) {
+                    return find_longest_match_backward_vec(pattern, patLen, data, dataLen, maxMatches, goodLen);
+                } else {
+                    return find_longest_match_backward_scalar(pattern, patLen, data, dataLen, maxMatches, goodLen);
+                }
+            }
+
+            /**
+             * @brief Finds the longest prefix of \p pattern that starts 1 to \p maxDist bytes
+             * before it, i.e. overlaps the pattern: a run of one byte, or of a pattern of up to
+             * \p maxDist bytes. Tries one ::cmp() per distance, nearest first, and returns the
+             * nearest of several longest matches.
+             *
+             * @param pattern
+             * @param patLen length of the pattern
+             * @param maxDist max. distance to try; the \p maxDist bytes before \p pattern must be readable
+             * @return a std::span of the match found before pattern, or an empty std::span if no prefix was found.
+             */
+            static byte_span find_run(
+                const uint8_t* const pattern,
+                const uint32_t patLen,
+                const uint32_t maxDist = 4) noexcept {
+                const uint8_t* match = nullptr;
+                uint32_t bestLen = 0;
+                for(uint32_t dist = 1; dist <= maxDist; ++dist) {
+                    const uint8_t* const s = pattern - dist;
+                    if(s[0] == pattern[0]) {
+                        const uint32_t len = cmp(s, pattern, patLen);
+                        if(len > bestLen) {
+                            match = s;
+                            bestLen = len;
+                            if(len >= patLen) {
+                                break;
+                            }
+                        }
+                    }
+                }
+                return byte_span {match, bestLen};
+            }
+
     };
 
 } // namespace heatshrink
\ No newline at end of file
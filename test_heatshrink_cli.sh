@@ -0,0 +1,108 @@
+#!/bin/sh
+
+# Round trips through the heatshrink CLI, mainly of the framed container
+# (-j): multi-threaded compression and decompression, heatshrink+ (-p) and
+# dictionary (-D) blocks, and output into regular files (where blocks are
+# written at their offsets) as well as pipes and appended files (where they
+# are written in order).
+
+HS=${HS:-./heatshrink}
+TMP=$(mktemp -d) || exit 1
+trap 'rm -rf "${TMP}"' EXIT
+
+pass=0
+fail=0
+
+ok() {
+    pass=$((pass + 1))
+}
+
+ng() {
+    printf "FAIL: %s\n" "$1"
+    fail=$((fail + 1))
+}
+
+# Check that OUT matches IN; NAME describes the case.
+check() {
+    if cmp -s "$2" "$3"; then ok; else ng "$1"; fi
+}
+
+# Input spanning several blocks (1 MB each), with text and runs of zeros
+# so that blocks compress differently.
+IN=${TMP}/in
+for i in 1 2 3 4 5 6 7 8 9 10; do
+    cat *.c *.cpp *.h
+    head -c 100000 /dev/zero
+done > "${IN}"
+head -c 3000 README.md > "${TMP}/dict"
+: > "${TMP}/empty"
+
+for J in 1 3 0; do
+    for WL in "-w 8 -l 4" "-w 12 -l 5"; do
+        name="-j ${J} ${WL}"
+        ${HS} -e -j ${J} ${WL} "${IN}" "${TMP}/c" || ng "${name}: encode"
+        ${HS} -d -j ${J} ${WL} "${TMP}/c" "${TMP}/out" || ng "${name}: decode"
+        check "${name}: file" "${IN}" "${TMP}/out"
+
+        # Through a pipe, and into a regular file via stdout at an offset
+        ${HS} -d -j ${J} "${TMP}/c" | cat > "${TMP}/out"
+        check "${name}: pipe" "${IN}" "${TMP}/out"
+        { printf "prefix"; ${HS} -d -j ${J} "${TMP}/c"; printf "suffix"; } > "${TMP}/out"
+        { printf "prefix"; cat "${IN}"; printf "suffix"; } > "${TMP}/exp"
+        check "${name}: stdout at an offset" "${TMP}/exp" "${TMP}/out"
+        printf "prefix" > "${TMP}/out"
+        ${HS} -d -j ${J} "${TMP}/c" >> "${TMP}/out"
+        { printf "prefix"; cat "${IN}"; } > "${TMP}/exp"
+        check "${name}: appended" "${TMP}/exp" "${TMP}/out"
+    done
+done
+
+# Framed output does not depend on the number of threads
+${HS} -e -j 1 "${IN}" "${TMP}/c1"
+${HS} -e -j 4 "${IN}" "${TMP}/c4"
+check "-j 1 vs. -j 4 output" "${TMP}/c1" "${TMP}/c4"
+
+${HS} -e -j 2 "${TMP}/empty" "${TMP}/c"
+${HS} -d -j 2 "${TMP}/c" "${TMP}/out"
+check "-j 2: empty input" "${TMP}/empty" "${TMP}/out"
+
+${HS} -e -j 2 -5 "${IN}" "${TMP}/c"
+${HS} -d -j 2 "${TMP}/c" "${TMP}/out"
+check "-j 2 -5" "${IN}" "${TMP}/out"
+
+if ${HS} -e -p "${TMP}/empty" "${TMP}/c" 2>/dev/null; then
+    ${HS} -e -j 2 -p "${IN}" "${TMP}/c"
+    ${HS} -d -j 2 "${TMP}/c" "${TMP}/out"
+    check "-j 2 -p" "${IN}" "${TMP}/out"
+else
+    printf "skipped -p (needs HEATSHRINK_32BIT)\n"
+fi
+
+# Dictionary blocks need the dictionary; other blocks ignore it
+${HS} -e -j 2 -D "${TMP}/dict" "${IN}" "${TMP}/c"
+${HS} -d -j 2 -D "${TMP}/dict" "${TMP}/c" "${TMP}/out"
+check "-j 2 -D" "${IN}" "${TMP}/out"
+if ${HS} -d -j 2 "${TMP}/c" "${TMP}/out" 2>/dev/null; then
+    ng "-j 2 -D: decoding without the dictionary should fail"
+else
+    ok
+fi
+${HS} -e -j 1 -w 8 "${IN}" "${TMP}/c"
+${HS} -d -j 1 -w 8 -D "${TMP}/dict" "${TMP}/c" "${TMP}/out"
+check "-j 1: decoding with an unused dictionary" "${IN}" "${TMP}/out"
+
+# Unframed input is rejected
+${HS} -e "${IN}" "${TMP}/c"
+if ${HS} -d -j 2 "${TMP}/c" "${TMP}/out" 2>/dev/null; then
+    ng "-d -j 2: unframed input should fail"
+else
+    ok
+fi
+
+# Unframed round trips, for comparison
+${HS} -e -w 10 -D "${TMP}/dict" "${IN}" "${TMP}/c"
+${HS} -d -w 10 -D "${TMP}/dict" "${TMP}/c" | cat > "${TMP}/out"
+check "unframed -D, pipe" "${IN}" "${TMP}/out"
+
+printf "CLI pass: %d, fail: %d\n" ${pass} ${fail}
+[ ${fail} -eq 0 ]
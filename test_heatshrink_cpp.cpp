@@ -0,0 +1,301 @@
+/* Tests for the header-only Encoder/Decoder templates in heatshrink.hpp,
+ * against each other and against the C API. */
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "heatshrink.hpp"
+#include "greatest.h"
+
+#if !HEATSHRINK_DYNAMIC_ALLOC
+#error Must set HEATSHRINK_DYNAMIC_ALLOC to 1 for the C++ test suite.
+#endif
+
+/* Only greedy matching gives the same output as the templates. */
+#define HEATSHRINK_C_API_IS_GREEDY (HEATSHRINK_32BIT && !HEATSHRINK_USE_INDEX && \
+    !HEATSHRINK_USE_HASH_CHAIN && !HEATSHRINK_LAZY_MATCHING)
+
+SUITE(templates);
+
+#if HEATSHRINK_WIDE_INDEX
+#define BUF_SIZE (192 * 1024)
+#else
+#define BUF_SIZE (64 * 1024)
+#endif
+
+static uint8_t input[BUF_SIZE];
+static uint8_t comp[2 * BUF_SIZE];
+static uint8_t comp_c[2 * BUF_SIZE];
+static uint8_t decomp[BUF_SIZE];
+
+static void fill_with_pseudorandom_letters(uint8_t *buf, uint32_t size, uint32_t seed) {
+    uint64_t rn = 9223372036854775783u; /* prime under 2^64 */
+    for (uint32_t i=0; i<size; i++) {
+        rn = rn*seed + seed;
+        buf[i] = (rn % 26) + 'a';
+    }
+}
+
+/* Runs of one byte or of a pattern of up to 5 bytes. */
+static void fill_with_pseudorandom_runs(uint8_t *buf, uint32_t size, uint32_t seed) {
+    uint64_t rn = 9223372036854775783u; /* prime under 2^64 */
+    uint32_t i = 0;
+    while (i < size) {
+        rn = rn*seed + seed;
+        const uint32_t period = 1 + (rn >> 8) % 5;
+        const uint32_t length = 1 + (rn >> 16) % 300;
+        for (uint32_t j=0; j<period && i < size; j++) {
+            rn = rn*seed + seed;
+            buf[i++] = rn >> 24;
+        }
+        for (uint32_t j=period; j<length && i < size; j++, i++) {
+            buf[i] = buf[i - period];
+        }
+    }
+}
+
+#if HEATSHRINK_WIDE_INDEX
+/* Letters, repeated from half way on, i.e. SIZE/2 bytes back. */
+static void fill_with_distant_repeat(uint8_t *buf, uint32_t size, uint32_t seed) {
+    fill_with_pseudorandom_letters(buf, size / 2, seed);
+    memcpy(&buf[size / 2], buf, size - size / 2);
+}
+#endif
+
+static bool more(HSE_poll_res res) { return res == HSER_POLL_MORE; }
+static bool more(HSD_poll_res res) { return res == HSDR_POLL_MORE; }
+static bool done(HSE_finish_res res) { return res == HSER_FINISH_DONE; }
+static bool done(HSD_finish_res res) { return res == HSDR_FINISH_DONE; }
+
+/* Sink, poll and finish through any encoder or decoder with the C++ API,
+ * polling at most CHUNK bytes at a time. Returns the output size. */
+template<typename Codec>
+static size_t run_codec(Codec& codec, const uint8_t *in, size_t in_size,
+        uint8_t *out, size_t chunk) {
+    size_t sunk = 0, polled = 0, count = 0;
+    while (sunk < in_size) {
+        codec.sink(&in[sunk], in_size - sunk, &count);
+        sunk += count;
+        while (more(codec.poll(&out[polled], chunk, &count))) {
+            polled += count;
+        }
+        polled += count;
+    }
+    while (!done(codec.finish())) {
+        codec.poll(&out[polled], chunk, &count);
+        polled += count;
+    }
+    return polled;
+}
+
+static size_t compress_c(uint8_t window_sz2, uint8_t lookahead_sz2,
+        const uint8_t *in, size_t in_size, uint8_t *out) {
+    heatshrink_encoder *hse = heatshrink_encoder_alloc(window_sz2, lookahead_sz2);
+    size_t sunk = 0, polled = 0, count = 0;
+    while (sunk < in_size) {
+        heatshrink_encoder_sink(hse, &in[sunk], in_size - sunk, &count);
+        sunk += count;
+        HSE_poll_res pres;
+        do {
+            pres = heatshrink_encoder_poll(hse, &out[polled], 512, &count);
+            polled += count;
+        } while (pres == HSER_POLL_MORE);
+    }
+    while (heatshrink_encoder_finish(hse) == HSER_FINISH_MORE) {
+        heatshrink_encoder_poll(hse, &out[polled], 512, &count);
+        polled += count;
+    }
+    heatshrink_encoder_free(hse);
+    return polled;
+}
+
+static size_t decompress_c(uint8_t window_sz2, uint8_t lookahead_sz2,
+        const uint8_t *in, size_t in_size, uint8_t *out) {
+    heatshrink_decoder *hsd = heatshrink_decoder_alloc(256, window_sz2, lookahead_sz2);
+    size_t sunk = 0, polled = 0, count = 0;
+    while (sunk < in_size) {
+        heatshrink_decoder_sink(hsd, &in[sunk], in_size - sunk, &count);
+        sunk += count;
+        HSD_poll_res pres;
+        do {
+            pres = heatshrink_decoder_poll(hsd, &out[polled], 512, &count);
+            polled += count;
+        } while (pres == HSDR_POLL_MORE);
+    }
+    while (heatshrink_decoder_finish(hsd) == HSDR_FINISH_MORE) {
+        heatshrink_decoder_poll(hsd, &out[polled], 512, &count);
+        polled += count;
+    }
+    heatshrink_decoder_free(hsd);
+    return polled;
+}
+
+/* Compress with Encoder<W,L> and check that both Decoder<W,L,IB> and the C
+ * decoder expand it, and that the C encoder expands with Decoder<W,L,IB>. */
+template<uint32_t W, uint32_t L, uint32_t IB>
+static greatest_test_res round_trip(uint32_t size, uint32_t seed, size_t chunk,
+        void (*fill)(uint8_t *, uint32_t, uint32_t) = fill_with_pseudorandom_letters) {
+    static heatshrink::Encoder<W,L> encoder;
+    static heatshrink::Decoder<W,L,IB> decoder;
+    encoder.reset();
+    decoder.reset();
+
+    fill(input, size, seed);
+    const size_t comp_sz = run_codec(encoder, input, size, comp, chunk);
+
+    memset(decomp, 0, size);
+    ASSERT_EQ(size, run_codec(decoder, comp, comp_sz, decomp, chunk));
+    ASSERT_EQ(0, memcmp(input, decomp, size));
+
+    memset(decomp, 0, size);
+    ASSERT_EQ(size, decompress_c(W, L, comp, comp_sz, decomp));
+    ASSERT_EQ(0, memcmp(input, decomp, size));
+
+    const size_t comp_c_sz = compress_c(W, L, input, size, comp_c);
+#if HEATSHRINK_C_API_IS_GREEDY
+    ASSERT_EQ(comp_c_sz, comp_sz);
+    ASSERT_EQ(0, memcmp(comp, comp_c, comp_sz));
+#endif
+    decoder.reset();
+    memset(decomp, 0, size);
+    ASSERT_EQ(size, run_codec(decoder, comp_c, comp_c_sz, decomp, chunk));
+    ASSERT_EQ(0, memcmp(input, decomp, size));
+    PASS();
+}
+
+TEST encoder_should_reject_misuse(void) {
+    heatshrink::Encoder<8,4> encoder;
+    uint8_t buf[4] = { 0 };
+    size_t count = 0;
+    ASSERT_EQ(HSER_SINK_ERROR_NULL, encoder.sink(NULL, 4, &count));
+    ASSERT_EQ(HSER_POLL_ERROR_NULL, encoder.poll(buf, 4, NULL));
+    ASSERT_EQ(HSER_POLL_ERROR_MISUSE, encoder.poll(buf, 0, &count));
+    ASSERT_EQ(HSER_FINISH_MORE, encoder.finish());
+    ASSERT_EQ(HSER_SINK_ERROR_MISUSE, encoder.sink(buf, 4, &count));
+    PASS();
+}
+
+TEST empty_input_should_finish_immediately(void) {
+    heatshrink::Encoder<8,4> encoder;
+    heatshrink::Decoder<8,4,16> decoder;
+    uint8_t buf[4];
+    size_t count = 0;
+    ASSERT_EQ(HSER_FINISH_MORE, encoder.finish());
+    ASSERT_EQ(HSER_POLL_EMPTY, encoder.poll(buf, sizeof(buf), &count));
+    ASSERT_EQ(0, count);
+    ASSERT_EQ(HSER_FINISH_DONE, encoder.finish());
+    ASSERT_EQ(HSDR_FINISH_DONE, decoder.finish());
+    PASS();
+}
+
+/* greatest's CHECK_CALL does not compile as C++. */
+#define CHECK_ROUND_TRIP(CALL)                                          \
+    do {                                                                \
+        const greatest_test_res res = CALL;                             \
+        if (res != GREATEST_TEST_RES_PASS) { return res; }              \
+    } while (0)
+
+TEST configurations_should_round_trip(void) {
+    for (uint32_t seed=1; seed<=3; seed++) {
+        for (uint32_t size=1; size<=BUF_SIZE; size<<=2) {
+            CHECK_ROUND_TRIP((round_trip<4,3,1>(size, seed, 1)));
+            CHECK_ROUND_TRIP((round_trip<8,4,32>(size, seed, 512)));
+            CHECK_ROUND_TRIP((round_trip<9,8,64>(size, seed, 3)));
+            CHECK_ROUND_TRIP((round_trip<10,9,256>(size, seed, 512)));
+            CHECK_ROUND_TRIP((round_trip<12,4,256>(size, seed, 512)));
+            CHECK_ROUND_TRIP((round_trip<15,7,1024>(size, seed, 4096)));
+            CHECK_ROUND_TRIP((round_trip<15,14,1024>(size, seed, 7)));
+        }
+    }
+    PASS();
+}
+
+TEST runs_should_round_trip(void) {
+    for (uint32_t seed=1; seed<=3; seed++) {
+        for (uint32_t size=1; size<=BUF_SIZE; size<<=2) {
+            CHECK_ROUND_TRIP((round_trip<4,3,1>(size, seed, 1, fill_with_pseudorandom_runs)));
+            CHECK_ROUND_TRIP((round_trip<8,7,32>(size, seed, 7, fill_with_pseudorandom_runs)));
+            CHECK_ROUND_TRIP((round_trip<12,8,256>(size, seed, 512, fill_with_pseudorandom_runs)));
+        }
+    }
+    PASS();
+}
+
+#if HEATSHRINK_WIDE_INDEX
+/* Backref indexes (and counts) of more than 16 bits take an extra step. */
+TEST wide_windows_should_round_trip(void) {
+    for (uint32_t seed=1; seed<=2; seed++) {
+        CHECK_ROUND_TRIP((round_trip<17,5,1>(BUF_SIZE, seed, 7, fill_with_distant_repeat)));
+        CHECK_ROUND_TRIP((round_trip<18,16,16>(BUF_SIZE, seed, 512, fill_with_distant_repeat)));
+        CHECK_ROUND_TRIP((round_trip<20,17,64>(BUF_SIZE, seed, 4096, fill_with_distant_repeat)));
+    }
+    PASS();
+}
+#endif
+
+TEST dictionary_should_round_trip(void) {
+    static heatshrink::Encoder<10,5> encoder;
+    static heatshrink::Decoder<10,5,64> decoder;
+    static uint8_t dict[2048];
+    const size_t size = 4096;
+    fill_with_pseudorandom_letters(dict, sizeof(dict), 3);
+    fill_with_pseudorandom_letters(input, size, 5);
+    memcpy(input, &dict[sizeof(dict) - 300], 300);
+
+    encoder.reset();
+    ASSERT_EQ(HSER_DICTIONARY_OK, encoder.set_dictionary(dict, sizeof(dict)));
+    const size_t comp_sz = run_codec(encoder, input, size, comp, 512);
+
+    heatshrink_encoder *hse = heatshrink_encoder_alloc(10, 5);
+    heatshrink_encoder_set_dictionary(hse, dict, sizeof(dict));
+    size_t sunk = 0, comp_c_sz = 0, count = 0;
+    while (sunk < size) {
+        heatshrink_encoder_sink(hse, &input[sunk], size - sunk, &count);
+        sunk += count;
+        while (heatshrink_encoder_poll(hse, &comp_c[comp_c_sz], 512, &count) == HSER_POLL_MORE) {
+            comp_c_sz += count;
+        }
+        comp_c_sz += count;
+    }
+    while (heatshrink_encoder_finish(hse) == HSER_FINISH_MORE) {
+        heatshrink_encoder_poll(hse, &comp_c[comp_c_sz], 512, &count);
+        comp_c_sz += count;
+    }
+    heatshrink_encoder_free(hse);
+#if HEATSHRINK_C_API_IS_GREEDY
+    ASSERT_EQ(comp_c_sz, comp_sz);
+    ASSERT_EQ(0, memcmp(comp, comp_c, comp_sz));
+#endif
+
+    decoder.reset();
+    ASSERT_EQ(HSDR_DICTIONARY_OK, decoder.set_dictionary(dict, sizeof(dict)));
+    memset(decomp, 0, size);
+    ASSERT_EQ(size, run_codec(decoder, comp, comp_sz, decomp, 512));
+    ASSERT_EQ(0, memcmp(input, decomp, size));
+
+    decoder.reset();
+    ASSERT_EQ(HSDR_DICTIONARY_OK, decoder.set_dictionary(dict, sizeof(dict)));
+    memset(decomp, 0, size);
+    ASSERT_EQ(size, run_codec(decoder, comp_c, comp_c_sz, decomp, 512));
+    ASSERT_EQ(0, memcmp(input, decomp, size));
+    PASS();
+}
+
+SUITE(templates) {
+    RUN_TEST(dictionary_should_round_trip);
+    RUN_TEST(encoder_should_reject_misuse);
+    RUN_TEST(empty_input_should_finish_immediately);
+    RUN_TEST(configurations_should_round_trip);
+    RUN_TEST(runs_should_round_trip);
+#if HEATSHRINK_WIDE_INDEX
+    RUN_TEST(wide_windows_should_round_trip);
+#endif
+}
+
+GREATEST_MAIN_DEFS();
+
+int main(int argc, char **argv) {
+    GREATEST_MAIN_BEGIN();      /* command-line arguments, initialization. */
+    RUN_SUITE(templates);
+    GREATEST_MAIN_END();        /* display results */
+}
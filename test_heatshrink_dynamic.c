@@ -1,6 +1,14 @@
+/* MAP_ANON under -std=c99 */
+#define _DEFAULT_SOURCE
+
 #include <stdint.h>
 #include <ctype.h>
 #include <assert.h>
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/mman.h>
+#include <unistd.h>
+#define HAS_GUARD_PAGE 1
+#endif
 
 #include "heatshrink_encoder.h"
 #include "heatshrink_decoder.h"
@@ -14,6 +22,15 @@ SUITE(encoding);
 SUITE(decoding);
 SUITE(regression);
 SUITE(integration);
+SUITE(dictionary);
+#if HEATSHRINK_32BIT
+SUITE(one_shot);
+SUITE(tokens);
+SUITE(plus);
+#endif
+#if HEATSHRINK_WIDE_INDEX
+SUITE(wide_index);
+#endif
 
 #ifdef HEATSHRINK_HAS_THEFT
 SUITE(properties);
@@ -36,6 +53,20 @@ TEST encoder_alloc_should_reject_invalid_arguments(void) {
     PASS();
 }
 
+TEST encoder_alloc_ex_should_reject_invalid_level(void) {
+    heatshrink_encoder *hse = heatshrink_encoder_alloc_ex(8, 4, HEATSHRINK_LEVEL_MAX_RATIO + 1);
+    ASSERT_EQ(NULL, hse);
+    hse = heatshrink_encoder_alloc_ex(8, 4, HEATSHRINK_LEVEL_MAX_RATIO);
+    ASSERT(hse);
+    heatshrink_encoder_free(hse);
+    PASS();
+}
+
+TEST encoder_free_should_accept_null(void) {
+    heatshrink_encoder_free(NULL);
+    PASS();
+}
+
 TEST encoder_sink_should_reject_nulls(void) {
     heatshrink_encoder *hse = heatshrink_encoder_alloc(8, 7);
     uint8_t input[] = {'f', 'o', 'o'};
@@ -96,6 +127,36 @@ TEST encoder_sink_should_accept_partial_input_when_some_will_fit(void) {
     PASS();
 }
 
+TEST encoder_sink_should_accept_nothing_until_polled_when_full(void) {
+    heatshrink_encoder *hse = heatshrink_encoder_alloc(8, 7);
+    ASSERT(hse);
+    uint8_t input[512];
+    uint8_t output[512];
+    size_t bytes_copied = 0;
+    memset(input, '*', 512);
+    ASSERT_EQ(HSER_SINK_OK, heatshrink_encoder_sink(hse,
+            input, 512, &bytes_copied));
+    ASSERT_EQ(256, bytes_copied);
+#if HEATSHRINK_COMPACT_ENCODER
+    ASSERT_EQ(HSER_SINK_OK, heatshrink_encoder_sink(hse,
+            &input[256], 256, &bytes_copied));
+    ASSERT_EQ(0, bytes_copied);
+#else
+    ASSERT_EQ(HSER_SINK_ERROR_MISUSE, heatshrink_encoder_sink(hse,
+            &input[256], 256, &bytes_copied));
+#endif
+
+    size_t output_size = 0;
+    ASSERT_EQ(HSER_POLL_EMPTY, heatshrink_encoder_poll(hse,
+            output, 512, &output_size));
+    ASSERT_EQ(HSER_SINK_OK, heatshrink_encoder_sink(hse,
+            &input[256], 256, &bytes_copied));
+    ASSERT(bytes_copied > 0);
+
+    heatshrink_encoder_free(hse);
+    PASS();
+}
+
 TEST encoder_poll_should_indicate_when_no_input_is_provided(void) {
     heatshrink_encoder *hse = heatshrink_encoder_alloc(8, 7);
     uint8_t output[512];
@@ -234,10 +295,13 @@ TEST encoder_poll_should_detect_repeated_substring_and_preserve_trailing_literal
 
 SUITE(encoding) {
     RUN_TEST(encoder_alloc_should_reject_invalid_arguments);
+    RUN_TEST(encoder_alloc_ex_should_reject_invalid_level);
 
+    RUN_TEST(encoder_free_should_accept_null);
     RUN_TEST(encoder_sink_should_reject_nulls);
     RUN_TEST(encoder_sink_should_accept_input_when_it_will_fit);
     RUN_TEST(encoder_sink_should_accept_partial_input_when_some_will_fit);
+    RUN_TEST(encoder_sink_should_accept_nothing_until_polled_when_full);
 
     RUN_TEST(encoder_poll_should_reject_nulls);
     RUN_TEST(encoder_poll_should_indicate_when_no_input_is_provided);
@@ -274,6 +338,11 @@ TEST decoder_alloc_should_reject_lookahead_greater_than_window_size(void) {
     PASS();
 }
 
+TEST decoder_free_should_accept_null(void) {
+    heatshrink_decoder_free(NULL);
+    PASS();
+}
+
 TEST decoder_sink_should_reject_null_hsd_pointer(void) {
     uint8_t input[] = {0,1,2,3,4,5};
     size_t count = 0;
@@ -618,6 +687,7 @@ SUITE(decoding) {
     RUN_TEST(decoder_alloc_should_reject_lookahead_equal_to_window_size);
     RUN_TEST(decoder_alloc_should_reject_lookahead_greater_than_window_size);
 
+    RUN_TEST(decoder_free_should_accept_null);
     RUN_TEST(decoder_sink_should_reject_null_hsd_pointer);
     RUN_TEST(decoder_sink_should_reject_null_input_pointer);
     RUN_TEST(decoder_sink_should_reject_null_count_pointer);
@@ -648,12 +718,13 @@ typedef struct {
     uint8_t log_lvl;
     uint8_t window_sz2;
     uint8_t lookahead_sz2;
+    uint8_t level;
     size_t decoder_input_buffer_size;
 } cfg_info;
 
 static int compress_and_expand_and_check(uint8_t *input, uint32_t input_size, cfg_info *cfg) {
-    heatshrink_encoder *hse = heatshrink_encoder_alloc(cfg->window_sz2,
-        cfg->lookahead_sz2);
+    heatshrink_encoder *hse = heatshrink_encoder_alloc_ex(cfg->window_sz2,
+        cfg->lookahead_sz2, cfg->level);
     ASSERT(hse);
     heatshrink_decoder *hsd = heatshrink_decoder_alloc(cfg->decoder_input_buffer_size,
         cfg->window_sz2, cfg->lookahead_sz2);
@@ -766,7 +837,7 @@ TEST data_without_duplication_should_match(void) {
     uint8_t input[] = {'a', 'b', 'c', 'd', 'e', 'f', 'g', 'h', 'i',
                        'j', 'k', 'l', 'm', 'n', 'o', 'p', 'q', 'r',
                        's', 't', 'u', 'v', 'w', 'x', 'y', 'z'};
-    cfg_info cfg;
+    cfg_info cfg = {0};
     cfg.log_lvl = 0;
     cfg.window_sz2 = 8;
     cfg.lookahead_sz2 = 3;
@@ -779,7 +850,7 @@ TEST data_with_simple_repetition_should_compress_and_decompress_properly(void) {
                        'c', 'd', 'e', 'a', 'b', 'c', 'd', 'e', 'f',
                        'a', 'b', 'c', 'd', 'e', 'f', 'g', 'a', 'b',
                        'c', 'd', 'e', 'f', 'g', 'h'};
-    cfg_info cfg;
+    cfg_info cfg = {0};
     cfg.log_lvl = 0;
     cfg.window_sz2 = 8;
     cfg.lookahead_sz2 = 3;
@@ -799,12 +870,17 @@ TEST data_without_duplication_should_match_with_absurdly_tiny_buffers(void) {
     int log = 0;
 
     if (log) dump_buf("input", input, sizeof(input));
-    for (uint32_t i=0; i<sizeof(input); i++) {
+    size_t packed_count = 0;
+    for (uint32_t i=0; i<sizeof(input); i += count) {
         ASSERT(heatshrink_encoder_sink(hse, &input[i], 1, &count) >= 0);
+        if (count == 0) {       /* input buffer full (HEATSHRINK_COMPACT_ENCODER) */
+            size_t out_count = 0;
+            ASSERT(heatshrink_encoder_poll(hse, &comp[packed_count], 1, &out_count) >= 0);
+            packed_count += out_count;
+        }
     }
     ASSERT_EQ(HSER_FINISH_MORE, heatshrink_encoder_finish(hse));
 
-    size_t packed_count = 0;
     do {
         ASSERT(heatshrink_encoder_poll(hse, &comp[packed_count], 1, &count) >= 0);
         packed_count += count;
@@ -841,12 +917,17 @@ TEST data_with_simple_repetition_should_match_with_absurdly_tiny_buffers(void) {
     int log = 0;
 
     if (log) dump_buf("input", input, sizeof(input));
-    for (uint32_t i=0; i<sizeof(input); i++) {
+    size_t packed_count = 0;
+    for (uint32_t i=0; i<sizeof(input); i += count) {
         ASSERT(heatshrink_encoder_sink(hse, &input[i], 1, &count) >= 0);
+        if (count == 0) {       /* input buffer full (HEATSHRINK_COMPACT_ENCODER) */
+            size_t out_count = 0;
+            ASSERT(heatshrink_encoder_poll(hse, &comp[packed_count], 1, &out_count) >= 0);
+            packed_count += out_count;
+        }
     }
     ASSERT_EQ(HSER_FINISH_MORE, heatshrink_encoder_finish(hse));
 
-    size_t packed_count = 0;
     do {
         ASSERT(heatshrink_encoder_poll(hse, &comp[packed_count], 1, &count) >= 0);
         packed_count += count;
@@ -888,10 +969,85 @@ TEST pseudorandom_data_should_match(uint32_t size, uint32_t seed, cfg_info *cfg)
     return compress_and_expand_and_check(input, size, cfg);
 }
 
+/* Runs of one byte or of a pattern of up to 5 bytes, with a literal or two
+ * in between. */
+static void fill_with_pseudorandom_runs(uint8_t *buf, uint32_t size, uint32_t seed) {
+    uint64_t rn = 9223372036854775783; /* prime under 2^64 */
+    uint32_t i = 0;
+    while (i < size) {
+        rn = rn*seed + seed;
+        const uint32_t period = 1 + (rn >> 8) % 5;
+        const uint32_t length = 1 + (rn >> 16) % 300;
+        for (uint32_t j=0; j<period && i < size; j++) {
+            rn = rn*seed + seed;
+            buf[i++] = rn >> 24;
+        }
+        for (uint32_t j=period; j<length && i < size; j++, i++) {
+            buf[i] = buf[i - period];
+        }
+    }
+}
+
+TEST pseudorandom_runs_should_match(uint32_t size, uint32_t seed, cfg_info *cfg) {
+    uint8_t input[size];
+    fill_with_pseudorandom_runs(input, size, seed);
+    return compress_and_expand_and_check(input, size, cfg);
+}
+
+static size_t compressed_size(uint8_t *input, uint32_t input_size, uint8_t level) {
+    heatshrink_encoder *hse = heatshrink_encoder_alloc_ex(8, 4, level);
+    uint8_t output[256];
+    size_t sunk = 0, total = 0, count = 0;
+    while (sunk < input_size) {
+        heatshrink_encoder_sink(hse, &input[sunk], input_size - sunk, &count);
+        sunk += count;
+        if (sunk == input_size) { heatshrink_encoder_finish(hse); }
+        while (heatshrink_encoder_poll(hse, output, sizeof(output), &count) == HSER_POLL_MORE) {
+            total += count;
+        }
+        total += count;
+    }
+    heatshrink_encoder_free(hse);
+    return total;
+}
+
+TEST max_ratio_should_not_be_larger_than_default(void) {
+    uint32_t size = 4096;
+    uint8_t input[size];
+    for (uint32_t seed=1; seed<=10; seed++) {
+        fill_with_pseudorandom_letters(input, size, seed);
+        for (uint32_t i=0; i<size; i++) { input[i] = 'a' + (input[i] % 4); }
+        size_t greedy = compressed_size(input, size, HEATSHRINK_LEVEL_DEFAULT);
+        size_t optimal = compressed_size(input, size, HEATSHRINK_LEVEL_MAX_RATIO);
+        ASSERT(optimal <= greedy);
+    }
+    PASS();
+}
+
+TEST fastest_level_should_catch_up_after_incompressible_data(void) {
+    uint32_t size = 8192;
+    uint8_t input[size];
+    uint64_t rn = 9223372036854775783u;
+    for (uint32_t i=0; i<size/2; i++) {
+        rn = rn*7 + 7;
+        input[i] = rn >> 32;
+    }
+    for (uint32_t i=size/2; i<size; i++) { input[i] = 'a' + (i % 4); }
+    /* All literals: 9 bits per byte; the repetition: less than a bit per byte. */
+    ASSERT(compressed_size(input, size, HEATSHRINK_LEVEL_FASTEST) < (size/2)*9/8 + size/16);
+
+    cfg_info cfg = {0};
+    cfg.window_sz2 = 8;
+    cfg.lookahead_sz2 = 4;
+    cfg.level = HEATSHRINK_LEVEL_FASTEST;
+    cfg.decoder_input_buffer_size = 256;
+    return compress_and_expand_and_check(input, size, &cfg);
+}
+
 TEST small_input_buffer_should_not_impact_decoder_correctness(void) {
     int size = 5;
     uint8_t input[size];
-    cfg_info cfg;
+    cfg_info cfg = {0};
     cfg.log_lvl = 0;
     cfg.window_sz2 = 8;
     cfg.lookahead_sz2 = 3;
@@ -908,7 +1064,7 @@ TEST regression_backreference_counters_should_not_roll_over(void) {
     uint32_t seed = 3;
     uint8_t input[size];
     fill_with_pseudorandom_letters(input, size, seed);
-    cfg_info cfg;
+    cfg_info cfg = {0};
     cfg.log_lvl = 0;
     cfg.window_sz2 = 8;
     cfg.lookahead_sz2 = 3;
@@ -925,7 +1081,7 @@ TEST regression_index_fail(void) {
     uint32_t seed = 3;
     uint8_t input[size];
     fill_with_pseudorandom_letters(input, size, seed);
-    cfg_info cfg;
+    cfg_info cfg = {0};
     cfg.log_lvl = 0;
     cfg.window_sz2 = 8;
     cfg.lookahead_sz2 = 3;
@@ -940,7 +1096,7 @@ TEST sixty_four_k(void) {
     uint32_t seed = 1;
     uint8_t input[size];
     fill_with_pseudorandom_letters(input, size, seed);
-    cfg_info cfg;
+    cfg_info cfg = {0};
     cfg.log_lvl = 0;
     cfg.window_sz2 = 8;
     cfg.lookahead_sz2 = 3;
@@ -961,6 +1117,8 @@ SUITE(integration) {
     RUN_TEST(data_with_simple_repetition_should_compress_and_decompress_properly);
     RUN_TEST(data_without_duplication_should_match_with_absurdly_tiny_buffers);
     RUN_TEST(data_with_simple_repetition_should_match_with_absurdly_tiny_buffers);
+    RUN_TEST(max_ratio_should_not_be_larger_than_default);
+    RUN_TEST(fastest_level_should_catch_up_after_incompressible_data);
     
 #if __STDC_VERSION__ >= 19901L
     printf("\n\nFuzzing (single-byte sizes):\n");
@@ -971,7 +1129,7 @@ SUITE(integration) {
                 if (GREATEST_IS_VERBOSE()) printf(" -- input buffer %u\n", ibs);
                 for (uint32_t seed=1; seed<=10; seed++) {
                     if (GREATEST_IS_VERBOSE()) printf(" -- seed %u\n", seed);
-                    cfg_info cfg;
+                    cfg_info cfg = {0};
                     cfg.log_lvl = 0;
                     cfg.window_sz2 = 8;
                     cfg.lookahead_sz2 = lsize;
@@ -990,7 +1148,7 @@ SUITE(integration) {
                 if (GREATEST_IS_VERBOSE()) printf(" -- input buffer %u\n", ibs);
                 for (uint32_t seed=1; seed<=10; seed++) {
                     if (GREATEST_IS_VERBOSE()) printf(" -- seed %u\n", seed);
-                    cfg_info cfg;
+                    cfg_info cfg = {0};
                     cfg.log_lvl = 0;
                     cfg.window_sz2 = 11;
                     cfg.lookahead_sz2 = lsize;
@@ -1001,9 +1159,610 @@ SUITE(integration) {
         }
     }
 
+    printf("\nFuzzing (max. ratio):\n");
+    for (uint8_t lsize=3; lsize < 8; lsize += 2) {
+        for (uint32_t size=1; size < 128*1024L; size <<= 1) {
+            if (GREATEST_IS_VERBOSE()) printf(" -- size %u\n", size);
+            for (uint32_t seed=1; seed<=10; seed++) {
+                if (GREATEST_IS_VERBOSE()) printf(" -- seed %u\n", seed);
+                cfg_info cfg = {0};
+                cfg.log_lvl = 0;
+                cfg.window_sz2 = 9;
+                cfg.lookahead_sz2 = lsize;
+                cfg.level = HEATSHRINK_LEVEL_MAX_RATIO;
+                cfg.decoder_input_buffer_size = 256;
+                RUN_TESTp(pseudorandom_data_should_match, size, seed, &cfg);
+            }
+        }
+    }
+
+    printf("\nFuzzing (levels):\n");
+    for (uint8_t level=HEATSHRINK_LEVEL_FASTEST; level <= HEATSHRINK_LEVEL_SLOWEST; level++) {
+        for (uint32_t size=1; size < 128*1024L; size <<= 1) {
+            if (GREATEST_IS_VERBOSE()) printf(" -- size %u\n", size);
+            for (uint32_t seed=1; seed<=3; seed++) {
+                if (GREATEST_IS_VERBOSE()) printf(" -- seed %u\n", seed);
+                cfg_info cfg = {0};
+                cfg.log_lvl = 0;
+                cfg.window_sz2 = 12;
+                cfg.lookahead_sz2 = 5;
+                cfg.level = level;
+                cfg.decoder_input_buffer_size = 256;
+                RUN_TESTp(pseudorandom_data_should_match, size, seed, &cfg);
+            }
+        }
+    }
+
+    printf("\nFuzzing (runs):\n");
+    for (uint8_t wsize=4; wsize <= 12; wsize += 4) {
+        for (uint32_t size=1; size < 128*1024L; size <<= 1) {
+            if (GREATEST_IS_VERBOSE()) printf(" -- size %u\n", size);
+            for (uint32_t seed=1; seed<=3; seed++) {
+                if (GREATEST_IS_VERBOSE()) printf(" -- seed %u\n", seed);
+                const uint8_t levels[] = { HEATSHRINK_LEVEL_DEFAULT, HEATSHRINK_LEVEL_FASTEST,
+                    HEATSHRINK_LEVEL_MAX_RATIO };
+                for (uint32_t l=0; l<sizeof(levels); l++) {
+                    cfg_info cfg = {0};
+                    cfg.log_lvl = 0;
+                    cfg.window_sz2 = wsize;
+                    cfg.lookahead_sz2 = wsize - 1;
+                    cfg.level = levels[l];
+                    cfg.decoder_input_buffer_size = 256;
+                    RUN_TESTp(pseudorandom_runs_should_match, size, seed, &cfg);
+                }
+            }
+        }
+    }
+
+#endif
+}
+
+/* Compress IN to OUT with HSE, which is freed, polling at most OUT_CHUNK
+ * bytes at a time (0: as many as fit). */
+static size_t stream_compress(heatshrink_encoder *hse, const uint8_t *in, size_t in_size,
+        uint8_t *out, size_t out_size, size_t out_chunk) {
+    size_t sunk = 0, polled = 0, count = 0;
+    HSE_poll_res pres;
+    if (out_chunk == 0) { out_chunk = out_size; }
+    while (sunk < in_size) {
+        heatshrink_encoder_sink(hse, &in[sunk], in_size - sunk, &count);
+        sunk += count;
+        do {
+            pres = heatshrink_encoder_poll(hse, &out[polled],
+                out_chunk < out_size - polled ? out_chunk : out_size - polled, &count);
+            polled += count;
+        } while (pres == HSER_POLL_MORE);
+    }
+    while (heatshrink_encoder_finish(hse) == HSER_FINISH_MORE) {
+        heatshrink_encoder_poll(hse, &out[polled],
+            out_chunk < out_size - polled ? out_chunk : out_size - polled, &count);
+        polled += count;
+    }
+    heatshrink_encoder_free(hse);
+    return polled;
+}
+
+/* Expand IN to OUT with HSD, which is freed. */
+static size_t stream_decompress(heatshrink_decoder *hsd, const uint8_t *in, size_t in_size,
+        uint8_t *out, size_t out_size) {
+    size_t sunk = 0, polled = 0, count = 0;
+    while (sunk < in_size) {
+        heatshrink_decoder_sink(hsd, &in[sunk], in_size - sunk, &count);
+        sunk += count;
+        while (heatshrink_decoder_poll(hsd, &out[polled], out_size - polled, &count) == HSDR_POLL_MORE) {
+            polled += count;
+        }
+        polled += count;
+    }
+    while (heatshrink_decoder_finish(hsd) == HSDR_FINISH_MORE) {
+        heatshrink_decoder_poll(hsd, &out[polled], out_size - polled, &count);
+        polled += count;
+    }
+    heatshrink_decoder_free(hsd);
+    return polled;
+}
+
+#if HEATSHRINK_32BIT
+TEST one_shot_should_reject_invalid_arguments(void) {
+    uint8_t buf[16] = { 0 };
+    size_t count = 0;
+    ASSERT_EQ(HSER_COMPRESS_ERROR_NULL, heatshrink_compress(NULL, 4, buf, 16, 8, 4, &count));
+    ASSERT_EQ(HSER_COMPRESS_ERROR_NULL, heatshrink_compress(buf, 4, NULL, 16, 8, 4, &count));
+    ASSERT_EQ(HSER_COMPRESS_ERROR_NULL, heatshrink_compress(buf, 4, buf, 16, 8, 4, NULL));
+    ASSERT_EQ(HSER_COMPRESS_ERROR_MISUSE, heatshrink_compress(buf, 4, buf, 16, 8, 8, &count));
+    ASSERT_EQ(HSER_COMPRESS_ERROR_MISUSE,
+        heatshrink_compress(buf, 4, buf, 16, HEATSHRINK_MAX_WINDOW_BITS + 1, 4, &count));
+    ASSERT_EQ(HSDR_DECOMPRESS_ERROR_NULL, heatshrink_decompress(NULL, 4, buf, 16, 8, 4, &count));
+    ASSERT_EQ(HSDR_DECOMPRESS_ERROR_NULL, heatshrink_decompress(buf, 4, buf, 16, 8, 4, NULL));
+    ASSERT_EQ(HSDR_DECOMPRESS_ERROR_MISUSE,
+        heatshrink_decompress(buf, 4, buf, 16, HEATSHRINK_MIN_WINDOW_BITS - 1, 3, &count));
+    PASS();
+}
+
+TEST one_shot_should_report_full_output(void) {
+    uint8_t input[64];
+    uint8_t comp[HEATSHRINK_COMPRESS_BOUND(sizeof(input))];
+    uint8_t decomp[sizeof(input)];
+    size_t comp_sz = 0, decomp_sz = 0;
+    fill_with_pseudorandom_letters(input, sizeof(input), 1);
+    ASSERT_EQ(HSER_COMPRESS_OK,
+        heatshrink_compress(input, sizeof(input), comp, sizeof(comp), 8, 4, &comp_sz));
+    size_t count = 0;
+    ASSERT_EQ(HSER_COMPRESS_ERROR_OUTPUT_FULL,
+        heatshrink_compress(input, sizeof(input), comp, comp_sz - 1, 8, 4, &count));
+    ASSERT_EQ(HSDR_DECOMPRESS_ERROR_OUTPUT_FULL,
+        heatshrink_decompress(comp, comp_sz, decomp, sizeof(input) - 1, 8, 4, &decomp_sz));
+    ASSERT_EQ(sizeof(input) - 1, decomp_sz);
+    ASSERT_EQ(0, memcmp(input, decomp, decomp_sz));
+    PASS();
+}
+
+TEST one_shot_should_match_streaming(uint32_t size, uint32_t seed, uint8_t window_sz2,
+        uint8_t lookahead_sz2) {
+    uint8_t *input = malloc(size);
+    uint8_t *comp = malloc(heatshrink_compress_bound(size));
+    uint8_t *decomp = malloc(size + 1); /* room for the streaming decoder to poll */
+    if (input == NULL || comp == NULL || decomp == NULL) FAILm("malloc fail");
+    if (seed & 1) {
+        fill_with_pseudorandom_letters(input, size, seed);
+    } else {
+        fill_with_pseudorandom_runs(input, size, seed);
+    }
+
+    /* one-shot -> streaming and one-shot */
+    size_t comp_sz = 0, decomp_sz = 0;
+    ASSERT_EQ(HSER_COMPRESS_OK, heatshrink_compress(input, size,
+        comp, heatshrink_compress_bound(size), window_sz2, lookahead_sz2, &comp_sz));
+    ASSERT(comp_sz <= heatshrink_compress_bound(size));
+    ASSERT_EQ(size, stream_decompress(heatshrink_decoder_alloc(256, window_sz2, lookahead_sz2),
+        comp, comp_sz, decomp, size + 1));
+    ASSERT_EQ(0, memcmp(input, decomp, size));
+    memset(decomp, 0, size);
+    ASSERT_EQ(HSDR_DECOMPRESS_OK, heatshrink_decompress(comp, comp_sz,
+        decomp, size, window_sz2, lookahead_sz2, &decomp_sz));
+    ASSERT_EQ(size, decomp_sz);
+    ASSERT_EQ(0, memcmp(input, decomp, size));
+
+    /* streaming -> one-shot */
+    comp_sz = stream_compress(heatshrink_encoder_alloc(window_sz2, lookahead_sz2),
+        input, size, comp, heatshrink_compress_bound(size), 0);
+    memset(decomp, 0, size);
+    ASSERT_EQ(HSDR_DECOMPRESS_OK, heatshrink_decompress(comp, comp_sz,
+        decomp, size, window_sz2, lookahead_sz2, &decomp_sz));
+    ASSERT_EQ(size, decomp_sz);
+    ASSERT_EQ(0, memcmp(input, decomp, size));
+
+    free(input);
+    free(comp);
+    free(decomp);
+    PASS();
+}
+
+#if HAS_GUARD_PAGE
+/* Return a buffer of SIZE bytes which ends right before an inaccessible page,
+ * so that reading past its end faults. Free it with guarded_free. */
+static uint8_t *guarded_alloc(size_t size, size_t *map_size) {
+    const size_t page = sysconf(_SC_PAGESIZE);
+    *map_size = (size + page - 1) / page * page + page;
+    uint8_t *map = mmap(NULL, *map_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANON, -1, 0);
+    if (map == MAP_FAILED) { return NULL; }
+    if (mprotect(map + *map_size - page, page, PROT_NONE) != 0) {
+        munmap(map, *map_size);
+        return NULL;
+    }
+    return map + *map_size - page - size;
+}
+
+static void guarded_free(uint8_t *buf, size_t size, size_t map_size) {
+    const size_t page = sysconf(_SC_PAGESIZE);
+    munmap(buf + size + page - map_size, map_size);
+}
+
+/* The one-shot functions search and read the caller's buffers, which have
+ * no slack after their end. */
+TEST one_shot_should_not_read_past_the_input(const uint8_t *data, uint32_t size,
+        uint8_t window_sz2, uint8_t lookahead_sz2) {
+    size_t comp_cap = heatshrink_compress_bound(size);
+    size_t in_map = 0, comp_map = 0;
+    uint8_t *input = guarded_alloc(size, &in_map);
+    uint8_t *comp = malloc(comp_cap);
+    uint8_t *decomp = malloc(size + 1);
+    if (input == NULL || comp == NULL || decomp == NULL) FAILm("alloc fail");
+    memcpy(input, data, size);
+
+    size_t comp_sz = 0, decomp_sz = 0;
+    ASSERT_EQ(HSER_COMPRESS_OK, heatshrink_compress(input, size,
+        comp, comp_cap, window_sz2, lookahead_sz2, &comp_sz));
+    uint8_t *guarded_comp = guarded_alloc(comp_sz, &comp_map);
+    if (guarded_comp == NULL) FAILm("alloc fail");
+    memcpy(guarded_comp, comp, comp_sz);
+    ASSERT_EQ(HSDR_DECOMPRESS_OK, heatshrink_decompress(guarded_comp, comp_sz,
+        decomp, size, window_sz2, lookahead_sz2, &decomp_sz));
+    ASSERT_EQ(size, decomp_sz);
+    ASSERT_EQ(0, memcmp(data, decomp, size));
+
+    guarded_free(input, size, in_map);
+    guarded_free(guarded_comp, comp_sz, comp_map);
+    free(comp);
+    free(decomp);
+    PASS();
+}
+
+static void one_shot_guarded(void) {
+    static const uint8_t short_input[] = "ddccdaadcd";
+    RUN_TESTp(one_shot_should_not_read_past_the_input, short_input,
+        sizeof(short_input) - 1, 8, 6);
+    uint8_t input[512];
+    for (uint32_t seed=1; seed<=8; seed++) {
+        if (seed & 1) {
+            fill_with_pseudorandom_letters(input, sizeof(input), seed);
+        } else {
+            fill_with_pseudorandom_runs(input, sizeof(input), seed);
+        }
+        for (uint32_t size=1; size <= sizeof(input); size += (size < 64 ? 1 : 37)) {
+            RUN_TESTp(one_shot_should_not_read_past_the_input, input, size, 4, 3);
+            RUN_TESTp(one_shot_should_not_read_past_the_input, input, size, 8, 6);
+            RUN_TESTp(one_shot_should_not_read_past_the_input, input, size, 11, 4);
+        }
+    }
+}
+#endif
+
+SUITE(one_shot) {
+    RUN_TEST(one_shot_should_reject_invalid_arguments);
+    RUN_TEST(one_shot_should_report_full_output);
+#if HAS_GUARD_PAGE
+    one_shot_guarded();
+#endif
+    for (uint32_t size=1; size < 128*1024L; size <<= 1) {
+        for (uint32_t seed=1; seed<=4; seed++) {
+            RUN_TESTp(one_shot_should_match_streaming, size, seed, 4, 3);
+            RUN_TESTp(one_shot_should_match_streaming, size, seed, 8, 4);
+            RUN_TESTp(one_shot_should_match_streaming, size, seed, 11, 8);
+            RUN_TESTp(one_shot_should_match_streaming, size, seed, 15, 14);
+#if HEATSHRINK_WIDE_INDEX
+            RUN_TESTp(one_shot_should_match_streaming, size, seed, 20, 17);
+#endif
+        }
+    }
+}
+
+TEST tokens_should_reject_invalid_arguments(void) {
+    heatshrink_encoder *hse = heatshrink_encoder_alloc(8, 4);
+    heatshrink_token tokens[4];
+    size_t count = 0;
+    ASSERT_EQ(HSER_POLL_ERROR_NULL, heatshrink_encoder_poll_tokens(NULL, tokens, 4, &count));
+    ASSERT_EQ(HSER_POLL_ERROR_NULL, heatshrink_encoder_poll_tokens(hse, NULL, 4, &count));
+    ASSERT_EQ(HSER_POLL_ERROR_NULL, heatshrink_encoder_poll_tokens(hse, tokens, 4, NULL));
+    ASSERT_EQ(HSER_POLL_ERROR_MISUSE, heatshrink_encoder_poll_tokens(hse, tokens, 0, &count));
+    heatshrink_encoder_free(hse);
+    PASS();
+}
+
+TEST tokens_should_match_poll(uint32_t size, uint32_t seed, uint8_t window_sz2,
+        uint8_t lookahead_sz2, uint32_t max_tokens) {
+    uint8_t *input = malloc(size);
+    uint8_t *comp = malloc(heatshrink_compress_bound(size));
+    uint8_t *decomp = malloc(size);
+    heatshrink_token *tokens = malloc(max_tokens * sizeof(heatshrink_token));
+    if (input == NULL || comp == NULL || decomp == NULL || tokens == NULL) FAILm("malloc fail");
+    if (seed & 1) {
+        fill_with_pseudorandom_letters(input, size, seed);
+    } else {
+        fill_with_pseudorandom_runs(input, size, seed);
+    }
+    size_t comp_sz = stream_compress(heatshrink_encoder_alloc(window_sz2, lookahead_sz2),
+        input, size, comp, heatshrink_compress_bound(size), 0);
+
+    /* Replay the tokens into DECOMP, and count the bits poll would pack them in. */
+    heatshrink_encoder *hse = heatshrink_encoder_alloc(window_sz2, lookahead_sz2);
+    size_t sunk = 0, decomp_sz = 0, count = 0;
+    uint64_t bits = 0;
+    int finished = 0;
+    while (1) {
+        HSE_poll_res pres = heatshrink_encoder_poll_tokens(hse, tokens, max_tokens, &count);
+        ASSERT(pres >= 0);
+        for (size_t i = 0; i < count; i++) {
+            if (tokens[i].offset == 0) {
+                ASSERT(tokens[i].length <= 0xff);
+                ASSERT(decomp_sz < size);
+                decomp[decomp_sz++] = tokens[i].length;
+                bits += 9;
+            } else {
+                ASSERT(tokens[i].offset <= decomp_sz);
+                ASSERT(tokens[i].offset <= (1UL << window_sz2));
+                ASSERT(tokens[i].length >= 1);
+                ASSERT(tokens[i].length <= (1UL << lookahead_sz2));
+                ASSERT(decomp_sz + tokens[i].length <= size);
+                for (uint32_t j = 0; j < tokens[i].length; j++) {
+                    decomp[decomp_sz] = decomp[decomp_sz - tokens[i].offset];
+                    decomp_sz++;
+                }
+                bits += 1 + window_sz2 + lookahead_sz2;
+            }
+        }
+        if (pres == HSER_POLL_MORE) { continue; }
+        if (sunk < size) {
+            ASSERT_EQ(HSER_SINK_OK, heatshrink_encoder_sink(hse, &input[sunk], size - sunk, &count));
+            sunk += count;
+        } else if (finished) {
+            break;
+        } else {
+            finished = (heatshrink_encoder_finish(hse) == HSER_FINISH_DONE);
+        }
+    }
+    heatshrink_encoder_free(hse);
+
+    ASSERT_EQ(size, decomp_sz);
+    ASSERT_EQ(0, memcmp(input, decomp, size));
+    ASSERT_EQ(comp_sz, (bits + 7) / 8);
+
+    free(input);
+    free(comp);
+    free(decomp);
+    free(tokens);
+    PASS();
+}
+
+SUITE(tokens) {
+    RUN_TEST(tokens_should_reject_invalid_arguments);
+    for (uint32_t size=1; size < 128*1024L; size <<= 2) {
+        for (uint32_t seed=1; seed<=4; seed++) {
+            RUN_TESTp(tokens_should_match_poll, size, seed, 4, 3, 1);
+            RUN_TESTp(tokens_should_match_poll, size, seed, 8, 4, 7);
+            RUN_TESTp(tokens_should_match_poll, size, seed, 11, 8, 256);
+            RUN_TESTp(tokens_should_match_poll, size, seed, 15, 14, 4096);
+        }
+    }
+}
+
+/* Coders for the heatshrink+ format; the decoder sinks at most IN_CHUNK
+ * bytes at a time. */
+static heatshrink_encoder *plus_encoder(uint8_t window_sz2, uint8_t lookahead_sz2) {
+    return heatshrink_encoder_alloc_plus(window_sz2, lookahead_sz2, HEATSHRINK_LEVEL_DEFAULT);
+}
+
+static heatshrink_decoder *plus_decoder(uint8_t window_sz2, uint8_t lookahead_sz2,
+        uint16_t in_chunk) {
+    return heatshrink_decoder_alloc_plus(in_chunk, window_sz2, lookahead_sz2);
+}
+
+TEST plus_should_reject_invalid_arguments(void) {
+    ASSERT_EQ(NULL, heatshrink_encoder_alloc_plus(8, 8, HEATSHRINK_LEVEL_DEFAULT));
+    ASSERT_EQ(NULL, heatshrink_encoder_alloc_plus(8, 4, HEATSHRINK_LEVEL_MAX_RATIO + 1));
+    ASSERT_EQ(NULL, heatshrink_decoder_alloc_plus(0, 8, 4));
+    ASSERT_EQ(NULL, heatshrink_decoder_alloc_plus(256, HEATSHRINK_MAX_WINDOW_BITS + 1, 4));
+    PASS();
+}
+
+TEST plus_should_expand_empty_input(void) {
+    const uint8_t input[1] = { 0 };
+    uint8_t comp[16], decomp[4];
+    size_t comp_sz = stream_compress(plus_encoder(8, 4), input, 0, comp, sizeof(comp), 0);
+    ASSERT(comp_sz > 0);    /* the end marker */
+    ASSERT_EQ(0, stream_decompress(plus_decoder(8, 4, 1), comp, comp_sz, decomp, sizeof(decomp)));
+    PASS();
+}
+
+TEST plus_decoder_should_ignore_input_after_end(void) {
+    uint8_t input[512], comp[HEATSHRINK_COMPRESS_BOUND(sizeof(input)) + 64];
+    uint8_t decomp[sizeof(input) + 1]; /* room for the decoder to poll */
+    fill_with_pseudorandom_letters(input, sizeof(input), 3);
+    size_t comp_sz = stream_compress(plus_encoder(8, 4), input, sizeof(input),
+        comp, sizeof(comp), 0);
+    memset(&comp[comp_sz], 0xFF, 64);
+    ASSERT_EQ(sizeof(input), stream_decompress(plus_decoder(8, 4, 16), comp, comp_sz + 64,
+        decomp, sizeof(decomp)));
+    ASSERT_EQ(0, memcmp(input, decomp, sizeof(input)));
+    PASS();
+}
+
+TEST plus_should_match(uint32_t size, uint32_t seed, uint8_t window_sz2,
+        uint8_t lookahead_sz2, uint16_t in_chunk, uint32_t out_chunk) {
+    uint8_t *input = malloc(size);
+    size_t comp_size = HEATSHRINK_COMPRESS_BOUND(size) + 64;
+    uint8_t *comp = malloc(comp_size);
+    uint8_t *decomp = malloc(size + 1);
+    if (input == NULL || comp == NULL || decomp == NULL) FAILm("malloc fail");
+    if (seed & 1) {
+        fill_with_pseudorandom_letters(input, size, seed);
+    } else {
+        fill_with_pseudorandom_runs(input, size, seed);
+    }
+    size_t comp_sz = stream_compress(plus_encoder(window_sz2, lookahead_sz2), input, size,
+        comp, comp_size, out_chunk);
+    ASSERT(comp_sz < comp_size);
+    ASSERT_EQ(size, stream_decompress(plus_decoder(window_sz2, lookahead_sz2, in_chunk),
+        comp, comp_sz, decomp, size + 1));
+    ASSERT_EQ(0, memcmp(input, decomp, size));
+    free(input);
+    free(comp);
+    free(decomp);
+    PASS();
+}
+
+TEST plus_should_compress_text_better(void) {
+    static const char *words[] = {
+        "sensor", "temperature", "ok", "battery", "level", "low", "radio", "link",
+        "up", "down", "retry", "timeout", "the", "of", "and", "to",
+    };
+    const uint32_t size = 16 * 1024;
+    uint8_t *input = malloc(size);
+    uint8_t *plain = malloc(HEATSHRINK_COMPRESS_BOUND(size));
+    uint8_t *comp = malloc(HEATSHRINK_COMPRESS_BOUND(size));
+    if (input == NULL || plain == NULL || comp == NULL) FAILm("malloc fail");
+    uint32_t rn = 12345, i = 0;
+    while (i < size) {
+        rn = rn * 1103515245 + 12345;
+        const char *word = words[(rn >> 16) % 16];
+        for (uint32_t j = 0; word[j] != '\0' && i < size; j++) { input[i++] = word[j]; }
+        if (i < size) { input[i++] = ((rn >> 8) & 7) == 0 ? '\n' : ' '; }
+    }
+    size_t plain_sz = stream_compress(heatshrink_encoder_alloc(8, 4), input, size,
+        plain, HEATSHRINK_COMPRESS_BOUND(size), 0);
+    size_t comp_sz = stream_compress(plus_encoder(8, 4), input, size,
+        comp, HEATSHRINK_COMPRESS_BOUND(size), 256);
+    /* the same tokens, in at least 5% fewer bytes */
+    ASSERT(comp_sz < plain_sz - plain_sz / 20);
+    free(input);
+    free(plain);
+    free(comp);
+    PASS();
+}
+
+SUITE(plus) {
+    RUN_TEST(plus_should_reject_invalid_arguments);
+    RUN_TEST(plus_should_expand_empty_input);
+    RUN_TEST(plus_decoder_should_ignore_input_after_end);
+    RUN_TEST(plus_should_compress_text_better);
+    for (uint32_t size=1; size < 128*1024L; size <<= 2) {
+        for (uint32_t seed=1; seed<=4; seed++) {
+            RUN_TESTp(plus_should_match, size, seed, 4, 3, 1, 1);
+            RUN_TESTp(plus_should_match, size, seed, 8, 4, 3, 7);
+            RUN_TESTp(plus_should_match, size, seed, 11, 8, 256, 4096);
+            RUN_TESTp(plus_should_match, size, seed, 15, 14, 64, 1 << 20);
+#if HEATSHRINK_WIDE_INDEX
+            RUN_TESTp(plus_should_match, size, seed, 20, 17, 64, 1 << 20);
+#endif
+        }
+    }
+}
+#endif
+
+static heatshrink_encoder *dictionary_encoder(uint8_t window_sz2, uint8_t lookahead_sz2,
+        uint8_t level, int plus) {
+#if HEATSHRINK_32BIT
+    if (plus) { return heatshrink_encoder_alloc_plus(window_sz2, lookahead_sz2, level); }
 #endif
+    return heatshrink_encoder_alloc_ex(window_sz2, lookahead_sz2, level);
+    (void)plus;
 }
 
+static heatshrink_decoder *dictionary_decoder(uint8_t window_sz2, uint8_t lookahead_sz2,
+        int plus) {
+#if HEATSHRINK_32BIT
+    if (plus) { return heatshrink_decoder_alloc_plus(64, window_sz2, lookahead_sz2); }
+#endif
+    return heatshrink_decoder_alloc(64, window_sz2, lookahead_sz2);
+    (void)plus;
+}
+
+TEST dictionary_should_reject_invalid_arguments(void) {
+    uint8_t dict[4] = { 'a', 'b', 'c', 'd' };
+    size_t count = 0;
+    heatshrink_encoder *hse = heatshrink_encoder_alloc(8, 4);
+    heatshrink_decoder *hsd = heatshrink_decoder_alloc(16, 8, 4);
+    ASSERT_EQ(HSER_DICTIONARY_ERROR_NULL, heatshrink_encoder_set_dictionary(NULL, dict, 4));
+    ASSERT_EQ(HSER_DICTIONARY_ERROR_NULL, heatshrink_encoder_set_dictionary(hse, NULL, 4));
+    ASSERT_EQ(HSER_DICTIONARY_OK, heatshrink_encoder_set_dictionary(hse, NULL, 0));
+    ASSERT_EQ(HSER_SINK_OK, heatshrink_encoder_sink(hse, dict, 4, &count));
+    ASSERT_EQ(HSER_DICTIONARY_ERROR_MISUSE, heatshrink_encoder_set_dictionary(hse, dict, 4));
+    ASSERT_EQ(HSDR_DICTIONARY_ERROR_NULL, heatshrink_decoder_set_dictionary(NULL, dict, 4));
+    ASSERT_EQ(HSDR_DICTIONARY_ERROR_NULL, heatshrink_decoder_set_dictionary(hsd, NULL, 4));
+    ASSERT_EQ(HSDR_SINK_OK, heatshrink_decoder_sink(hsd, dict, 4, &count));
+    ASSERT_EQ(HSDR_DICTIONARY_ERROR_MISUSE, heatshrink_decoder_set_dictionary(hsd, dict, 4));
+    heatshrink_encoder_free(hse);
+    heatshrink_decoder_free(hsd);
+    PASS();
+}
+
+/* A message which starts like the end of a dictionary of twice the window,
+ * compressed with and without it. */
+TEST dictionary_should_match(uint32_t size, uint8_t window_sz2, uint8_t lookahead_sz2,
+        uint8_t level, int plus) {
+    const uint32_t window_sz = 1 << window_sz2;
+    const uint32_t dict_size = 2 * window_sz;
+    uint8_t *dict = malloc(dict_size);
+    uint8_t *input = malloc(size);
+    size_t comp_size = HEATSHRINK_COMPRESS_BOUND(size) + 64;
+    uint8_t *comp = malloc(comp_size);
+    uint8_t *decomp = malloc(size + 1);
+    if (dict == NULL || input == NULL || comp == NULL || decomp == NULL) FAILm("malloc fail");
+    fill_with_pseudorandom_letters(dict, dict_size, 3);
+    fill_with_pseudorandom_letters(input, size, 5);
+    memcpy(input, &dict[dict_size - window_sz / 2], size < window_sz / 2 ? size : window_sz / 2);
+
+    size_t plain_sz = stream_compress(dictionary_encoder(window_sz2, lookahead_sz2, level, plus),
+        input, size, comp, comp_size, 0);
+    heatshrink_encoder *hse = dictionary_encoder(window_sz2, lookahead_sz2, level, plus);
+    heatshrink_decoder *hsd = dictionary_decoder(window_sz2, lookahead_sz2, plus);
+    ASSERT_EQ(HSER_DICTIONARY_OK, heatshrink_encoder_set_dictionary(hse, dict, dict_size));
+    ASSERT_EQ(HSDR_DICTIONARY_OK, heatshrink_decoder_set_dictionary(hsd, dict, dict_size));
+    size_t comp_sz = stream_compress(hse, input, size, comp, comp_size, 0);
+    ASSERT(comp_sz < comp_size);
+    if (size >= 16) { ASSERT(comp_sz < plain_sz); }
+    ASSERT_EQ(size, stream_decompress(hsd, comp, comp_sz, decomp, size + 1));
+    ASSERT_EQ(0, memcmp(input, decomp, size));
+    free(dict);
+    free(input);
+    free(comp);
+    free(decomp);
+    PASS();
+}
+
+SUITE(dictionary) {
+    RUN_TEST(dictionary_should_reject_invalid_arguments);
+    for (uint32_t size=1; size < 64*1024L; size <<= 2) {
+        RUN_TESTp(dictionary_should_match, size, 4, 3, HEATSHRINK_LEVEL_DEFAULT, 0);
+        RUN_TESTp(dictionary_should_match, size, 8, 4, HEATSHRINK_LEVEL_DEFAULT, 0);
+        RUN_TESTp(dictionary_should_match, size, 11, 5, HEATSHRINK_LEVEL_DEFAULT, 0);
+        RUN_TESTp(dictionary_should_match, size, 15, 8, HEATSHRINK_LEVEL_DEFAULT, 0);
+#if HEATSHRINK_32BIT
+        RUN_TESTp(dictionary_should_match, size, 9, 4, HEATSHRINK_LEVEL_FASTEST, 0);
+        RUN_TESTp(dictionary_should_match, size, 9, 4, HEATSHRINK_LEVEL_MAX_RATIO, 0);
+        RUN_TESTp(dictionary_should_match, size, 11, 5, HEATSHRINK_LEVEL_DEFAULT, 1);
+#endif
+    }
+}
+
+#if HEATSHRINK_WIDE_INDEX
+TEST wide_window_should_reach_back_beyond_64k(void) {
+    /* A, B, A again: the second A is one (or a few) backrefs with index and
+     * count bits beyond 2 bytes. */
+    const uint32_t a_size = 80 * 1024, b_size = 160 * 1024;
+    const uint32_t size = a_size + b_size + a_size;
+    uint8_t *input = malloc(size);
+    uint8_t *comp = malloc(heatshrink_compress_bound(size));
+    if (input == NULL || comp == NULL) FAILm("malloc fail");
+    fill_with_pseudorandom_runs(input, a_size, 2);
+    fill_with_pseudorandom_runs(&input[a_size], b_size, 4);
+    memcpy(&input[a_size + b_size], input, a_size);
+
+    const size_t ab_sz = stream_compress(heatshrink_encoder_alloc(18, 17), input,
+        a_size + b_size, comp, heatshrink_compress_bound(size), 0);
+    const size_t aba_sz = stream_compress(heatshrink_encoder_alloc(18, 17), input,
+        size, comp, heatshrink_compress_bound(size), 0);
+    ASSERT(aba_sz < ab_sz + 64);
+    free(input);
+    free(comp);
+    PASS();
+}
+
+TEST wide_window_should_match_with_tiny_decoder_input(void) {
+    /* Decoding suspends between (and within) the bytes of the 3-byte index
+     * and count. (With fewer than 8 bytes of input, a poll could yield
+     * nothing, which compress_and_expand_and_check doesn't expect.) */
+    const uint32_t a_size = 70 * 1024, b_size = 8 * 1024;
+    const uint32_t size = a_size + b_size + a_size;
+    uint8_t *input = malloc(size);
+    if (input == NULL) FAILm("malloc fail");
+    fill_with_pseudorandom_letters(input, a_size + b_size, 3);
+    memcpy(&input[a_size + b_size], input, a_size);
+    cfg_info cfg = {0};
+    cfg.window_sz2 = 20;
+    cfg.lookahead_sz2 = 17;
+    cfg.decoder_input_buffer_size = 8;
+    int res = compress_and_expand_and_check(input, size, &cfg);
+    free(input);
+    return res;
+}
+
+SUITE(wide_index) {
+    RUN_TEST(wide_window_should_reach_back_beyond_64k);
+    RUN_TEST(wide_window_should_match_with_tiny_decoder_input);
+}
+#endif
+
 /* Add all the definitions that need to be in the test runner's main file. */
 GREATEST_MAIN_DEFS();
 
@@ -1013,6 +1772,15 @@ int main(int argc, char **argv) {
     RUN_SUITE(decoding);
     RUN_SUITE(regression);
     RUN_SUITE(integration);
+    RUN_SUITE(dictionary);
+#if HEATSHRINK_32BIT
+    RUN_SUITE(one_shot);
+    RUN_SUITE(tokens);
+    RUN_SUITE(plus);
+#endif
+#if HEATSHRINK_WIDE_INDEX
+    RUN_SUITE(wide_index);
+#endif
     #ifdef HEATSHRINK_HAS_THEFT
     RUN_SUITE(properties);
     #endif